@@ -5,6 +5,27 @@
 
 namespace cheesebase {
 
+namespace {
+
+size_t tierOf(size_t size) {
+  if (size <= T4Allocator::size())
+    return 4;
+  else if (size <= T3Allocator::size())
+    return 3;
+  else if (size <= T2Allocator::size())
+    return 2;
+  else if (size <= T1Allocator::size())
+    return 1;
+  else if (size <= PageAllocator::size())
+    return 0;
+  else
+    throw AllocError("requested size to big");
+}
+
+constexpr size_t tierSize(size_t tier) { return k_page_size >> tier; }
+
+} // anonymous namespace
+
 Allocator::Allocator(const DskDatabaseHdr& h, Storage& store)
     : pg_alloc_(store, h.free_alloc_pg, h.end_of_file)
     , t1_alloc_(store, h.free_alloc_t1, pg_alloc_)
@@ -13,93 +34,121 @@ Allocator::Allocator(const DskDatabaseHdr& h, Storage& store)
     , t4_alloc_(store, h.free_alloc_t4, t3_alloc_) {}
 
 AllocTransaction Allocator::startTransaction() {
-  return AllocTransaction(*this, ExLock<Mutex>{ mutex_ });
+  return AllocTransaction(*this);
 }
 
-std::pair<Block, std::vector<AllocWrite>>
-AllocTransaction::allocBlock(size_t size) {
-  if (size <= alloc_->t4_alloc_.size())
-    return alloc_->t4_alloc_.allocBlock();
-  else if (size <= alloc_->t3_alloc_.size())
-    return alloc_->t3_alloc_.allocBlock();
-  else if (size <= alloc_->t2_alloc_.size())
-    return alloc_->t2_alloc_.allocBlock();
-  else if (size <= alloc_->t1_alloc_.size())
-    return alloc_->t1_alloc_.allocBlock();
-  else if (size <= alloc_->pg_alloc_.size())
-    return alloc_->pg_alloc_.allocBlock();
-  else
-    throw AllocError("requested size to big");
+Block Allocator::allocBlock(size_t tier) {
+  std::pair<Block, std::vector<AllocWrite>> alloc;
+  switch (tier) {
+  case 0:
+    alloc = pg_alloc_.allocBlock();
+    break;
+  case 1:
+    alloc = t1_alloc_.allocBlock();
+    break;
+  case 2:
+    alloc = t2_alloc_.allocBlock();
+    break;
+  case 3:
+    alloc = t3_alloc_.allocBlock();
+    break;
+  default:
+    alloc = t4_alloc_.allocBlock();
+    break;
+  }
+
+  addPending(alloc.second);
+  // a Next written in while the block was free is obsolete now
+  pending_.erase(alloc.first.addr);
+  return alloc.first;
 }
 
-std::vector<AllocWrite> AllocTransaction::freeBlock(Addr addr, size_t size) {
-  if (size <= alloc_->t4_alloc_.size())
-    return alloc_->t4_alloc_.freeBlock(addr);
-  else if (size <= alloc_->t3_alloc_.size())
-    return alloc_->t3_alloc_.freeBlock(addr);
-  else if (size <= alloc_->t2_alloc_.size())
-    return alloc_->t2_alloc_.freeBlock(addr);
-  else if (size <= alloc_->t1_alloc_.size())
-    return alloc_->t1_alloc_.freeBlock(addr);
-  else if (size <= alloc_->pg_alloc_.size())
-    return alloc_->pg_alloc_.freeBlock(addr);
-  else
-    throw AllocError("requested size to big");
+void Allocator::freeBlock(size_t tier, Addr addr) {
+  switch (tier) {
+  case 0:
+    addPending(pg_alloc_.freeBlock(addr));
+    break;
+  case 1:
+    addPending(t1_alloc_.freeBlock(addr));
+    break;
+  case 2:
+    addPending(t2_alloc_.freeBlock(addr));
+    break;
+  case 3:
+    addPending(t3_alloc_.freeBlock(addr));
+    break;
+  default:
+    addPending(t4_alloc_.freeBlock(addr));
+    break;
+  }
 }
 
-void Allocator::clearCache() {
-  pg_alloc_.clearCache();
-  t1_alloc_.clearCache();
-  t2_alloc_.clearCache();
-  t3_alloc_.clearCache();
-  t4_alloc_.clearCache();
+void Allocator::addPending(const std::vector<AllocWrite>& writes) {
+  for (auto& w : writes) pending_[w.first] = w.second;
 }
 
-AllocTransaction::AllocTransaction(Allocator& alloc, ExLock<Mutex> lock)
-    : alloc_(&alloc), lock_(std::move(lock)){};
+AllocTransaction::AllocTransaction(Allocator& alloc) : alloc_(&alloc){};
 
 AllocTransaction::~AllocTransaction() { end(); }
 
 Block AllocTransaction::alloc(size_t size) {
-  Expects(lock_.owns_lock());
-  auto alloc = allocBlock(size);
-  auto& block = alloc.first;
-  auto& writes = alloc.second;
-
-  // in case it was freed in the same TA and has a Next written in
-  writes_.erase(block.addr);
-  for (auto& w : writes) {
-    writes_[w.first] = w.second;
+  Expects(!lock_.owns_lock());
+  auto tier = tierOf(size);
+
+  // reuse what this transaction freed before
+  auto& local = freed_[tier];
+  if (!local.empty()) {
+    auto addr = local.back();
+    local.pop_back();
+    return { addr, tierSize(tier) };
   }
+
+  Guard<Mutex> guard{ alloc_->mutex_ };
+  auto block = alloc_->allocBlock(tier);
+  allocated_[tier].push_back(block.addr);
   return block;
 }
 
 void AllocTransaction::free(Block block) { free(block.addr, block.size); }
 
 void AllocTransaction::free(Addr addr, size_t size) {
-  Expects(lock_.owns_lock());
-  for (auto& w : freeBlock(addr, size)) {
-    writes_[w.first] = w.second;
-  }
+  Expects(!lock_.owns_lock());
+  freed_[tierOf(size)].push_back(addr);
 }
 
 std::vector<Write> AllocTransaction::commit() {
-  Expects(lock_.owns_lock());
-  std::vector<Write> writes;
-  writes.reserve(writes_.size());
+  Expects(!lock_.owns_lock());
+  lock_ = ExLock<Mutex>(alloc_->mutex_);
 
-  for (auto& w : writes_) {
+  for (size_t tier = 0; tier < k_alloc_tiers; ++tier) {
+    for (auto addr : freed_[tier]) alloc_->freeBlock(tier, addr);
+    freed_[tier].clear();
+    allocated_[tier].clear();
+  }
+
+  std::vector<Write> writes;
+  writes.reserve(alloc_->pending_.size());
+  for (auto& w : alloc_->pending_) {
     writes.push_back({ w.first, w.second });
   }
+  alloc_->pending_.clear();
 
   return writes;
 }
 
 void AllocTransaction::end() {
-  writes_.clear();
   if (lock_.owns_lock()) {
-    alloc_->clearCache();
     lock_.unlock();
+    return;
+  }
+
+  // not committed, allocated blocks are unused
+  ExLock<Mutex> lck{ alloc_->mutex_, boost::defer_lock };
+  for (size_t tier = 0; tier < k_alloc_tiers; ++tier) {
+    if (!allocated_[tier].empty() && !lck.owns_lock()) lck.lock();
+    for (auto addr : allocated_[tier]) alloc_->freeBlock(tier, addr);
+    allocated_[tier].clear();
+    freed_[tier].clear();
   }
 }
 
@@ -4,11 +4,21 @@
 
 #include "block_alloc.h"
 #include <boost/container/flat_map.hpp>
+#include <array>
 
 namespace cheesebase {
 
 class Allocator;
 
+// Number of block sizes, from one page (tier 0) down to 1/16 page (tier 4).
+constexpr size_t k_alloc_tiers{ 5 };
+
+// Allocations of one transaction. The allocator is only locked for the
+// duration of single calls, so transactions can allocate concurrently:
+// - Allocated blocks are taken from the shared free lists right away. If the
+//   transaction ends without commit they are given back.
+// - Freed blocks are kept local until commit, so no other transaction can
+//   reuse them before. The transaction itself may reuse them.
 class AllocTransaction {
   friend class Allocator;
 
@@ -23,22 +33,24 @@ public:
   void free(Addr addr, size_t size);
   void free(Block block);
 
-  // Get writes of all done changes to pass to the storage.
+  // Apply the frees and get writes of all pending changes of the allocator to
+  // pass to the storage. Locks the allocator until end() is called, so the
+  // writes have to be passed on to the journal before, keeping the commits of
+  // multiple transactions in order.
   std::vector<Write> commit();
 
   // End the transaction, clearing the object and allowing it to be reused.
+  // Gives back allocated blocks if not committed.
   // note: it is not required to end() before destructing the object.
   void end();
 
 private:
-  AllocTransaction(Allocator& alloc, ExLock<Mutex> lock);
-
-  std::pair<Block, std::vector<AllocWrite>> allocBlock(size_t size);
-  std::vector<AllocWrite> freeBlock(Addr addr, size_t size);
+  AllocTransaction(Allocator& alloc);
 
   Allocator* alloc_;
   ExLock<Mutex> lock_;
-  boost::container::flat_map<Addr, uint64_t> writes_;
+  std::array<std::vector<Addr>, k_alloc_tiers> allocated_;
+  std::array<std::vector<Addr>, k_alloc_tiers> freed_;
 };
 
 class Allocator {
@@ -50,7 +62,13 @@ public:
   AllocTransaction startTransaction();
 
 private:
-  void clearCache();
+  // Take a block from the free list of a tier, needs mutex_.
+  Block allocBlock(size_t tier);
+
+  // Add a block to the free list of a tier, needs mutex_.
+  void freeBlock(size_t tier, Addr addr);
+
+  void addPending(const std::vector<AllocWrite>& writes);
 
   Mutex mutex_;
   PageAllocator pg_alloc_;
@@ -58,6 +76,10 @@ private:
   T2Allocator t2_alloc_;
   T3Allocator t3_alloc_;
   T4Allocator t4_alloc_;
+
+  // Changes of the free lists not passed to the storage yet. They are written
+  // by the next committing transaction, whichever that is.
+  boost::container::flat_map<Addr, uint64_t> pending_;
 };
 
 } // namespace cheesebase
@@ -25,24 +25,32 @@ Addr T4Allocator::hdrOffset() {
   return Addr(offsetof(DskDatabaseHdr, free_alloc_t4));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// BlockAllocator
+
+template <class Next, size_t Size>
+Addr BlockAllocator::popNext() {
+  auto lookup = next_cache_.find(free_);
+  if (lookup != next_cache_.end()) {
+    auto next = lookup->second;
+    next_cache_.erase(lookup);
+    return next;
+  }
+
+  auto block = store_.loadBlock<Size>(free_);
+  auto& next = bytesAsType<Next>(*block);
+  if (next.next().value % Size != 0)
+    throw ConsistencyError("Invalid header in block of free list");
+  return next.next();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PageAllocator
 
 std::pair<Block, std::vector<AllocWrite>> PageAllocator::allocBlock() {
   if (free_.value != 0) {
     auto page = free_;
-
-    Addr next = [&] {
-      auto lookup = next_cache_.find(page);
-      if (lookup != next_cache_.end()) {
-        return lookup->second;
-      }
-      auto block = store_.loadBlock<size()>(free_);
-      auto& next = bytesAsType<Next>(*block);
-      if (next.next().pageOffset() != 0)
-        throw ConsistencyError("Invalid header in block of free list");
-      return next.next();
-    }();
+    auto next = popNext<Next, size()>();
 
     free_ = next;
     return { { page, size() }, { { hdrOffset(), free_.value } } };
@@ -68,21 +76,7 @@ template <class P, BlockType T>
 std::pair<Block, std::vector<AllocWrite>> TierAllocator<P, T>::allocBlock() {
   if (free_.value != 0) {
     auto block = free_;
-
-    Addr next = [&] {
-      auto lookup = next_cache_.find(block);
-      if (lookup != next_cache_.end()) {
-        return lookup->second;
-      }
-
-      auto block = store_.loadBlock<size()>(free_);
-      auto& next = bytesAsType<Next>(*block);
-
-      if (next.next().value % size() != 0)
-        throw ConsistencyError("Invalid header in block of free list");
-
-      return next.next();
-    }();
+    auto next = popNext<Next, size()>();
 
     free_ = next;
     return { { block, size() }, { { hdrOffset(), free_.value } } };
@@ -98,7 +92,7 @@ std::pair<Block, std::vector<AllocWrite>> TierAllocator<P, T>::allocBlock() {
 
     // half of the parent block is unused
     free_.value = block.addr.value + size();
-    next_cache_.emplace(free_, Addr(0));
+    next_cache_[free_] = Addr(0);
 
     writes.reserve(writes.size() + 2);
     writes.push_back({ hdrOffset(), free_.value });
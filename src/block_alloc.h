@@ -43,12 +43,19 @@ class BlockAllocator {
 public:
   void setFirstFree(Addr free) { free_ = free; }
   Addr getFirstFree() const { return free_; }
-  void clearCache() { next_cache_.clear(); }
 
 protected:
   BlockAllocator(Storage& store, Addr free) : free_(free), store_(store) {}
+
+  // Get the successor of the first free block and remove it from the cache.
+  template <class Next, size_t Size>
+  Addr popNext();
+
   Addr free_{ 0 };
   Storage& store_;
+
+  // Successors of free blocks linked while running. Their Next may not be
+  // written to the storage yet, so they stay here until allocated.
   std::map<Addr, Addr> next_cache_;
 };
 
@@ -2,30 +2,100 @@
 
 #include "block_locks.h"
 
+#include <algorithm>
+
 namespace cheesebase {
 
-std::shared_ptr<RwMutex> BlockLockPool::getMutex(Addr block) {
-  Guard<Mutex> guard{ mtx_ };
-
-  std::shared_ptr<RwMutex> mutex;
-
-  auto lookup = map_.find(block);
-  if (lookup == map_.end()) {
-    // not existing
-    mutex = std::make_shared<RwMutex>();
-    map_.emplace_hint(lookup, block, mutex);
-  } else {
-    mutex = lookup->second.lock();
-    if (!mutex) {
-      mutex = std::make_shared<RwMutex>();
-      lookup->second = mutex;
+namespace block_locks_detail {
+
+EntryRef::~EntryRef() {
+  if (entry_ != nullptr) pool_->release(*entry_);
+}
+
+} // namespace block_locks_detail
+
+using namespace block_locks_detail;
+
+BlockLockPool::BlockLockPool()
+    : stripes_{ std::make_unique<Stripe[]>(k_lock_stripes) } {}
+
+BlockLockPool::Stripe& BlockLockPool::stripeOf(Addr addr) {
+  // blocks are at least 256 bytes aligned, don't waste stripes on the offset
+  return stripes_[Addr::Hash{}(Addr(addr.value >> 8)) % k_lock_stripes];
+}
+
+EntryRef BlockLockPool::acquire(Addr addr) {
+  auto& stripe = stripeOf(addr);
+  Guard<Mutex> guard{ stripe.mtx };
+
+  LockEntry* unused = nullptr;
+  auto find = [&](LockEntry& e) {
+    if (e.users > 0 && e.addr == addr) return true;
+    if (e.users == 0 && unused == nullptr) unused = &e;
+    return false;
+  };
+  for (auto& e : stripe.entries) {
+    if (find(e)) {
+      ++e.users;
+      return { this, &e };
     }
   }
-  return mutex;
+  // only entries in use are kept in overflow
+  for (auto& e : stripe.overflow) {
+    if (e->addr == addr) {
+      ++e->users;
+      return { this, e.get() };
+    }
+  }
+
+  if (unused == nullptr) {
+    stripe.overflow.push_back(std::make_unique<LockEntry>());
+    unused = stripe.overflow.back().get();
+  }
+  unused->addr = addr;
+  unused->users = 1;
+  return { this, unused };
+}
+
+void BlockLockPool::release(LockEntry& entry) {
+  auto& stripe = stripeOf(entry.addr);
+  Guard<Mutex> guard{ stripe.mtx };
+  Expects(entry.users > 0);
+  if (--entry.users > 0) return;
+
+  // give back additional entries, or a burst of locks would slow down the
+  // stripe for good
+  auto it = std::find_if(
+      stripe.overflow.begin(), stripe.overflow.end(),
+      [&](const std::unique_ptr<LockEntry>& e) { return e.get() == &entry; });
+  if (it != stripe.overflow.end()) {
+    std::swap(*it, stripe.overflow.back());
+    stripe.overflow.pop_back();
+  }
+}
+
+size_t BlockLockPool::overflowEntries() {
+  size_t n = 0;
+  for (size_t i = 0; i < k_lock_stripes; ++i) {
+    Guard<Mutex> guard{ stripes_[i].mtx };
+    n += stripes_[i].overflow.size();
+  }
+  return n;
 }
 
-BlockLockR BlockLockPool::getLockR(Addr block) { return { getMutex(block) }; }
+BlockLockR BlockLockPool::getLockR(Addr block) { return { acquire(block) }; }
+
+BlockLockW BlockLockPool::getLockW(Addr block) { return { acquire(block) }; }
 
-BlockLockW BlockLockPool::getLockW(Addr block) { return { getMutex(block) }; }
+bool BlockLockW::tryExclusive() {
+  Expects(ug_lck_.owns_lock());
+  ex_lck_ = ExLock<UgMutex>(std::move(ug_lck_), boost::try_to_lock);
+  return ex_lck_.owns_lock();
+}
+
+void BlockLockW::downgrade() {
+  Expects(ex_lck_.owns_lock());
+  ug_lck_ = UgLock<UgMutex>(std::move(ex_lck_));
+}
 
 } // namespace cheesebase
@@ -5,44 +5,132 @@
 #include "common.h"
 #include "macros.h"
 #include "sync.h"
-#include <unordered_map>
+#include <array>
+#include <memory>
+#include <vector>
 
 namespace cheesebase {
 
 class BlockLockPool;
 
-template <class M, class L>
+namespace block_locks_detail {
+
+// Lock of one block address. Only exists while somebody uses it.
+struct LockEntry {
+  UgMutex mutex;
+  Addr addr;
+  size_t users{ 0 }; // guarded by the mutex of the stripe
+};
+
+// Counted reference to a LockEntry, given back to the pool on destruction.
+class EntryRef {
+public:
+  EntryRef() = default;
+  EntryRef(BlockLockPool* pool, LockEntry* entry)
+      : pool_{ pool }, entry_{ entry } {}
+  EntryRef(EntryRef&& o) noexcept : pool_{ o.pool_ }, entry_{ o.entry_ } {
+    o.entry_ = nullptr;
+  }
+  EntryRef(const EntryRef&) = delete;
+  EntryRef& operator=(const EntryRef&) = delete;
+  EntryRef& operator=(EntryRef&&) = delete;
+  ~EntryRef();
+
+  UgMutex& mutex() const noexcept { return entry_->mutex; }
+
+private:
+  BlockLockPool* pool_{ nullptr };
+  LockEntry* entry_{ nullptr };
+};
+
+} // namespace block_locks_detail
+
+template <class L>
 class BlockLock {
   friend BlockLockPool;
 
 public:
   BlockLock() = default;
-  MOVE_ONLY(BlockLock)
+  BlockLock(BlockLock&&) = default;
+  BlockLock(const BlockLock&) = delete;
+  BlockLock& operator=(const BlockLock&) = delete;
+  BlockLock& operator=(BlockLock&&) = delete;
 
 private:
-  BlockLock(std::shared_ptr<M>&& mtx) : mtx_{ std::move(mtx) }, lck_{ *mtx_ } {}
+  BlockLock(block_locks_detail::EntryRef&& ref)
+      : ref_{ std::move(ref) }, lck_{ ref_.mutex() } {}
 
   // Order is important here!
-  // In destruction lck_ unlocks before mtx_ gets freed.
-  std::shared_ptr<M> mtx_;
+  // In destruction lck_ unlocks before the entry is given back.
+  block_locks_detail::EntryRef ref_;
   L lck_;
 };
 
-using BlockLockR = BlockLock<RwMutex, ShLock<RwMutex>>;
-using BlockLockW = BlockLock<RwMutex, ExLock<RwMutex>>;
+using BlockLockR = BlockLock<ShLock<UgMutex>>;
+
+// Write lock of a block. Excludes other writers, but is held as upgrade lock
+// so readers can continue while a transaction is prepared. The lock is made
+// exclusive only while the changes are applied.
+class BlockLockW {
+  friend BlockLockPool;
+
+public:
+  BlockLockW() = default;
+  BlockLockW(BlockLockW&&) = default;
+  BlockLockW(const BlockLockW&) = delete;
+  BlockLockW& operator=(const BlockLockW&) = delete;
+  BlockLockW& operator=(BlockLockW&&) = delete;
+
+  // Make the lock exclusive. Fails instead of waiting for readers.
+  bool tryExclusive();
+
+  // Allow readers again.
+  void downgrade();
+
+private:
+  BlockLockW(block_locks_detail::EntryRef&& ref)
+      : ref_{ std::move(ref) }, ug_lck_{ ref_.mutex() } {}
+
+  // Order is important here, see BlockLock.
+  block_locks_detail::EntryRef ref_;
+  UgLock<UgMutex> ug_lck_;
+  ExLock<UgMutex> ex_lck_;
+};
 
+// Locks of blocks by address. Entries are kept in a fixed table, split into
+// stripes by the hash of the address. Each stripe has its own mutex, which is
+// only held to find or give back an entry, never while waiting for a block.
+// Memory is only allocated when more blocks of one stripe are locked at once
+// than it has entries, as a large transaction can hold any number of locks.
+// The additional entries are freed when their block is unlocked, so finding an
+// entry only scans the fixed ones and those of blocks locked right now.
 class BlockLockPool {
+  friend block_locks_detail::EntryRef;
+
 public:
-  BlockLockPool() = default;
+  BlockLockPool();
 
   BlockLockR getLockR(Addr);
   BlockLockW getLockW(Addr);
 
+  // Number of entries allocated beyond the fixed table.
+  size_t overflowEntries();
+
 private:
-  std::shared_ptr<RwMutex> getMutex(Addr block);
+  struct Stripe {
+    Mutex mtx;
+    std::array<block_locks_detail::LockEntry, k_lock_stripe_entries> entries;
+    // additional entries in use, allocated one by one as they must not move
+    std::vector<std::unique_ptr<block_locks_detail::LockEntry>> overflow;
+  };
+
+  // get the entry of addr, adds one to the stripe if it is full
+  block_locks_detail::EntryRef acquire(Addr addr);
+  void release(block_locks_detail::LockEntry& entry);
+
+  Stripe& stripeOf(Addr addr);
 
-  std::unordered_map<Addr, std::weak_ptr<RwMutex>, Addr::Hash> map_{};
-  Mutex mtx_;
+  std::unique_ptr<Stripe[]> stripes_;
 };
 
 } // namespace cheesebase
@@ -2,13 +2,36 @@
 
 #include "cache.h"
 #include "exceptions.h"
+#include "lz.h"
+#include "murmurhash3.h"
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace cheesebase {
 
 namespace cache_detail {
 
-File::File(const std::string& filename, OpenMode m) {
+namespace {
+
+void runRequests(IoRing& ring, int fd, const std::vector<IoRequest>& requests) {
+  if (requests.size() == 1) {
+    // no need to wait for others using the ring
+    runIoRequest(fd, requests.front());
+  } else if (!requests.empty()) {
+    ring.run(fd, requests);
+  }
+}
+
+} // anonymous namespace
+
+File::File(const std::string& filename, OpenMode m, int flags) {
   namespace fs = boost::filesystem;
 
   auto exists = fs::exists(filename);
@@ -18,61 +41,535 @@ File::File(const std::string& filename, OpenMode m) {
     throw FileError("file not found");
   if (m == OpenMode::create_always && exists) fs::remove(filename);
 
-  fstream_.open(filename, std::ios_base::out | std::ios_base::binary |
-                              std::ios_base::app);
-  if (!fstream_.is_open()) throw FileError("could not open file");
+  fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | flags, 0644);
+  if (fd_ < 0) throw FileError("could not open file");
 
-  if (m == OpenMode::create_new || m == OpenMode::create_always || !exists)
-    extendFile(k_page_size * 8);
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    ::close(fd_);
+    throw FileError("could not stat file");
+  }
+  physical_size_ = static_cast<uint64_t>(st.st_size);
 
-  size_ = static_cast<uint64_t>(fstream_.tellp());
-  file_ = bi::file_mapping(filename.c_str(), bi::read_write);
+  try {
+    if (physical_size_ < k_page_size * 8) extendFile(k_page_size * 8);
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+  size_ = std::max(physical_size_, static_cast<uint64_t>(k_page_size * 8));
 }
 
-uint64_t File::extendFile(uint64_t size) {
-  Expects(size > size_);
-  for (uint64_t i = 0; i < size - size_; ++i) fstream_.put('\xAA');
-  fstream_.flush();
-  if (fstream_.bad()) throw FileError("failed extending file");
-  return size;
+File::~File() {
+  // give back the preallocated but unused space
+  if (physical_size_ > size_) {
+    ::ftruncate(fd_, static_cast<off_t>(size_));
+  }
+  ::close(fd_);
 }
 
-bi::mapped_region File::getRegion(PageNr page_nr) {
-  if (page_nr.addr() + k_page_size > size_) {
-    size_ = extendFile(page_nr.addr() + k_page_size);
-  }
+void File::usePage(PageNr page_nr) { useBytes(page_nr.addr() + k_page_size); }
 
-  return bi::mapped_region(file_, bi::read_write,
-                           gsl::narrow_cast<bi::offset_t>(page_nr.addr()),
-                           k_page_size);
+void File::useBytes(uint64_t end) {
+  if (end > physical_size_) extendFile(end);
+  if (end > size_) size_ = end;
 }
 
-void PageList::bumpPage(const_iterator p) {
-  Guard<Mutex> _{ mtx_ };
-  pages_.splice(pages_.begin(), pages_, p);
+void File::extendFile(uint64_t size) {
+  Expects(size > physical_size_);
+  auto grow = std::min<uint64_t>(physical_size_, k_max_file_growth);
+  auto target = std::max(size, physical_size_ + grow);
+  target = (target + k_page_size - 1) & ~static_cast<uint64_t>(k_page_size - 1);
+
+  // reserve the blocks if the file system supports it, just set the size
+  // (sparse file) otherwise
+  auto offset = static_cast<off_t>(physical_size_);
+  auto len = static_cast<off_t>(target - physical_size_);
+  if (::posix_fallocate(fd_, offset, len) != 0 &&
+      ::ftruncate(fd_, static_cast<off_t>(target)) != 0) {
+    throw FileError("failed extending file");
+  }
+  physical_size_ = target;
 }
 
-std::pair<PageList::iterator, ExLock<RwMutex>> PageList::getPage() {
+MappedFile::MappedFile(const std::string& filename, OpenMode m)
+    : File(filename, m)
+    , file_{ bi::file_mapping(filename.c_str(), bi::read_write) } {}
+
+MappedFile::~MappedFile() { chunks_.clear(); }
+
+bi::mapped_region& MappedFile::getChunk(size_t chunk_nr) {
+  if (chunk_nr >= chunks_.size()) chunks_.resize(chunk_nr + 1);
+
+  auto& chunk = chunks_[chunk_nr];
+  if (chunk.get_address() == nullptr) {
+    chunk = bi::mapped_region(
+        file_, bi::read_write,
+        gsl::narrow_cast<bi::offset_t>(chunk_nr * k_map_chunk_size),
+        k_map_chunk_size);
+  }
+  return chunk;
+}
+
+Byte* MappedFile::getPage(PageNr page_nr) {
   Guard<Mutex> guard{ mtx_ };
+  usePage(page_nr);
+
+  auto& chunk = getChunk(page_nr.addr() >> k_map_chunk_power);
+  return static_cast<Byte*>(chunk.get_address()) +
+         (page_nr.addr() & (k_map_chunk_size - 1));
+}
 
-  if (pages_.size() < max_pages_) {
-    pages_.emplace_front();
+void MappedFile::flush(PageNr first, size_t count) {
+  auto addr = first.addr();
+  auto end = addr + count * k_page_size;
+
+  while (addr < end) {
+    // a range may span multiple chunks, which are not adjacent in memory
+    auto chunk_nr = addr >> k_map_chunk_power;
+    auto offset = addr & (k_map_chunk_size - 1);
+    auto len = std::min<uint64_t>(end - addr, k_map_chunk_size - offset);
+
+    Byte* start;
+    {
+      Guard<Mutex> guard{ mtx_ };
+      Expects(chunk_nr < chunks_.size() &&
+              chunks_[chunk_nr].get_address() != nullptr);
+      start = static_cast<Byte*>(chunks_[chunk_nr].get_address()) + offset;
+    }
+
+    // chunks stay mapped, no need to block other threads meanwhile
+    if (::msync(start, len, MS_SYNC) != 0)
+      throw FileError("failed to flush pages");
+    addr += len;
+  }
+}
+
+void MappedFile::prefetch(PageNr first, size_t count) {
+  auto addr = first.addr();
+  auto end = addr + count * k_page_size;
+
+  while (addr < end) {
+    auto chunk_nr = addr >> k_map_chunk_power;
+    auto offset = addr & (k_map_chunk_size - 1);
+    auto len = std::min<uint64_t>(end - addr, k_map_chunk_size - offset);
+
+    Byte* start;
+    {
+      Guard<Mutex> guard{ mtx_ };
+      if (addr >= size_) return;
+      len = std::min<uint64_t>(len, size_ - addr);
+      start = static_cast<Byte*>(getChunk(chunk_nr).get_address()) + offset;
+    }
+
+    // only a hint, reading the page later works anyway
+    ::madvise(start, len, MADV_WILLNEED);
+    addr += len;
+  }
+}
+
+DirectFile::DirectFile(const std::string& filename, OpenMode m)
+    : BufferedFile(filename, m, O_DIRECT), ring_{ k_io_ring_entries } {}
+
+std::vector<IoRequest>
+DirectFile::requests(const std::vector<PageBuffer>& pages, IoRequest::Op op) {
+  std::vector<IoRequest> requests;
+  requests.reserve(pages.size());
+  for (auto& p : pages)
+    requests.push_back({ op, p.second, k_page_size, p.first.addr() });
+  return requests;
+}
+
+void DirectFile::read(const std::vector<PageBuffer>& pages) {
+  {
+    Guard<Mutex> guard{ mtx_ };
+    for (auto& p : pages) usePage(p.first);
+  }
+  runRequests(ring_, fd_, requests(pages, IoRequest::Op::read));
+}
+
+void DirectFile::write(const std::vector<PageBuffer>& pages) {
+  runRequests(ring_, fd_, requests(pages, IoRequest::Op::write));
+}
+
+void DirectFile::sync() {
+  if (::fdatasync(fd_) != 0) throw FileError("failed to flush pages");
+}
+
+CompressedFile::CompressedFile(const std::string& filename, OpenMode m)
+    : BufferedFile(filename, m)
+    , map_file_{ filename + k_page_map_suffix }
+    , free_(k_page_size / k_extent_granule + 1)
+    , ring_{ k_io_ring_entries } {
+  if (boost::filesystem::exists(map_file_)) {
+    loadPageMap();
   } else {
-    // move last to front
-    pages_.splice(pages_.begin(), pages_, --(pages_.end()));
+    size_ = 0;
+    storePageMap(map_);
+  }
+}
+
+uint64_t CompressedFile::allocate(size_t size) {
+  auto units = (size + k_extent_granule - 1) / k_extent_granule;
+  for (auto n = units; n < free_.size(); ++n) {
+    if (free_[n].empty()) continue;
+    auto offset = free_[n].back();
+    free_[n].pop_back();
+    if (n > units) free_[n - units].push_back(offset + units * k_extent_granule);
+    return extent(offset, size);
+  }
+
+  // append, size_ is the end of the last extent
+  auto offset = size_;
+  useBytes(offset + units * k_extent_granule);
+  return extent(offset, size);
+}
+
+void CompressedFile::release(uint64_t e) {
+  free_[extentUnits(e)].push_back(extentOffset(e));
+}
+
+void CompressedFile::read(const std::vector<PageBuffer>& pages) {
+  std::vector<uint64_t> extents;
+  extents.reserve(pages.size());
+  {
+    Guard<Mutex> guard{ mtx_ };
+    for (auto& p : pages)
+      extents.push_back(p.first.value < map_.size() ? map_[p.first.value] : 0);
   }
 
-  auto it = pages_.begin();
-  return { it, ExLock<RwMutex>(it->mutex) };
+  // compressed pages are read into one buffer, the others directly
+  size_t total = 0;
+  for (auto e : extents)
+    if (extentSize(e) < k_page_size) total += extentSize(e);
+  std::vector<Byte> compressed(total);
+
+  std::vector<IoRequest> requests;
+  size_t pos = 0;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    auto size = extentSize(extents[i]);
+    auto offset = extentOffset(extents[i]);
+    if (size == 0) {
+      std::memset(pages[i].second, 0, k_page_size);
+    } else if (size == k_page_size) {
+      requests.push_back({ IoRequest::Op::read, pages[i].second, size, offset });
+    } else {
+      requests.push_back(
+          { IoRequest::Op::read, compressed.data() + pos, size, offset });
+      pos += size;
+    }
+  }
+  runRequests(ring_, fd_, requests);
+
+  pos = 0;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    auto size = extentSize(extents[i]);
+    if (size == 0 || size == k_page_size) continue;
+    lzDecompress(gsl::span<const Byte>(compressed.data() + pos,
+                                       static_cast<std::ptrdiff_t>(size)),
+                 gsl::span<Byte>(pages[i].second,
+                                 static_cast<std::ptrdiff_t>(k_page_size)));
+    pos += size;
+  }
 }
 
-void PageList::flush() {
+void CompressedFile::write(const std::vector<PageBuffer>& pages) {
+  // Compress outside of the lock. Pages saving less than a unit are stored
+  // as they are, they would not take less space.
+  std::vector<Byte> compressed(pages.size() * k_page_size);
+  std::vector<size_t> sizes(pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) {
+    sizes[i] = lzCompress(
+        gsl::span<const Byte>(pages[i].second,
+                              static_cast<std::ptrdiff_t>(k_page_size)),
+        gsl::span<Byte>(compressed.data() + i * k_page_size,
+                        static_cast<std::ptrdiff_t>(k_page_size -
+                                                    k_extent_granule)));
+    if (sizes[i] == 0) sizes[i] = k_page_size;
+  }
+
+  std::vector<uint64_t> extents;
+  extents.reserve(pages.size());
+  {
+    Guard<Mutex> guard{ mtx_ };
+    for (auto size : sizes) extents.push_back(allocate(size));
+  }
+
+  std::vector<IoRequest> requests;
+  requests.reserve(pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) {
+    auto data = sizes[i] == k_page_size ? pages[i].second
+                                        : compressed.data() + i * k_page_size;
+    requests.push_back({ IoRequest::Op::write, data, sizes[i],
+                         extentOffset(extents[i]) });
+  }
+
+  try {
+    runRequests(ring_, fd_, requests);
+  } catch (const FileError&) {
+    // no page map references the new extents
+    Guard<Mutex> guard{ mtx_ };
+    for (auto e : extents) release(e);
+    throw;
+  }
+
   Guard<Mutex> guard{ mtx_ };
+  for (size_t i = 0; i < pages.size(); ++i) {
+    auto nr = pages[i].first.value;
+    if (nr >= map_.size()) map_.resize(nr + 1, 0);
+    auto old = map_[nr];
+    if (old != 0 && nr < synced_.size() && synced_[nr] == old)
+      pending_.push_back(old);
+    else if (old != 0)
+      release(old); // written after the last sync, not needed anymore
+    map_[nr] = extents[i];
+  }
+}
+
+void CompressedFile::sync() {
+  std::vector<uint64_t> map;
+  std::vector<uint64_t> pending;
+  {
+    Guard<Mutex> guard{ mtx_ };
+    map = map_;
+    synced_ = map_;
+    pending.swap(pending_);
+  }
+
+  // the extents have to be durable before the page map referencing them
+  try {
+    if (::fdatasync(fd_) != 0) throw FileError("failed to flush pages");
+    storePageMap(map);
+  } catch (const FileError&) {
+    Guard<Mutex> guard{ mtx_ };
+    pending_.insert(pending_.end(), pending.begin(), pending.end());
+    throw;
+  }
+
+  Guard<Mutex> guard{ mtx_ };
+  for (auto e : pending) release(e);
+}
+
+void CompressedFile::loadPageMap() {
+  auto fd = ::open(map_file_.c_str(), O_RDONLY);
+  if (fd < 0) throw FileError("could not open page map");
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw FileError("could not stat page map");
+  }
+  std::vector<Byte> content(static_cast<size_t>(st.st_size));
+  try {
+    runIoRequest(fd, { IoRequest::Op::read, content.data(), content.size(), 0 });
+  } catch (const FileError&) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);
+
+  auto bytes = gsl::span<const Byte>(content);
+  if (bytes.size() < ssizeof<DskPageMapHdr>())
+    throw ConsistencyError("Invalid page map");
+  auto& hdr = bytesAsType<DskPageMapHdr>(bytes);
+  auto entries = bytes.subspan(ssizeof<DskPageMapHdr>());
+  auto size = static_cast<size_t>(entries.size());
+  if (hdr.magic != k_page_map_magic ||
+      hdr.count != size / sizeof(uint64_t) || size % sizeof(uint64_t) != 0 ||
+      hashBytes(entries.data(), size) != hdr.checksum)
+    throw ConsistencyError("Invalid page map");
+  map_.resize(hdr.count);
+  std::memcpy(map_.data(), entries.data(), size);
+  synced_ = map_;
+
+  // the gaps between the extents are free
+  std::vector<uint64_t> used;
+  for (auto e : map_)
+    if (e != 0) used.push_back(e);
+  std::sort(used.begin(), used.end());
+
+  uint64_t end = 0;
+  for (auto e : used) {
+    auto offset = extentOffset(e);
+    if (offset < end || extentSize(e) == 0 || extentSize(e) > k_page_size)
+      throw ConsistencyError("Invalid page map");
+
+    for (auto units = (offset - end) / k_extent_granule; units > 0;) {
+      auto n = std::min<uint64_t>(units, free_.size() - 1);
+      free_[n].push_back(end);
+      end += n * k_extent_granule;
+      units -= n;
+    }
+    end = offset + extentUnits(e) * k_extent_granule;
+  }
+  size_ = end;
+}
+
+void CompressedFile::storePageMap(const std::vector<uint64_t>& map) {
+  auto size = map.size() * sizeof(uint64_t);
+  std::vector<Byte> content(sizeof(DskPageMapHdr) + size);
+  auto entries = content.data() + sizeof(DskPageMapHdr);
+  std::memcpy(entries, map.data(), size);
+  auto& hdr = bytesAsType<DskPageMapHdr>(gsl::span<Byte>(content));
+  hdr.magic = k_page_map_magic;
+  hdr.count = map.size();
+  hdr.checksum = hashBytes(entries, size);
+  hdr.reserved = 0;
+
+  // write a new file and rename it, a crash leaves either the old or the new
+  auto tmp = map_file_ + ".tmp";
+  auto fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw FileError("could not write page map");
+  bool success = true;
+  try {
+    runIoRequest(fd,
+                 { IoRequest::Op::write, content.data(), content.size(), 0 });
+  } catch (const FileError&) {
+    success = false;
+  }
+  success = ::fsync(fd) == 0 && success;
+  ::close(fd);
+  if (!success || ::rename(tmp.c_str(), map_file_.c_str()) != 0)
+    throw FileError("could not write page map");
+
+  // the rename is durable with the directory
+  auto dir = boost::filesystem::path(map_file_).parent_path().string();
+  auto dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+  if (dir_fd < 0) throw FileError("could not write page map");
+  success = ::fsync(dir_fd) == 0;
+  ::close(dir_fd);
+  if (!success) throw FileError("could not write page map");
+}
+
+BufferPool::~BufferPool() {
+  for (auto c : chunks_) std::free(c);
+}
+
+Byte* BufferPool::get() {
+  Guard<Mutex> guard{ mtx_ };
+  if (!free_.empty()) {
+    auto buffer = free_.back();
+    free_.pop_back();
+    return buffer;
+  }
+  if (used_ == k_buffer_chunk_pages) {
+    void* chunk = nullptr;
+    if (::posix_memalign(&chunk, k_page_size,
+                         k_page_size * k_buffer_chunk_pages) != 0)
+      throw std::bad_alloc();
+    chunks_.push_back(static_cast<Byte*>(chunk));
+    used_ = 0;
+  }
+  return chunks_.back() + k_page_size * used_++;
+}
+
+void BufferPool::put(Byte* buffer) {
+  Guard<Mutex> guard{ mtx_ };
+  free_.push_back(buffer);
+}
+
+Shard::Shard(size_t max_pages, CachePolicy policy)
+    : max_pages_{ max_pages }, policy_{ policy }, hand_{ main_.end() } {}
+
+Shard::Victim Shard::clockVictim(bool clean_only) {
+  // two full rounds: the first may only clear reference bits
+  for (size_t i = 0; i < main_.size() * 2; ++i) {
+    if (hand_ == main_.end()) hand_ = main_.begin();
+    auto page = *hand_;
+
+    if (clean_only && page->dirty.load(std::memory_order_relaxed)) {
+      ++hand_;
+      continue;
+    }
+    if (page->referenced.exchange(false, std::memory_order_relaxed)) {
+      ++hand_;
+      continue;
+    }
+
+    // never wait for a page in use, holding the shard lock meanwhile could
+    // deadlock with its owner requesting another page
+    ExLock<RwMutex> lck{ page->mutex, boost::try_to_lock };
+    if (lck.owns_lock()) {
+      hand_ = main_.erase(hand_);
+      return { page, std::move(lck) };
+    }
+    ++hand_;
+  }
+  return { nullptr, ExLock<RwMutex>() };
+}
 
-  for (auto& p : pages_) {
-    if (!p.region.flush(0, k_page_size, false))
-      throw FileError("failed to flush page");
+Shard::Victim Shard::probationVictim(bool clean_only) {
+  for (auto it = probation_.begin(); it != probation_.end(); ++it) {
+    auto page = *it;
+    if (clean_only && page->dirty.load(std::memory_order_relaxed)) continue;
+    ExLock<RwMutex> lck{ page->mutex, boost::try_to_lock };
+    if (lck.owns_lock()) {
+      probation_.erase(it);
+      addGhost(page->page_nr);
+      return { page, std::move(lck) };
+    }
   }
+  return { nullptr, ExLock<RwMutex>() };
+}
+
+void Shard::addGhost(PageNr page_nr) {
+  ghosts_.push_back(page_nr);
+  ghost_map_[page_nr] = --ghosts_.end();
+  if (ghosts_.size() > std::max<size_t>(1, max_pages_ / 2)) {
+    ghost_map_.erase(ghosts_.front());
+    ghosts_.pop_front();
+  }
+}
+
+Shard::Victim Shard::victim() {
+  Victim frame{ nullptr, ExLock<RwMutex>() };
+  // a dirty victim is written back while the shard is locked
+  for (auto clean_only : { true, false }) {
+    if (policy_ == CachePolicy::clock) {
+      frame = clockVictim(clean_only);
+    } else {
+      // keep the probation queue at about a quarter of the shard
+      if (probation_.size() > max_pages_ / 4 || main_.empty())
+        frame = probationVictim(clean_only);
+      if (frame.first == nullptr) frame = clockVictim(clean_only);
+      if (frame.first == nullptr) frame = probationVictim(clean_only);
+    }
+    if (frame.first != nullptr) break;
+  }
+  return frame;
+}
+
+std::pair<CachePage*, ExLock<RwMutex>> Shard::getFrame(PageNr page_nr) {
+  Victim frame{ nullptr, ExLock<RwMutex>() };
+  if (size() >= max_pages_) frame = victim();
+
+  if (frame.first == nullptr && !spare_.empty()) {
+    // below the limit or everything is locked
+    frame = { spare_.back(), ExLock<RwMutex>(spare_.back()->mutex) };
+    spare_.pop_back();
+  } else if (frame.first == nullptr) {
+    frames_.emplace_back();
+    frame = { &frames_.back(), ExLock<RwMutex>(frames_.back().mutex) };
+  }
+  frame.first->referenced.store(false, std::memory_order_relaxed);
+
+  auto ghost = ghost_map_.find(page_nr);
+  if (policy_ == CachePolicy::clock || ghost != ghost_map_.end()) {
+    if (ghost != ghost_map_.end()) {
+      ghosts_.erase(ghost->second);
+      ghost_map_.erase(ghost);
+    }
+    // behind the hand, so it is visited last
+    main_.insert(hand_, frame.first);
+  } else {
+    probation_.push_back(frame.first);
+  }
+
+  return frame;
+}
+
+std::pair<CachePage*, ExLock<RwMutex>> Shard::surplusFrame() {
+  if (size() <= max_pages_) return { nullptr, ExLock<RwMutex>() };
+  return victim();
 }
 
 } // namespace cache_detail
@@ -81,10 +578,65 @@ void PageList::flush() {
 
 using namespace cache_detail;
 
-Cache::Cache(const std::string& fn, OpenMode m, size_t nr_pages)
-    : file_{ fn, m }, pages_{ nr_pages } {}
+namespace {
+
+// Only compressed DB files have a page map.
+void checkPageMap(const std::string& fn, OpenMode m, FileAccess access) {
+  namespace fs = boost::filesystem;
+  auto map_file = fn + k_page_map_suffix;
+  if (!fs::exists(fn) || m == OpenMode::create_always) {
+    fs::remove(map_file); // left over of a previous database
+    return;
+  }
+  if (m == OpenMode::create_new) return; // fails when opening the file
 
-Cache::~Cache() { flush(); }
+  if (fs::exists(map_file) != (access == FileAccess::compressed))
+    throw FileError("file access does not match the database");
+}
+
+} // anonymous namespace
+
+Cache::Cache(const std::string& fn, OpenMode m, size_t nr_pages,
+             CachePolicy policy, FileAccess access) {
+  checkPageMap(fn, m, access);
+  if (access == FileAccess::direct)
+    buffered_ = std::make_unique<DirectFile>(fn, m);
+  else if (access == FileAccess::compressed)
+    buffered_ = std::make_unique<CompressedFile>(fn, m);
+  else
+    mapped_ = std::make_unique<MappedFile>(fn, m);
+
+  nr_pages = std::max<size_t>(1, nr_pages);
+  auto nr_shards = std::max<size_t>(
+      1, std::min(k_cache_shards, nr_pages / k_min_shard_pages));
+  shards_.reserve(nr_shards);
+  for (size_t i = 0; i < nr_shards; ++i) {
+    auto size = nr_pages / nr_shards + (i < nr_pages % nr_shards ? 1 : 0);
+    shards_.push_back(std::make_unique<Shard>(size, policy));
+  }
+
+  writeback_threshold_ =
+      std::max<size_t>(1, nr_pages * k_writeback_percent / 100);
+  dirty_limit_ = std::max<size_t>(1, nr_pages * k_dirty_limit_percent / 100);
+  thread_ = boost::thread([this] { writeBackLoop(); });
+}
+
+Cache::~Cache() {
+  {
+    Guard<Mutex> guard{ thread_mtx_ };
+    stop_ = true;
+  }
+  thread_cond_.notify_all();
+  thread_.join();
+
+  // pages that are not written are still in the journal
+  try {
+    flush();
+  } catch (const std::exception& e) {
+    std::cerr << "cheesebase: writing the cache on close failed: " << e.what()
+              << '\n';
+  }
+}
 
 PageRef<PageReadView> Cache::readPage(PageNr page_nr) {
   return getPage<PageReadView>(page_nr);
@@ -94,65 +646,340 @@ PageRef<PageWriteView> Cache::writePage(PageNr page_nr) {
   return getPage<PageWriteView>(page_nr);
 }
 
-std::pair<PageList::iterator, ExLock<RwMutex>> Cache::getFreePage() {
-  auto pair = pages_.getPage();
-  if (pair.first->inUse()) {
-    freePage(*pair.first);
-  }
-  return pair;
+Shard& Cache::shardOf(PageNr page_nr) {
+  return *shards_[PageNr::Hash{}(page_nr) % shards_.size()];
 }
 
-void Cache::freePage(CachePage& p) {
-  p.region.flush(0, k_page_size, false);
-  map_.erase(p.page_nr);
-  p.region = {};
+void Cache::freePage(Shard& shard, CachePage& p) {
+  // Clean pages are identical to the file already. The flag is cleared only
+  // after the write, a page failing to be written stays cached and dirty.
+  // Nobody else clears it meanwhile, the exclusive shard lock keeps the
+  // write back away.
+  if (p.dirty.load()) {
+    if (buffered_)
+      buffered_->write({ { p.page_nr, p.data } });
+    else
+      mapped_->flush(p.page_nr);
+    p.dirty.store(false);
+    --dirty_pages_;
+  }
+  shard.map.erase(p.page_nr);
+  p.data = nullptr;
   p.page_nr = PageNr(CachePage::sUnused);
 }
 
+template <class View>
+PageRef<View> Cache::lockPage(CachePage& page) {
+  page.touch();
+  // lock before creating the view, data may still be set by the loading thread
+  ShLock<RwMutex> lck{ page.mutex };
+  if (page.failed) throw FileError("failed reading page");
+  if (std::is_same<View, PageWriteView>::value) markDirty(page);
+  return { page.template getView<View>(), std::move(lck) };
+}
+
 template <class View>
 PageRef<View> Cache::getPage(PageNr page_nr) {
+  if (std::is_same<View, PageWriteView>::value) throttle();
+
+  auto& shard = shardOf(page_nr);
   {
     // acquire read access for map
-    ShGuard<RwMutex> guard{ map_mtx_ };
+    ShGuard<RwMutex> guard{ shard.mtx };
 
-    auto p = map_.find(page_nr);
-    if (p != map_.end()) {
+    auto p = shard.map.find(page_nr);
+    if (p != shard.map.end()) {
       // page found, lock and return it
-      pages_.bumpPage(p->second);
-      return { p->second->getView<View>(), p->second->mutex };
+      return lockPage<View>(*p->second);
     }
   }
   // page not found, create it
 
-  PageList::iterator page;
+  CachePage* page;
   ExLock<RwMutex> page_lock;
   {
     // switch to write lock on map
-    Guard<RwMutex> guard{ map_mtx_ };
+    Guard<RwMutex> guard{ shard.mtx };
 
     // there might be a saved page now
-    auto p = map_.find(page_nr);
-    if (p != map_.end()) {
-      pages_.bumpPage(p->second);
-      return { p->second->getView<View>(), p->second->mutex };
+    auto p = shard.map.find(page_nr);
+    if (p != shard.map.end()) {
+      return lockPage<View>(*p->second);
     }
 
-    // get a free page
-    std::tie(page, page_lock) = getFreePage();
-
-    auto emplace = map_.emplace(page_nr, page);
-    Expects(emplace.second);
+    std::tie(page, page_lock) = reserveFrame(shard, page_nr);
 
-    // just need exclusive page lock for writing content, unlock the cache
+    // just need exclusive page lock for writing content, unlock the shard
   }
 
-  page->page_nr = page_nr;
-  page->region = file_.getRegion(page_nr);
+  if (buffered_) {
+    try {
+      buffered_->read({ { page_nr, page->data } });
+    } catch (...) {
+      // also corrupted compressed pages, the frame must not keep them
+      page->failed = true;
+      page_lock.unlock();
+      discardFailed(shard, *page, page_nr);
+      throw;
+    }
+  } else {
+    page->data = mapped_->getPage(page_nr);
+  }
+  if (std::is_same<View, PageWriteView>::value) markDirty(*page);
 
   // downgrade the exclusive page lock to shared ATOMICALLY
   return { page->getView<View>(), std::move(page_lock) };
 }
 
-void Cache::flush() { pages_.flush(); }
+std::pair<CachePage*, ExLock<RwMutex>> Cache::reserveFrame(Shard& shard,
+                                                           PageNr page_nr) {
+  // get a free page
+  auto frame = shard.getFrame(page_nr);
+  auto page = frame.first;
+  if (page->inUse()) freePage(shard, *page);
+
+  // frames added while all others were locked are given up again as soon as
+  // they can be evicted
+  for (auto surplus = shard.surplusFrame(); surplus.first != nullptr;
+       surplus = shard.surplusFrame()) {
+    auto p = surplus.first;
+    if (p->inUse()) freePage(shard, *p);
+    if (p->buffer != nullptr) {
+      buffers_.put(p->buffer);
+      p->buffer = nullptr;
+    }
+    shard.retire(p);
+  }
+
+  auto emplace = shard.map.emplace(page_nr, page);
+  Expects(emplace.second);
+  page->page_nr = page_nr;
+
+  if (buffered_) {
+    if (page->buffer == nullptr) page->buffer = buffers_.get();
+    page->data = page->buffer;
+  }
+  return frame;
+}
+
+void Cache::discardFailed(Shard& shard, CachePage& p, PageNr page_nr) {
+  Guard<RwMutex> guard{ shard.mtx };
+  ExLock<RwMutex> lck{ p.mutex };
+
+  // readers waiting for the page saw it failed, nobody can find it again
+  auto it = shard.map.find(page_nr);
+  if (it != shard.map.end() && it->second == &p) shard.map.erase(it);
+  p.failed = false;
+  p.data = nullptr;
+  p.page_nr = PageNr(CachePage::sUnused);
+}
+
+void Cache::markDirty(CachePage& p) {
+  if (p.dirty.load(std::memory_order_relaxed) || p.dirty.exchange(true))
+    return;
+
+  if (++dirty_pages_ == writeback_threshold_) thread_cond_.notify_one();
+}
+
+void Cache::throttle() {
+  if (dirty_pages_ < dirty_limit_) return;
+
+  ExLock<Mutex> lck{ thread_mtx_ };
+  waitForPass(lck, true);
+}
+
+void Cache::waitForWriteBack() {
+  ExLock<Mutex> lck{ thread_mtx_ };
+  waitForPass(lck, false);
+}
+
+void Cache::waitForPass(ExLock<Mutex>& lck, bool until_clean) {
+  // a pass running right now may have missed pages dirtied before the call
+  auto target = passes_ + (in_pass_ ? 2 : 1);
+  while (!stop_ && passes_ < target &&
+         !(until_clean && dirty_pages_ < dirty_limit_)) {
+    wake_ = true;
+    thread_cond_.notify_one();
+    clean_cond_.wait(lck);
+  }
+}
+
+void Cache::writeBack(bool all) {
+  if (buffered_) return writeBackBuffered(all);
+  Guard<Mutex> guard{ writeback_mtx_ };
+
+  std::vector<PageNr> pages;
+  for (auto& shard : shards_) {
+    ShGuard<RwMutex> shard_guard{ shard->mtx };
+    shard->forEachFrame([&](CachePage& p) {
+      if (!p.dirty.load()) return;
+
+      // a page in use may be written right now, a later pass takes care of it
+      ExLock<RwMutex> lck{ p.mutex, boost::defer_lock };
+      if (!all && !lck.try_lock()) return;
+
+      if (p.dirty.exchange(false)) {
+        pages.push_back(p.page_nr);
+        --dirty_pages_;
+      }
+    });
+  }
+
+  // sequential order, neighbouring pages are flushed together
+  std::sort(pages.begin(), pages.end(),
+            [](PageNr l, PageNr r) { return l.value < r.value; });
+  size_t i = 0;
+  while (i < pages.size()) {
+    size_t n = 1;
+    while (i + n < pages.size() && pages[i + n].value == pages[i].value + n)
+      ++n;
+    try {
+      mapped_->flush(pages[i], n);
+    } catch (const FileError&) {
+      // the pages are not dirty anymore, a following flush must not succeed
+      failed_ = true;
+      throw;
+    }
+    i += n;
+  }
+}
+
+void Cache::writeBackBuffered(bool all) {
+  Guard<Mutex> guard{ writeback_mtx_ };
+
+  // The buffers are written while their pages are locked, so they are not
+  // changed meanwhile and their frames are not evicted and reused. Shards are
+  // written one after the other, to not hold pages of one shard while waiting
+  // for another.
+  for (auto& shard : shards_) {
+    std::vector<BufferedFile::PageBuffer> pages;
+    std::vector<ExLock<RwMutex>> locks;
+    std::vector<ShLock<RwMutex>> shared_locks;
+    {
+      ShGuard<RwMutex> shard_guard{ shard->mtx };
+      shard->forEachFrame([&](CachePage& p) {
+        if (!p.dirty.load()) return;
+
+        if (all) {
+          // Nobody writes during a flush, but readers may hold the page. A
+          // shared lock is enough to keep the frame, waiting for an exclusive
+          // one could deadlock with a reader requesting another page.
+          ShLock<RwMutex> lck{ p.mutex };
+          if (p.dirty.exchange(false)) {
+            pages.emplace_back(p.page_nr, p.data);
+            shared_locks.push_back(std::move(lck));
+            --dirty_pages_;
+          }
+          return;
+        }
+
+        // a page in use may be written right now, a later pass takes care
+        // of it
+        ExLock<RwMutex> lck{ p.mutex, boost::try_to_lock };
+        if (lck.owns_lock() && p.dirty.exchange(false)) {
+          pages.emplace_back(p.page_nr, p.data);
+          locks.push_back(std::move(lck));
+          --dirty_pages_;
+        }
+      });
+    }
+    if (pages.empty()) continue;
+
+    std::sort(pages.begin(), pages.end(),
+              [](const BufferedFile::PageBuffer& l,
+                 const BufferedFile::PageBuffer& r) { return l.first < r.first; });
+    try {
+      buffered_->write(pages);
+    } catch (const FileError&) {
+      failed_ = true;
+      throw;
+    }
+  }
+}
+
+void Cache::writeBackLoop() {
+  ExLock<Mutex> lck{ thread_mtx_ };
+  while (!stop_) {
+    if (!wake_) {
+      thread_cond_.wait_for(
+          lck, boost::chrono::milliseconds(k_writeback_interval_ms));
+    }
+    wake_ = false;
+    if (!stop_ && dirty_pages_ >= writeback_threshold_) {
+      in_pass_ = true;
+      lck.unlock();
+      try {
+        writeBack(false);
+      } catch (const FileError&) {
+        // reported by the next flush
+      }
+      lck.lock();
+      in_pass_ = false;
+    }
+    ++passes_;
+    clean_cond_.notify_all();
+  }
+}
+
+void Cache::flush() {
+  writeBack(true);
+
+  Guard<Mutex> guard{ writeback_mtx_ };
+  if (failed_) throw FileError("failed to write back pages");
+  if (buffered_) buffered_->sync();
+}
+
+bool Cache::contains(PageNr page_nr) {
+  auto& shard = shardOf(page_nr);
+  ShGuard<RwMutex> guard{ shard.mtx };
+  return shard.map.count(page_nr) > 0;
+}
+
+void Cache::prefetch(std::vector<PageNr> pages) {
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+  pages.erase(std::remove_if(pages.begin(), pages.end(),
+                             [this](PageNr p) { return contains(p); }),
+              pages.end());
+
+  for (size_t i = 0; i < pages.size();) {
+    auto run = i + 1;
+    while (run < pages.size() && pages[run].value == pages[run - 1].value + 1)
+      ++run;
+    prefetch(pages[i], run - i);
+    i = run;
+  }
+}
+
+void Cache::prefetch(PageNr first, size_t count) {
+  if (mapped_) return mapped_->prefetch(first, count);
+
+  std::vector<BufferedFile::PageBuffer> pages;
+  std::vector<std::pair<CachePage*, ExLock<RwMutex>>> frames;
+  for (size_t i = 0; i < count; ++i) {
+    PageNr page_nr{ first.value + i };
+    auto& shard = shardOf(page_nr);
+
+    // never wait for a shard while holding pages, just skip the page
+    ExLock<RwMutex> guard{ shard.mtx, boost::try_to_lock };
+    if (!guard.owns_lock() || shard.map.count(page_nr) > 0) continue;
+
+    frames.push_back(reserveFrame(shard, page_nr));
+    pages.emplace_back(page_nr, frames.back().first->data);
+  }
+  if (pages.empty()) return;
+
+  try {
+    buffered_->read(pages);
+  } catch (...) {
+    // only a hint, the pages are read again when they are needed
+    for (size_t i = 0; i < frames.size(); ++i) {
+      auto& frame = frames[i];
+      frame.first->failed = true;
+      frame.second.unlock();
+      discardFailed(shardOf(pages[i].first), *frame.first, pages[i].first);
+    }
+  }
+}
 
 } // namespace cheesebase
@@ -1,18 +1,26 @@
 // Licensed under the Apache License 2.0 (see LICENSE file).
 
 // Provides memory pages to read and write from. Recently requested pages are
-// cached. Writable pages are marked and later written back to disk.
+// cached. Writable pages are marked dirty and written back to disk by a
+// background thread, when evicted or when the cache is flushed. Writers wait
+// for the background thread while too many pages are dirty.
 
 #pragma once
 
 #include "common.h"
+#include "io_ring.h"
+#include "options.h"
+#include "storage_engine.h"
 #include "sync.h"
 #include <vector>
 
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
-#include <fstream>
+#include <boost/thread/thread.hpp>
+#include <atomic>
+#include <deque>
 #include <list>
+#include <memory>
 #include <unordered_map>
 
 namespace cheesebase {
@@ -32,126 +40,369 @@ struct CachePage {
   static const uint64_t sUnused = static_cast<uint64_t>(-1);
 
   RwMutex mutex;
-  boost::interprocess::mapped_region region;
+  Byte* data{ nullptr };
+  Byte* buffer{ nullptr }; // kept by the frame unless the file is mapped
   PageNr page_nr{ sUnused };
+  std::atomic<bool> referenced{ false }; // second chance bit for CLOCK
+  std::atomic<bool> dirty{ false };      // written since last write back
+  bool failed{ false }; // loading failed, guarded by mutex
 
   bool inUse() const noexcept { return page_nr.value != sUnused; }
 
+  // set the reference bit, avoids dirtying the cache line if already set
+  void touch() noexcept {
+    if (!referenced.load(std::memory_order_relaxed))
+      referenced.store(true, std::memory_order_relaxed);
+  }
+
   template <typename View>
   View getView() const {
-    return View(static_cast<Byte*>(region.get_address()),
-                static_cast<typename View::index_type>(region.get_size()));
+    return View(data, static_cast<typename View::index_type>(k_page_size));
   }
 };
 
-class PageList {
+// One partition of the cache. Pages are assigned to a shard by the hash of
+// their PageNr, so threads working on different pages rarely share a lock.
+// A hit only sets the reference bit of the frame, all bookkeeping is done when
+// a new page is loaded:
+// - clock: all frames are in one CLOCK ring. The sweeping hand clears the
+//   reference bits and picks the first frame not referenced since.
+// - two_q: new pages enter a FIFO probation queue. Pages evicted from it are
+//   remembered for a while (ghosts); when requested again they go to the
+//   main CLOCK ring. A scan only cycles through the probation queue.
+class Shard {
 public:
-  using iterator = std::list<CachePage>::iterator;
-  using const_iterator = std::list<CachePage>::iterator;
+  Shard(size_t max_pages, CachePolicy policy);
+
+  // Return a frame for page_nr and a fitting exclusive lock. Uses an empty
+  // frame while below the size limit, otherwise a victim picked by the policy.
+  // Frames locked by someone else are skipped; if all are, the shard grows
+  // beyond its limit. The caller needs to hold mtx exclusively.
+  std::pair<CachePage*, ExLock<RwMutex>> getFrame(PageNr page_nr);
+
+  // Return an unlocked victim while the shard is beyond its limit, nullptr
+  // otherwise. The caller frees its page and gives it back with retire().
+  // Needs mtx exclusively.
+  std::pair<CachePage*, ExLock<RwMutex>> surplusFrame();
+
+  // Keep an unused frame aside until the shard grows again. Needs mtx
+  // exclusively.
+  void retire(CachePage* frame) { spare_.push_back(frame); }
+
+  // Call f for every frame. The caller needs to hold mtx.
+  template <class F>
+  void forEachFrame(F f) {
+    for (auto& frame : frames_) f(frame);
+  }
+
+  RwMutex mtx; // guards everything in the shard
+  std::unordered_map<PageNr, CachePage*, PageNr::Hash> map;
 
-  PageList(size_t max_pages) : max_pages_{ max_pages } {}
+private:
+  using Victim = std::pair<CachePage*, ExLock<RwMutex>>;
 
-  // mark p as most recently used (move to front of list)
-  void bumpPage(iterator p);
+  // Remove and return an unlocked frame, nullptr if there is none. With
+  // clean_only, dirty frames are skipped.
+  Victim clockVictim(bool clean_only);
+  Victim probationVictim(bool clean_only);
 
-  // return new or old+bumped page and a fitting exclusive lock
-  std::pair<iterator, ExLock<RwMutex>> getPage();
+  // a clean frame if there is one, they are evicted without writing
+  Victim victim();
 
-  void flush();
+  // number of frames holding pages
+  size_t size() const noexcept { return main_.size() + probation_.size(); }
 
-private:
-  Mutex mtx_;
-  std::list<CachePage> pages_;
+  void addGhost(PageNr page_nr);
+
+  std::deque<CachePage> frames_; // deque never moves existing elements
+  std::vector<CachePage*> spare_; // frames not in use after an overshoot
   size_t max_pages_;
+  CachePolicy policy_;
+
+  std::list<CachePage*> main_; // CLOCK ring
+  std::list<CachePage*>::iterator hand_;
+  std::list<CachePage*> probation_;
+  std::list<PageNr> ghosts_;
+  std::unordered_map<PageNr, std::list<PageNr>::iterator, PageNr::Hash>
+      ghost_map_;
 };
 
+// DB file. The file is preallocated in geometrically growing extents. The
+// logical size (end of the last page used) is tracked separately and the file
+// is truncated to it when closed.
 class File {
 public:
-  File(const std::string& filename, OpenMode m);
-  bi::mapped_region getRegion(PageNr page_nr);
+  // flags are passed to open(2) in addition to O_RDWR | O_CREAT
+  File(const std::string& filename, OpenMode m, int flags = 0);
+  ~File();
+
+  File(const File&) = delete;
+  File& operator=(const File&) = delete;
+
+protected:
+  // mark the page as used and extend the file if needed, needs mtx_
+  void usePage(PageNr page_nr);
+
+  // mark the first end bytes as used and extend the file if needed, needs mtx_
+  void useBytes(uint64_t end);
+
+  // grow the physical file to hold at least size bytes
+  void extendFile(uint64_t size);
+
+  Mutex mtx_;
+  int fd_{ -1 };
+  uint64_t size_{ 0 };          // logical size
+  uint64_t physical_size_{ 0 }; // allocated size on disk
+};
+
+// DB file mapped into memory in chunks of k_map_chunk_size. A chunk is mapped
+// on first access and stays mapped until the File is destroyed, so pages are
+// just pointers into the mapping.
+class MappedFile : public File {
+public:
+  MappedFile(const std::string& filename, OpenMode m);
+  ~MappedFile();
+
+  // Get pointer to the start of a page, extends the file if needed.
+  Byte* getPage(PageNr page_nr);
+
+  // Write back count consecutive pages starting at first to disk.
+  void flush(PageNr first, size_t count = 1);
+
+  // Start reading count consecutive pages starting at first from disk in the
+  // background. Pages beyond the end of the file are ignored.
+  void prefetch(PageNr first, size_t count = 1);
 
 private:
-  uint64_t extendFile(uint64_t size);
+  bi::mapped_region& getChunk(size_t chunk_nr);
 
   bi::file_mapping file_;
-  std::ofstream fstream_;
-  uint64_t size_{ 0 };
+  std::vector<bi::mapped_region> chunks_;
 };
 
-} // namespace cache_detail
+// DB file read and written through page buffers of the caller.
+class BufferedFile : public File {
+public:
+  using File::File;
+  virtual ~BufferedFile() = default;
 
-////////////////////////////////////////////////////////////////////////////////
+  using PageBuffer = std::pair<PageNr, Byte*>;
+
+  // Read pages into the buffers, pages never written are filled with zeros.
+  virtual void read(const std::vector<PageBuffer>& pages) = 0;
 
-// Locked reference of a page.
-template <class View>
-class PageRef {
-  template <class V>
-  friend class PageRef;
+  // Write the buffers to the pages.
+  virtual void write(const std::vector<PageBuffer>& pages) = 0;
+
+  // Wait for written pages to be durable.
+  virtual void sync() = 0;
+};
 
+// DB file opened with O_DIRECT. Pages are copied between the disk and buffers
+// of the caller, bypassing the page cache of the kernel. Buffers have to be
+// aligned to k_page_size. Batches of pages are submitted at once.
+class DirectFile : public BufferedFile {
 public:
-  PageRef() = default;
+  DirectFile(const std::string& filename, OpenMode m);
 
-  template <class V>
-  PageRef(View view, PageRef<V>&& other)
-      : view_{ view }, lock_{ std::move(other.lock_) } {}
+  void read(const std::vector<PageBuffer>& pages) override;
+  void write(const std::vector<PageBuffer>& pages) override;
+  void sync() override;
 
-  template <class L>
-  PageRef(View page, L&& lock)
-      : view_{ page }, lock_{ std::forward<L>(lock) } {}
+private:
+  std::vector<IoRequest> requests(const std::vector<PageBuffer>& pages,
+                                  IoRequest::Op op);
 
-  MOVE_ONLY(PageRef)
+  IoRing ring_;
+};
 
-  View get() const noexcept {
-    Expects(lock_.owns_lock());
-    return view_;
+constexpr uint64_t k_page_map_magic{ 0x50414d5042534843 }; // CHSBPMAP
+
+// Header of the page map file, followed by count extents.
+CB_PACKED(struct DskPageMapHdr {
+  uint64_t magic;
+  uint64_t count;
+  uint32_t checksum; // hash of the extents
+  uint32_t reserved;
+});
+static_assert(sizeof(DskPageMapHdr) == 24, "Invalid DskPageMapHdr size");
+
+// DB file of compressed pages. Every page is stored in an extent of whole
+// k_extent_granule units, found through the page map. The page map is kept in
+// memory and in a second file with k_page_map_suffix.
+// A written page always gets a new extent. If the old one is referenced by the
+// page map of the last sync, it is only reused after the next sync replaced
+// the page map file. So the file on disk stays consistent with the page map
+// of the last sync whenever the process stops. Free extents are not stored,
+// they are the gaps between the extents of the page map.
+class CompressedFile : public BufferedFile {
+public:
+  CompressedFile(const std::string& filename, OpenMode m);
+
+  void read(const std::vector<PageBuffer>& pages) override;
+  void write(const std::vector<PageBuffer>& pages) override;
+  // Replaces the page map file and releases the extents of pages written
+  // since the last sync. The caller guarantees one sync at a time.
+  void sync() override;
+
+private:
+  // Extents are encoded as offset in units of k_extent_granule in the upper
+  // 48 bits and the size in bytes in the lower 16. 0 for pages never written.
+  static uint64_t extent(uint64_t offset, size_t size) {
+    return offset / k_extent_granule << 16 | size;
   }
-  View operator*() const noexcept {
-    Expects(lock_.owns_lock());
-    return view_;
+  static uint64_t extentOffset(uint64_t e) {
+    return (e >> 16) * k_extent_granule;
   }
-  const View* operator->() const noexcept {
-    Expects(lock_.owns_lock());
-    return &view_;
+  static size_t extentSize(uint64_t e) { return e & 0xffff; }
+  static size_t extentUnits(uint64_t e) {
+    return (extentSize(e) + k_extent_granule - 1) / k_extent_granule;
   }
 
-  void free() { lock_.unlock(); }
+  // take an extent for size bytes, needs mtx_
+  uint64_t allocate(size_t size);
+
+  // give back an extent that is referenced by no page map, needs mtx_
+  void release(uint64_t e);
+
+  void loadPageMap();
+  void storePageMap(const std::vector<uint64_t>& map);
+
+  std::string map_file_;
+  std::vector<uint64_t> map_;    // extent by PageNr, guarded by mtx_
+  std::vector<uint64_t> synced_; // page map of the last sync
+
+  // Offsets of free extents by number of units. Replaced extents of the last
+  // sync are pending until the page map on disk does not need them.
+  std::vector<std::vector<uint64_t>> free_;
+  std::vector<uint64_t> pending_;
+
+  IoRing ring_;
+};
+
+// Page sized buffers aligned for direct I/O, allocated in chunks of
+// k_buffer_chunk_pages. Frames of the cache keep a buffer once they got one,
+// so the pool never takes any back.
+class BufferPool {
+public:
+  BufferPool() = default;
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  Byte* get();
+  void put(Byte* buffer);
 
 private:
-  View view_;
-  ShLock<RwMutex> lock_;
+  Mutex mtx_;
+  std::vector<Byte*> chunks_;
+  std::vector<Byte*> free_;
+  size_t used_{ k_buffer_chunk_pages }; // buffers taken from the last chunk
 };
 
-template <std::ptrdiff_t S>
-using ReadRef = PageRef<gsl::span<const Byte, S>>;
-template <std::ptrdiff_t S>
-using WriteRef = PageRef<gsl::span<Byte, S>>;
+} // namespace cache_detail
+
+////////////////////////////////////////////////////////////////////////////////
 
-class Cache {
+// Storage engine of databases in a file.
+class Cache : public StorageEngine {
 public:
-  Cache(const std::string& filename, OpenMode mode, size_t nr_pages);
-  ~Cache();
+  Cache(const std::string& filename, OpenMode mode, size_t nr_pages,
+        CachePolicy policy = CachePolicy::clock,
+        FileAccess access = FileAccess::mapped);
+  ~Cache() override;
+
+  PageRef<PageReadView> readPage(PageNr page_nr) override;
+  PageRef<PageWriteView> writePage(PageNr page_nr) override;
+
+  // Write back all dirty pages. The caller guarantees that no page is written
+  // concurrently.
+  void flush() override;
+
+  // Whether a page is currently held in the cache.
+  bool contains(PageNr page_nr);
+
+  // Hint that count pages starting at first are read soon. Without a mapped
+  // file they are loaded into the cache with a single batch of reads.
+  void prefetch(PageNr first, size_t count = 1);
 
-  PageRef<PageReadView> readPage(PageNr page_nr);
-  PageRef<PageWriteView> writePage(PageNr page_nr);
-  void flush();
+  // Prefetch the pages not cached yet, adjacent pages with a single request.
+  void prefetch(std::vector<PageNr> pages) override;
+
+  bool persistent() const noexcept override { return true; }
+
+  // Number of cached pages written since their last write back.
+  size_t dirtyPages() const noexcept { return dirty_pages_; }
+
+  // Wake the writeback thread and wait until it finished a pass that saw all
+  // pages dirtied before the call. A pass writes back the pages not in use if
+  // more than the writeback threshold are dirty.
+  void waitForWriteBack();
 
 private:
   // return specific page, creates it if not found
   template <typename View>
   PageRef<View> getPage(PageNr page_nr);
 
-  // return an unused page, may free the least recently used page
-  std::pair<cache_detail::PageList::iterator, ExLock<RwMutex>> getFreePage();
-
-  // flushed page to disk
-  void freePage(cache_detail::CachePage& p);
-
-  cache_detail::File file_;
-  cache_detail::PageList pages_;
-
-  RwMutex map_mtx_;
-  std::unordered_map<PageNr, cache_detail::PageList::iterator, PageNr::Hash>
-      map_;
+  // lock a cached page, marks it dirty if View is writable
+  template <typename View>
+  PageRef<View> lockPage(cache_detail::CachePage& page);
+
+  cache_detail::Shard& shardOf(PageNr page_nr);
+
+  // Take a frame for page_nr and lock it exclusively. The content of the page
+  // still has to be loaded. Needs exclusive shard lock.
+  std::pair<cache_detail::CachePage*, ExLock<RwMutex>>
+  reserveFrame(cache_detail::Shard& shard, PageNr page_nr);
+
+  // Remove a frame from the cache after loading it failed.
+  void discardFailed(cache_detail::Shard& shard, cache_detail::CachePage& p,
+                     PageNr page_nr);
+
+  // write back page if dirty and mark it unused, needs exclusive shard lock
+  void freePage(cache_detail::Shard& shard, cache_detail::CachePage& p);
+
+  void markDirty(cache_detail::CachePage& p);
+
+  // Wait for the writeback thread while too many pages are dirty. Returns
+  // after one pass at the latest, the writer may hold dirty pages the pass
+  // has to skip. Needs no lock of the cache.
+  void throttle();
+
+  // Wake the writeback thread until a pass that started after the call
+  // finished or, with until_clean, fewer pages than the limit are dirty.
+  // lck holds thread_mtx_.
+  void waitForPass(ExLock<Mutex>& lck, bool until_clean);
+
+  // Write back dirty pages in order of PageNr. Pages currently in use are
+  // skipped, unless all is set.
+  void writeBack(bool all);
+  void writeBackBuffered(bool all);
+
+  // body of the writeback thread
+  void writeBackLoop();
+
+  // exactly one of them is used
+  std::unique_ptr<cache_detail::MappedFile> mapped_;
+  std::unique_ptr<cache_detail::BufferedFile> buffered_;
+  cache_detail::BufferPool buffers_;
+  std::vector<std::unique_ptr<cache_detail::Shard>> shards_;
+
+  std::atomic<size_t> dirty_pages_{ 0 };
+  size_t writeback_threshold_;
+  size_t dirty_limit_;
+  Mutex writeback_mtx_; // one write back at a time
+  bool failed_{ false }; // a write back failed, guarded by writeback_mtx_
+
+  Mutex thread_mtx_;
+  Cond thread_cond_;
+  Cond clean_cond_; // a pass of the writeback thread finished
+  bool stop_{ false };
+  bool wake_{ false };    // someone waits for the next pass
+  bool in_pass_{ false }; // the writeback thread is writing pages
+  uint64_t passes_{ 0 };  // finished rounds of the writeback thread
+  boost::thread thread_;
 };
 
 } // namespace cheesebase
@@ -8,6 +8,9 @@
 #include "query/eval.h"
 #include "seri/array.h"
 #include "seri/object.h"
+#include <iterator>
+#include <map>
+#include <set>
 #include <sstream>
 
 namespace cheesebase {
@@ -105,8 +108,113 @@ void insertValue(Database& db, Location::const_iterator loc,
     throw CRUDError();
 }
 
+// Writable containers opened by the mutations of a batch, shared by the
+// mutations at the same location. Values created, replaced or removed by the
+// batch are remembered: paths are resolved on the state before the batch, and
+// the handle of an old version must not be written to.
+class BatchHandles {
+public:
+  BatchHandles(Transaction& ta) : ta_{ ta } {}
+
+  template <class T>
+  T& open(const Location& loc) {
+    auto it = handles_.find(loc);
+    if (it == handles_.end()) {
+      for (auto end = loc.begin(); end <= loc.end(); ++end) {
+        if (changed_.count(Location(loc.begin(), end)) > 0)
+          throw CRUDError("Batch writes into a value it changed");
+      }
+      it = handles_.emplace(loc, openWritable(ta_, loc.begin(), loc.end()))
+               .first;
+    }
+    auto coll = dynamic_cast<T*>(it->second.get());
+    if (coll == nullptr) throw NotFoundError();
+    return *coll;
+  }
+
+  // Mark the value at loc as changed, before it is written.
+  void change(const Location& loc) {
+    auto it = handles_.lower_bound(loc);
+    if (it != handles_.end() && it->first.size() >= loc.size() &&
+        std::equal(loc.begin(), loc.end(), it->first.begin()))
+      throw CRUDError("Batch changes a value it writes into");
+    changed_.insert(loc);
+  }
+
+  Writes getWrites() const {
+    Writes writes;
+    for (auto& h : handles_) {
+      auto w = h.second->getWrites();
+      std::move(w.begin(), w.end(), std::back_inserter(writes));
+    }
+    return writes;
+  }
+
+private:
+  Transaction& ta_;
+  std::map<Location, std::unique_ptr<disk::ValueW>> handles_;
+  std::set<Location> changed_;
+};
+
 } // anonymous namespace
 
+////////////////////////////////////////////////////////////////////////////////
+// WriteBatch
+
+void WriteBatch::insert(const std::string& key, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(key);
+  add(Op::insert, std::move(loc), val);
+}
+
+void WriteBatch::insert(uint64_t index, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(index);
+  add(Op::insert, std::move(loc), val);
+}
+
+void WriteBatch::update(const std::string& key, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(key);
+  add(Op::update, std::move(loc), val);
+}
+
+void WriteBatch::update(uint64_t index, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(index);
+  add(Op::update, std::move(loc), val);
+}
+
+void WriteBatch::upsert(const std::string& key, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(key);
+  add(Op::upsert, std::move(loc), val);
+}
+
+void WriteBatch::upsert(uint64_t index, const model::Value& val,
+                        const Location& location) {
+  auto loc = location;
+  loc.push_back(index);
+  add(Op::upsert, std::move(loc), val);
+}
+
+void WriteBatch::append(const model::Value& val, const Location& location) {
+  add(Op::append, location, val);
+}
+
+void WriteBatch::remove(const Location& location) {
+  add(Op::remove, location, model::Missing());
+}
+
+void WriteBatch::add(Op op, Location loc, const model::Value& val) {
+  ops_.push_back({ op, std::move(loc), val });
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Query
 
@@ -203,8 +311,8 @@ void Query::remove() { cb_->remove(location_); }
 ////////////////////////////////////////////////////////////////////////////////
 // CheeseBase
 
-CheeseBase::CheeseBase(const std::string& db_name)
-    : db_(std::make_unique<Database>(db_name)) {}
+CheeseBase::CheeseBase(const std::string& db_name, const Options& options)
+    : db_(std::make_unique<Database>(db_name, options)) {}
 
 CheeseBase::~CheeseBase() {}
 
@@ -265,6 +373,94 @@ uint64_t CheeseBase::append(const model::Value& val, const Location& loc) {
   return ret.value;
 }
 
+uint64_t CheeseBase::appendAll(const std::vector<model::Value>& vals,
+                               const Location& loc) {
+  Expects(!vals.empty());
+  if (loc.empty()) throw NotFoundError();
+  auto ta = db_->startTransaction();
+
+  auto coll = openWritable(ta, loc.begin(), loc.end());
+  auto arr = dynamic_cast<disk::ArrayW*>(coll.get());
+  if (arr == nullptr) throw NotFoundError();
+
+  auto first = arr->append(vals.front());
+  for (auto it = vals.begin() + 1; it != vals.end(); ++it) arr->append(*it);
+
+  ta.commit(coll->getWrites());
+
+  return first.value;
+}
+
+void CheeseBase::upsertAll(
+    const std::vector<std::pair<std::string, model::Value>>& members,
+    const Location& loc) {
+  auto ta = db_->startTransaction();
+
+  auto coll = openWritable(ta, loc.begin(), loc.end());
+  auto obj = dynamic_cast<disk::ObjectW*>(coll.get());
+  if (obj == nullptr) throw NotFoundError();
+
+  for (auto& m : members) {
+    if (!obj->insert(m.first, m.second, disk::Overwrite::Upsert))
+      throw CRUDError();
+  }
+
+  ta.commit(coll->getWrites());
+}
+
+void CheeseBase::write(const WriteBatch& batch) {
+  if (batch.empty()) return;
+  auto ta = db_->startTransaction();
+  BatchHandles handles{ ta };
+  Location parent;
+
+  auto overwriteOf = [](WriteBatch::Op op) {
+    return op == WriteBatch::Op::update
+               ? disk::Overwrite::Update
+               : op == WriteBatch::Op::upsert ? disk::Overwrite::Upsert
+                                              : disk::Overwrite::Insert;
+  };
+
+  for (auto& m : batch.ops_) {
+    auto& loc = m.location;
+    if (m.op == WriteBatch::Op::append) {
+      if (loc.empty()) throw NotFoundError();
+      auto& arr = handles.open<disk::ArrayW>(loc);
+      auto index = arr.append(m.value);
+      auto changed = loc;
+      changed.push_back(index.value);
+      handles.change(changed);
+      continue;
+    }
+
+    if (loc.empty()) throw CRUDError();
+    parent.assign(loc.begin(), loc.end() - 1);
+    bool success;
+    if (loc.back().which() == 0) {
+      auto& obj = handles.open<disk::ObjectW>(parent);
+      handles.change(loc);
+      auto& key = boost::get<std::string>(loc.back());
+      success = m.op == WriteBatch::Op::remove
+                    ? obj.remove(key)
+                    : obj.insert(key, m.value, overwriteOf(m.op));
+    } else {
+      auto& arr = handles.open<disk::ArrayW>(parent);
+      handles.change(loc);
+      auto key = Key(boost::get<uint64_t>(loc.back()));
+      success = m.op == WriteBatch::Op::remove
+                    ? arr.remove(key)
+                    : arr.insert(key, m.value, overwriteOf(m.op));
+    }
+
+    if (!success) {
+      if (m.op == WriteBatch::Op::remove) throw NotFoundError();
+      throw CRUDError();
+    }
+  }
+
+  ta.commit(handles.getWrites());
+}
+
 model::Value CheeseBase::get(const Location& location) const {
   if (location.empty()) {
     return disk::ObjectR(*db_, kRoot).getValue();
@@ -4,6 +4,7 @@
 
 #pragma once
 #include "model/model.h"
+#include "options.h"
 #include <memory>
 #include <string>
 
@@ -13,6 +14,47 @@ class CheeseBase;
 
 using Location = std::vector<boost::variant<std::string, uint64_t>>;
 
+// Mutations collected to be applied at once by CheeseBase::write. They take
+// the same arguments as the methods of CheeseBase.
+class WriteBatch {
+  friend CheeseBase;
+
+public:
+  void insert(const std::string& key, const model::Value&,
+              const Location& = {});
+  void insert(uint64_t index, const model::Value&, const Location& = {});
+
+  void update(const std::string& key, const model::Value&,
+              const Location& = {});
+  void update(uint64_t index, const model::Value&, const Location& = {});
+
+  void upsert(const std::string& key, const model::Value&,
+              const Location& = {});
+  void upsert(uint64_t index, const model::Value&, const Location& = {});
+
+  void append(const model::Value&, const Location&);
+
+  void remove(const Location&);
+
+  size_t size() const noexcept { return ops_.size(); }
+  bool empty() const noexcept { return ops_.empty(); }
+  void clear() noexcept { ops_.clear(); }
+
+private:
+  enum class Op { insert, update, upsert, append, remove };
+
+  // location of the value, of the array for append
+  struct Mutation {
+    Op op;
+    Location location;
+    model::Value value;
+  };
+
+  void add(Op, Location, const model::Value&);
+
+  std::vector<Mutation> ops_;
+};
+
 class Query {
   friend CheeseBase;
 
@@ -45,7 +87,7 @@ class CheeseBase {
   friend Query;
 
 public:
-  explicit CheeseBase(const std::string& db_name);
+  explicit CheeseBase(const std::string& db_name, const Options& options = {});
   ~CheeseBase();
 
   Query operator[](std::string key);
@@ -64,6 +106,20 @@ public:
   void upsert(uint64_t index, const model::Value&, const Location& = {});
   uint64_t append(const model::Value&, const Location&);
 
+  // Append all values to the array at location in one transaction. Returns
+  // the index of the first one. Values must not be empty.
+  uint64_t appendAll(const std::vector<model::Value>&, const Location&);
+
+  // Upsert all members into the object at location in one transaction.
+  void upsertAll(const std::vector<std::pair<std::string, model::Value>>&,
+                 const Location& = {});
+
+  // Apply the mutations of the batch in order, in one transaction. If one of
+  // them fails nothing is written. Containers created or replaced by the
+  // batch can not be written into by later mutations of the same batch,
+  // CRUDError is thrown then.
+  void write(const WriteBatch&);
+
   model::Value get(const Location&) const;
 
   void remove(const Location&);
@@ -20,8 +20,76 @@ const size_t k_page_size_power{ 12 };
 //! Size of one memory page. Change power instead of this.
 const size_t k_page_size{ 1u << k_page_size_power };
 
-//! Maximum size of pages kept in cache. Memory usage will be higher than this.
-const size_t k_default_cache_size{ k_page_size * 1024 * 10 }; // 40 MB - test
+//! Power of size of one file mapping chunk: chunk-size = 2^this
+const size_t k_map_chunk_power{ 26 };
+
+//! Size of the chunks the DB file is mapped in. Change power instead of this.
+const size_t k_map_chunk_size{ static_cast<size_t>(1) << k_map_chunk_power };
+
+//! Maximum amount the DB file grows by at once. Below this it doubles in size.
+const size_t k_max_file_growth{ k_map_chunk_size * 16 }; // 1 GB
+
+//! Default size of pages kept in cache. Memory usage will be higher than this.
+//! Overwritten by Options::cache_size.
+const size_t k_default_cache_size{ k_page_size * 1024 * 10 }; // 40 MB
+
+//! Number of independently locked partitions of the page cache.
+const size_t k_cache_shards{ 64 };
+
+//! Minimum number of pages per cache shard. Small caches use fewer shards.
+const size_t k_min_shard_pages{ 16 };
+
+//! Percentage of dirty pages in the cache that wakes the writeback thread.
+const size_t k_writeback_percent{ 10 };
+
+//! Interval in which the writeback thread checks for dirty pages anyway.
+const size_t k_writeback_interval_ms{ 1000 };
+
+//! Percentage of dirty pages in the cache at which writers wait for a pass of
+//! the writeback thread.
+const size_t k_dirty_limit_percent{ 30 };
+
+//! Number of page buffers allocated at once for direct file access.
+const size_t k_buffer_chunk_pages{ 64 };
+
+//! Number of requests in flight per batch of direct file access.
+const unsigned k_io_ring_entries{ 64 };
+
+//! Unit of the extents holding compressed pages.
+const size_t k_extent_granule{ 256 };
+
+//! Suffix of the file mapping pages of a compressed DB file to their extents.
+const char* const k_page_map_suffix{ ".pagemap" };
+
+//! Maximum number of k_map_chunk_size chunks of an in-memory database.
+const size_t k_memory_max_chunks{ 4096 }; // 256 GB
+
+//! Number of locks shared by the pages of an in-memory database.
+const size_t k_memory_lock_stripes{ 64 };
+
+//! Number of stripes of the block lock table.
+const size_t k_lock_stripes{ 256 };
+
+//! Number of blocks per stripe that can be locked at the same time without
+//! allocating more entries.
+const size_t k_lock_stripe_entries{ 16 };
+
+//! Smallest and largest size of B-tree nodes, in bytes.
+const size_t k_min_node_size{ 256 };
+const size_t k_max_node_size{ 2048 };
+
+//! Node size of newly created B-trees. Overwritten by Options::node_size.
+const size_t k_default_node_size{ 256 };
+
+//! Number of leafs a scan of a B-tree prefetches ahead of the leaf it reads.
+const size_t k_readahead_leafs{ 64 };
+
+//! Percentage of the space of B-tree nodes used when a tree is built at once.
+//! The rest is left for later inserts, which would split full nodes.
+const size_t k_bulk_fill_percent{ 90 };
+
+//! Size of the journal that triggers a checkpoint.
+const size_t k_journal_checkpoint_size{ k_page_size * 1024 * 16 }; // 64 MB
 
 using Byte = gsl::byte;
 
@@ -193,9 +261,20 @@ using PageReadView = gsl::span<const Byte, k_page_size>;
 using PageWriteView = gsl::span<Byte, k_page_size>;
 
 
-constexpr uint16_t kVersion{ 0x0001 };
-constexpr uint64_t k_magic{ 0x0000455342534843 + // CHSBSExx
-                            (static_cast<uint64_t>(kVersion) << 48) };
+// Version 2: B-tree leafs with slot directory.
+// Version 3: node size stored per node, internal nodes with separate key array.
+// Version 4: root nodes of B-trees keep the address of the rightmost leaf.
+// Version 5: arrays without holes are stored densely.
+// Version 6: internal nodes keep the number of entries below every child.
+// Nodes of older files are read as well and converted when they are written.
+constexpr uint16_t kVersion{ 0x0006 };
+constexpr uint16_t kMinVersion{ 0x0001 };
+
+constexpr uint64_t magicOfVersion(uint16_t version) {
+  return 0x0000455342534843 + // CHSBSExx
+         (static_cast<uint64_t>(version) << 48);
+}
+constexpr uint64_t k_magic{ magicOfVersion(kVersion) };
 
 CB_PACKED(struct DskDatabaseHdr {
   uint64_t magic;
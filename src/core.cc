@@ -8,22 +8,30 @@
 #include "storage.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
 
 namespace cheesebase {
 
-Database::Database(const std::string& file)
-    : lock_pool_{ std::make_unique<BlockLockPool>() } {
+Database::Database(const std::string& file, const Options& options)
+    : node_size_{ options.node_size }
+    , lock_pool_{ std::make_unique<BlockLockPool>() } {
+  if (node_size_ < k_min_node_size || node_size_ > k_max_node_size ||
+      (node_size_ & (node_size_ - 1)) != 0)
+    throw DatabaseError("Invalid B-tree node size");
+
   DskDatabaseHdr hdr;
 
-  if (boost::filesystem::exists(file)) {
-    store_ = std::make_unique<Storage>(file, OpenMode::open_existing);
+  if (!options.in_memory && boost::filesystem::exists(file)) {
+    store_ = std::make_unique<Storage>(file, OpenMode::open_existing, options);
     auto page = store_->loadPage(PageNr(0));
     hdr = bytesAsType<DskDatabaseHdr>(*page);
 
     auto kc_blk =
         bytesAsType<KeyNext>(page->subspan(ssizeof<DskDatabaseHdr>()));
     kc_blk.check();
-    if (hdr.magic != k_magic || hdr.free_alloc_pg.value % k_page_size != 0 ||
+    auto version = static_cast<uint16_t>(hdr.magic >> 48);
+    if (hdr.magic != magicOfVersion(version) || version < kMinVersion ||
+        version > kVersion || hdr.free_alloc_pg.value % k_page_size != 0 ||
         hdr.free_alloc_t1.value % (k_page_size / 2) != 0 ||
         hdr.free_alloc_t2.value % (k_page_size / 4) != 0 ||
         hdr.free_alloc_t3.value % (k_page_size / 8) != 0 ||
@@ -32,6 +40,13 @@ Database::Database(const std::string& file)
         hdr.end_of_file.value < k_page_size)
       throw DatabaseError("Invalid database header");
 
+    // older files are migrated lazily, but may not be opened by an older
+    // version any more
+    if (version < kVersion) {
+      hdr.magic = k_magic;
+      store_->storeWrite({ { Addr(offsetof(DskDatabaseHdr, magic)), k_magic } });
+    }
+
     alloc_ = std::make_unique<Allocator>(hdr, *store_);
     keycache_ = std::make_unique<KeyCache>(
         Block{ Addr(sizeof(DskDatabaseHdr)),
@@ -39,7 +54,7 @@ Database::Database(const std::string& file)
         *store_);
 
   } else {
-    store_ = std::make_unique<Storage>(file, OpenMode::create_new);
+    store_ = std::make_unique<Storage>(file, OpenMode::create_new, options);
     memset(&hdr, 0, sizeof(hdr));
     hdr.magic = k_magic;
     hdr.end_of_file = Addr(k_page_size);
@@ -79,15 +94,41 @@ boost::optional<Key> Database::getKey(const std::string& k) const {
   return keycache_->getKey(k);
 }
 
-BlockLockW Database::getLockW(Addr addr) { return lock_pool_->getLockW(addr); }
 BlockLockR Database::getLockR(Addr addr) { return lock_pool_->getLockR(addr); }
-BlockLockW Transaction::getLockW(Addr addr) { return db_.getLockW(addr); }
+
+void Database::prefetch(std::vector<PageNr> pages) {
+  store_->prefetch(std::move(pages));
+}
 BlockLockR Transaction::getLockR(Addr addr) { return db_.getLockR(addr); }
 
+void Transaction::lockW(Addr addr) {
+  if (locks_.count(addr) == 0)
+    locks_.emplace(addr, db_.lock_pool_->getLockW(addr));
+}
+
+void Transaction::lockExclusive() {
+  for (unsigned attempt = 0;; ++attempt) {
+    auto it = locks_.begin();
+    while (it != locks_.end() && it->second.tryExclusive()) ++it;
+    if (it == locks_.end()) return;
+
+    for (auto undo = locks_.begin(); undo != it; ++undo)
+      undo->second.downgrade();
+
+    // let the readers finish
+    if (attempt < 16)
+      boost::this_thread::yield();
+    else
+      boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+  }
+}
+
 ReadRef<k_page_size> Transaction::load(PageNr p) {
   return storage_.loadPage(p);
 };
 
+size_t Transaction::nodeSize() const noexcept { return db_.nodeSize(); }
+
 Block Transaction::alloc(size_t s) { return alloc_.alloc(s); };
 
 void Transaction::free(Addr a, size_t s) { return alloc_.free(a, s); }
@@ -101,13 +142,24 @@ Transaction::Transaction(Database& db)
     , kcache_(db.keycache_->startTransaction(alloc_)) {}
 
 void Transaction::commit(Writes w) {
+  // Before the key cache and the allocator commit, they can not be undone if
+  // this fails. The locks are taken before the journal, so a transaction
+  // waiting for its turn to apply never waits for readers.
+  lockExclusive();
   // kcache commit does allocation, so be sure to commit it before allocator
   auto w1 = kcache_.commit();
   auto w2 = alloc_.commit();
   w.reserve(w.size() + w1.size() + w2.size());
   std::move(w1.begin(), w1.end(), std::back_inserter(w));
   std::move(w2.begin(), w2.end(), std::back_inserter(w));
-  storage_.storeWrite(std::move(w));
+  Storage::CommitHooks hooks;
+  // the allocator stays locked until the writes are in the journal
+  hooks.enqueued = [this] { alloc_.end(); };
+  storage_.storeWrite(std::move(w), hooks);
+
+  // all changes are visible, no need to keep anything locked
+  kcache_.end();
+  locks_.clear();
 }
 
 } // namespace cheesebase
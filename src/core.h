@@ -7,8 +7,10 @@
 #include "allocator.h"
 #include "block_locks.h"
 #include "keycache.h"
+#include "options.h"
 #include "storage.h"
 
+#include <map>
 #include <memory>
 #include <string>
 
@@ -32,26 +34,42 @@ public:
   Block alloc(size_t s);
   void free(Addr a, size_t s);
   Key key(const std::string& s);
-  BlockLockW getLockW(Addr);
+
+  // Lock a block for writing until the transaction ends. Readers of the block
+  // are not blocked before the transaction commits. There are no snapshots:
+  // the commit waits until no reader holds the block, and from then on until
+  // the changes are applied readers wait. A long-lived ObjectR or ArrayR
+  // therefore delays the commits changing its value.
+  void lockW(Addr);
   BlockLockR getLockR(Addr);
   Database& db() const noexcept { return db_; }
 
+  // Node size of B-trees created in this transaction.
+  size_t nodeSize() const noexcept;
+
   void commit(Writes w);
 
 private:
   Transaction(Database& db);
 
+  // Make all write locks exclusive. All or nothing, to not deadlock with a
+  // reader waiting for one of them while holding another. Waits as long as
+  // readers hold one of the blocks, a thread holding a reader of them itself
+  // must not commit.
+  void lockExclusive();
+
   Database& db_;
   Storage& storage_;
   AllocTransaction alloc_;
   KeyTransaction kcache_;
+  std::map<Addr, BlockLockW> locks_;
 };
 
 class Database {
   friend class Transaction;
 
 public:
-  Database(const std::string& name);
+  Database(const std::string& name, const Options& options = {});
   Transaction startTransaction();
   std::string resolveKey(Key k) const;
   boost::optional<Key> getKey(const std::string& k) const;
@@ -62,12 +80,18 @@ public:
     return store_->loadBlock<S>(addr);
   }
 
-  BlockLockW getLockW(Addr);
   BlockLockR getLockR(Addr);
 
+  // Hint that the pages are loaded soon, see Storage::prefetch.
+  void prefetch(std::vector<PageNr> pages);
+
+  // Node size of newly created B-trees.
+  size_t nodeSize() const noexcept { return node_size_; }
+
 private:
   // for test cases
   Database() = default;
+  size_t node_size_{ k_default_node_size };
   std::unique_ptr<Storage> store_;
   std::unique_ptr<Allocator> alloc_;
   std::unique_ptr<KeyCache> keycache_;
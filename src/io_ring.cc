@@ -0,0 +1,217 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "io_ring.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define CB_HAVE_IO_URING
+#endif
+
+namespace cheesebase {
+
+namespace {
+
+// Largest power of two up to k_page_size that buffer, offset and size of a
+// request are aligned to. Retries of O_DIRECT transfers have to keep it.
+size_t alignment(const IoRequest& r) {
+  auto bits = reinterpret_cast<uintptr_t>(r.buffer) | r.offset | r.size |
+              k_page_size;
+  return bits & (~bits + 1);
+}
+
+} // anonymous namespace
+
+void runIoRequest(int fd, const IoRequest& request, size_t done) {
+  auto data = reinterpret_cast<char*>(request.buffer);
+  auto align = alignment(request);
+  done &= ~(align - 1);
+  while (done < request.size) {
+    auto offset = static_cast<off_t>(request.offset + done);
+    auto ret = request.op == IoRequest::Op::read
+                   ? ::pread(fd, data + done, request.size - done, offset)
+                   : ::pwrite(fd, data + done, request.size - done, offset);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      throw FileError(request.op == IoRequest::Op::read ? "failed reading file"
+                                                        : "failed writing file");
+    }
+    auto step = static_cast<size_t>(ret);
+    if (step == 0 && request.op == IoRequest::Op::read) {
+      // end of file
+      std::memset(data + done, 0, request.size - done);
+      return;
+    }
+    if (done + step < request.size) {
+      // continue at the last complete block
+      auto aligned = step & ~(align - 1);
+      if (aligned == 0 && request.op == IoRequest::Op::read) {
+        // end of file inside the block
+        std::memset(data + done + step, 0, request.size - done - step);
+        return;
+      }
+      step = aligned;
+    }
+    done += step;
+  }
+}
+
+IoRing::IoRing(unsigned entries) {
+#ifdef CB_HAVE_IO_URING
+  io_uring_params p;
+  std::memset(&p, 0, sizeof(p));
+  auto fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+  if (fd < 0) return; // not supported, requests run synchronously
+
+  sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  auto single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+  sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+
+  auto map = [fd](size_t size, off_t offset) {
+    auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+  };
+  sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+  cq_ptr_ = single ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+  sqes_ = map(sqes_size_, IORING_OFF_SQES);
+
+  ring_fd_ = fd;
+  if (sq_ptr_ == nullptr || cq_ptr_ == nullptr || sqes_ == nullptr) {
+    close();
+    return;
+  }
+
+  auto sq = static_cast<char*>(sq_ptr_);
+  auto cq = static_cast<char*>(cq_ptr_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = cq + p.cq_off.cqes;
+  entries_ = p.sq_entries;
+#else
+  (void)entries;
+#endif
+}
+
+IoRing::~IoRing() { close(); }
+
+void IoRing::close() {
+  if (ring_fd_ < 0) return;
+  if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+  if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+  if (sq_ptr_ != nullptr) ::munmap(sq_ptr_, sq_size_);
+  ::close(ring_fd_);
+  ring_fd_ = -1;
+  sq_ptr_ = cq_ptr_ = sqes_ = nullptr;
+}
+
+void IoRing::run(int fd, const std::vector<IoRequest>& requests) {
+  if (!supported()) return runSync(fd, requests);
+
+  Guard<Mutex> guard{ mtx_ };
+  for (size_t i = 0; i < requests.size(); i += entries_)
+    runBatch(fd, requests, i, std::min(requests.size(), i + entries_));
+}
+
+void IoRing::runSync(int fd, const std::vector<IoRequest>& requests) {
+  for (auto& r : requests) runIoRequest(fd, r);
+}
+
+#ifdef CB_HAVE_IO_URING
+
+void IoRing::runBatch(int fd, const std::vector<IoRequest>& requests,
+                      size_t from, size_t to) {
+  auto count = static_cast<unsigned>(to - from);
+  std::vector<iovec> iovecs(count);
+  std::vector<int> results(count);
+
+  auto sqes = static_cast<io_uring_sqe*>(sqes_);
+  auto tail = *sq_tail_;
+  for (unsigned i = 0; i < count; ++i) {
+    auto& r = requests[from + i];
+    iovecs[i].iov_base = r.buffer;
+    iovecs[i].iov_len = r.size;
+
+    auto idx = tail & *sq_mask_;
+    auto& sqe = sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = r.op == IoRequest::Op::read ? IORING_OP_READV
+                                             : IORING_OP_WRITEV;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(&iovecs[i]);
+    sqe.len = 1;
+    sqe.off = r.offset;
+    sqe.user_data = i;
+    sq_array_[idx] = idx;
+    ++tail;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  // submit everything, then reap until all submitted requests are completed
+  unsigned submitted = 0;
+  unsigned completed = 0;
+  bool failed = false;
+  while (completed < submitted || (!failed && submitted < count)) {
+    auto to_submit = failed ? 0 : count - submitted;
+    auto ret = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (ret >= 0) {
+      submitted += static_cast<unsigned>(ret);
+    } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // waiting again would fail the same way
+      if (to_submit == 0) throw FileError("failed waiting for I/O");
+
+      // take back what the kernel did not take, requests in flight still
+      // reference the buffers and have to be waited for
+      failed = true;
+      __atomic_store_n(sq_tail_, tail - to_submit, __ATOMIC_RELEASE);
+    }
+
+    auto head = *cq_head_;
+    auto cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; ++head) {
+      auto& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+      results[cqe.user_data] = cqe.res;
+      ++completed;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  if (failed) throw FileError("failed submitting I/O");
+
+  for (unsigned i = 0; i < count; ++i) {
+    auto& r = requests[from + i];
+    if (results[i] < 0) {
+      throw FileError(r.op == IoRequest::Op::read ? "failed reading file"
+                                                  : "failed writing file");
+    }
+
+    // finish short transfers synchronously, zero fills at the end of file
+    auto done = static_cast<size_t>(results[i]);
+    if (done < r.size) runIoRequest(fd, r, done);
+  }
+}
+
+#else
+
+void IoRing::runBatch(int fd, const std::vector<IoRequest>& requests,
+                      size_t from, size_t to) {
+  for (size_t i = from; i < to; ++i) runIoRequest(fd, requests[i]);
+}
+
+#endif
+
+} // namespace cheesebase
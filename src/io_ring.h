@@ -0,0 +1,79 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Batched file I/O through io_uring. A batch of reads and writes is submitted
+// with a single system call and completes in any order. Without io_uring
+// support in the kernel the requests are executed one after the other.
+
+#pragma once
+
+#include "common.h"
+#include "sync.h"
+
+#include <vector>
+
+namespace cheesebase {
+
+struct IoRequest {
+  enum class Op { read, write };
+
+  Op op;
+  Byte* buffer;
+  size_t size;
+  uint64_t offset;
+};
+
+class IoRing {
+public:
+  // Set up a ring with room for entries requests in flight.
+  explicit IoRing(unsigned entries);
+  ~IoRing();
+
+  IoRing(const IoRing&) = delete;
+  IoRing& operator=(const IoRing&) = delete;
+
+  // Execute all requests on fd and wait for them to complete. Reads past the
+  // end of the file fill the rest of the buffer with zeros. Throws FileError
+  // if a request fails. Runs of one thread at a time share the ring.
+  void run(int fd, const std::vector<IoRequest>& requests);
+
+  // Whether the kernel supports io_uring, otherwise requests are executed
+  // synchronously.
+  bool supported() const noexcept { return ring_fd_ >= 0; }
+
+private:
+  // unmap and close the ring, requests run synchronously afterwards
+  void close();
+
+  void runSync(int fd, const std::vector<IoRequest>& requests);
+
+  // submit requests [from, to) and wait for them
+  void runBatch(int fd, const std::vector<IoRequest>& requests, size_t from,
+                size_t to);
+
+  Mutex mtx_;
+  int ring_fd_{ -1 };
+  unsigned entries_{ 0 };
+
+  void* sq_ptr_{ nullptr };
+  size_t sq_size_{ 0 };
+  void* cq_ptr_{ nullptr };
+  size_t cq_size_{ 0 };
+  void* sqes_{ nullptr };
+  size_t sqes_size_{ 0 };
+
+  // pointers into the mapped rings
+  unsigned* sq_tail_{ nullptr };
+  unsigned* sq_mask_{ nullptr };
+  unsigned* sq_array_{ nullptr };
+  unsigned* cq_head_{ nullptr };
+  unsigned* cq_tail_{ nullptr };
+  unsigned* cq_mask_{ nullptr };
+  void* cqes_{ nullptr };
+};
+
+// Synchronous read or write of one request, retrying short transfers. The
+// first done bytes are skipped. A retry continues at the last block the
+// request is aligned to, so O_DIRECT transfers stay aligned.
+void runIoRequest(int fd, const IoRequest& request, size_t done = 0);
+
+} // namespace cheesebase
@@ -0,0 +1,187 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "journal.h"
+#include "murmurhash3.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cheesebase {
+
+namespace {
+
+constexpr size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+
+template <typename T>
+void appendBytes(std::vector<Byte>& buffer, const T& t) {
+  auto bytes = gsl::as_bytes(gsl::span<const T>(&t, 1));
+  buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+}
+
+void appendWrite(std::vector<Byte>& buffer, const Write& w) {
+  gsl::span<const Byte> data;
+  if (w.data.type() == typeid(uint64_t)) {
+    data = gsl::as_bytes(gsl::span<const uint64_t>(&boost::get<uint64_t>(w.data), 1));
+  } else {
+    data = boost::get<gsl::span<const Byte>>(w.data);
+  }
+
+  auto size = static_cast<size_t>(data.size());
+  appendBytes(buffer, DskJournalWrite{ w.addr.value, size });
+  buffer.insert(buffer.end(), data.begin(), data.end());
+  buffer.resize(buffer.size() + padded(size) - size, Byte(0));
+}
+
+} // anonymous namespace
+
+Journal::Journal(const std::string& filename) {
+  fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) throw FileError("could not open journal");
+
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    ::close(fd_);
+    throw FileError("could not stat journal");
+  }
+  size_ = static_cast<uint64_t>(st.st_size);
+}
+
+Journal::~Journal() { ::close(fd_); }
+
+uint64_t Journal::size() const {
+  Guard<Mutex> guard{ mtx_ };
+  return size_;
+}
+
+void Journal::writeAndSync(const std::vector<Byte>& buffer, uint64_t offset) {
+  auto data = reinterpret_cast<const char*>(buffer.data());
+  size_t written = 0;
+  while (written < buffer.size()) {
+    auto ret = ::pwrite(fd_, data + written, buffer.size() - written,
+                        static_cast<off_t>(offset + written));
+    if (ret < 0) throw FileError("failed writing journal");
+    written += static_cast<size_t>(ret);
+  }
+  if (::fdatasync(fd_) != 0) throw FileError("failed syncing journal");
+}
+
+uint64_t Journal::append(const Writes& writes) {
+  auto seq = enqueue(writes);
+  waitDurable(seq);
+  return seq;
+}
+
+uint64_t Journal::enqueue(const Writes& writes) {
+  // serialize outside of the lock, only the copy into the batch is guarded
+  std::vector<Byte> record(sizeof(DskJournalHdr));
+  for (auto& w : writes) appendWrite(record, w);
+
+  auto payload = gsl::span<const Byte>(record).subspan(ssizeof<DskJournalHdr>());
+  auto& hdr = bytesAsType<DskJournalHdr>(gsl::span<Byte>(record));
+  hdr.magic = k_journal_magic;
+  hdr.size = static_cast<uint64_t>(payload.size());
+  hdr.count = gsl::narrow<uint32_t>(writes.size());
+  hdr.checksum = hashBytes(payload.data(), static_cast<size_t>(payload.size()));
+
+  Guard<Mutex> guard{ mtx_ };
+  if (failed_) throw FileError("journal is not writable");
+  buffer_.insert(buffer_.end(), record.begin(), record.end());
+  return ++last_seq_;
+}
+
+void Journal::waitDurable(uint64_t seq) {
+  ExLock<Mutex> lck{ mtx_ };
+  Expects(seq <= last_seq_);
+
+  while (durable_seq_ < seq) {
+    if (failed_) throw FileError("journal is not writable");
+
+    if (syncing_) {
+      // somebody else is writing, our record is part of the next batch
+      cond_.wait(lck);
+      continue;
+    }
+
+    // become leader and write everything collected so far
+    syncing_ = true;
+    std::vector<Byte> batch;
+    batch.swap(buffer_);
+    auto batch_seq = last_seq_;
+    auto offset = size_;
+    lck.unlock();
+
+    bool success = true;
+    try {
+      writeAndSync(batch, offset);
+    } catch (const FileError&) {
+      success = false;
+    }
+
+    lck.lock();
+    syncing_ = false;
+    if (success) {
+      size_ += batch.size();
+      durable_seq_ = batch_seq;
+    } else {
+      failed_ = true;
+    }
+    cond_.notify_all();
+  }
+}
+
+void Journal::replay(const std::function<void(const Writes&)>& f) {
+  Guard<Mutex> guard{ mtx_ };
+
+  std::vector<Byte> content(size_);
+  auto data = reinterpret_cast<char*>(content.data());
+  size_t read = 0;
+  while (read < content.size()) {
+    auto ret = ::pread(fd_, data + read, content.size() - read,
+                       static_cast<off_t>(read));
+    if (ret < 0) throw FileError("failed reading journal");
+    if (ret == 0) break;
+    read += static_cast<size_t>(ret);
+  }
+
+  auto rest = gsl::span<const Byte>(content.data(), read);
+  while (rest.size() >= ssizeof<DskJournalHdr>()) {
+    auto& hdr = bytesAsType<DskJournalHdr>(rest);
+    rest = rest.subspan(ssizeof<DskJournalHdr>());
+    if (hdr.magic != k_journal_magic || hdr.size > uint64_t(rest.size()))
+      break;
+
+    auto payload = rest.subspan(0, static_cast<std::ptrdiff_t>(hdr.size));
+    if (hashBytes(payload.data(), hdr.size) != hdr.checksum) break;
+    rest = rest.subspan(payload.size());
+
+    Writes writes;
+    writes.reserve(hdr.count);
+    for (uint32_t i = 0; i < hdr.count; ++i) {
+      if (payload.size() < ssizeof<DskJournalWrite>())
+        throw ConsistencyError("Invalid journal record");
+      auto& w = bytesAsType<DskJournalWrite>(payload);
+      payload = payload.subspan(ssizeof<DskJournalWrite>());
+      if (padded(w.size) > uint64_t(payload.size()))
+        throw ConsistencyError("Invalid journal record");
+
+      writes.push_back(
+          { Addr(w.addr),
+            payload.subspan(0, static_cast<std::ptrdiff_t>(w.size)) });
+      payload = payload.subspan(static_cast<std::ptrdiff_t>(padded(w.size)));
+    }
+
+    f(writes);
+  }
+}
+
+void Journal::reset() {
+  Guard<Mutex> guard{ mtx_ };
+  Expects(!syncing_ && buffer_.empty());
+
+  if (::ftruncate(fd_, 0) != 0 || ::fsync(fd_) != 0)
+    throw FileError("failed truncating journal");
+  size_ = 0;
+}
+
+} // namespace cheesebase
@@ -0,0 +1,83 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Write-ahead journal of the database. Every transaction is appended as one
+// checksummed record and synced to disk before it gets applied to the DB file.
+// Concurrent committers are batched into a single sync (group commit).
+
+#pragma once
+
+#include "common.h"
+#include "sync.h"
+
+#include <functional>
+#include <string>
+
+namespace cheesebase {
+
+constexpr uint64_t k_journal_magic{ 0x4c4e524a42534843 }; // CHSBJRNL
+
+// Header of one journal record, followed by size bytes of payload.
+CB_PACKED(struct DskJournalHdr {
+  uint64_t magic;
+  uint64_t size;     // size of the payload in bytes
+  uint32_t count;    // number of writes in the payload
+  uint32_t checksum; // hash of the payload
+});
+static_assert(sizeof(DskJournalHdr) == 24, "Invalid DskJournalHdr size");
+
+// Header of one write inside a record payload, followed by size bytes of data
+// padded to a multiple of 8.
+CB_PACKED(struct DskJournalWrite {
+  uint64_t addr;
+  uint64_t size;
+});
+static_assert(sizeof(DskJournalWrite) == 16, "Invalid DskJournalWrite size");
+
+class Journal {
+public:
+  // Opens the journal file, creates it if it does not exist.
+  explicit Journal(const std::string& filename);
+  ~Journal();
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  // Append a transaction and block until it is durable on disk. Returns the
+  // sequence number of the record. Records appended concurrently are written
+  // and synced together.
+  uint64_t append(const Writes& writes);
+
+  // Append a transaction without waiting for it to be written. Returns the
+  // sequence number of the record, records are written in this order.
+  uint64_t enqueue(const Writes& writes);
+
+  // Block until the record with sequence number seq is durable on disk.
+  void waitDurable(uint64_t seq);
+
+  // Call f for every complete record in the journal, in order. Stops at the
+  // first torn or corrupt record, which is the end of the valid journal.
+  void replay(const std::function<void(const Writes&)>& f);
+
+  // Discard all records. The caller guarantees that all of them are persisted
+  // in the DB file and that no append is running concurrently.
+  void reset();
+
+  // Size of the journal file in bytes.
+  uint64_t size() const;
+
+private:
+  void writeAndSync(const std::vector<Byte>& buffer, uint64_t offset);
+
+  int fd_{ -1 };
+
+  mutable Mutex mtx_;
+  Cond cond_;
+  std::vector<Byte> buffer_;
+  uint64_t size_{ 0 };
+  uint64_t last_seq_{ 0 };
+  uint64_t durable_seq_{ 0 };
+  bool syncing_{ false };
+  bool failed_{ false };
+};
+
+} // namespace cheesebase
@@ -0,0 +1,170 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "lz.h"
+#include "exceptions.h"
+
+#include <array>
+#include <cstring>
+
+namespace cheesebase {
+
+namespace {
+
+// Every sequence starts with a token: the high nibble is the number of
+// literals, the low one the length of the match minus k_min_match. A nibble
+// of 15 is continued by bytes added to it, up to the first one below 255. The
+// literals follow, then the offset of the match as 16 bit little endian. The
+// last sequence has literals only.
+
+constexpr size_t k_min_match = 4;
+constexpr size_t k_max_offset = 0xffff;
+constexpr unsigned k_hash_bits = 12;
+
+uint32_t load32(const Byte* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+size_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - k_hash_bits); }
+
+class Output {
+public:
+  Output(gsl::span<Byte> dst)
+      : pos_{ dst.data() }, end_{ dst.data() + dst.size() } {}
+
+  // Append a sequence, offset 0 for the last one without a match. Returns
+  // false if it does not fit.
+  bool sequence(const Byte* literals, size_t count, size_t offset,
+                size_t match) {
+    auto lit_nibble = std::min<size_t>(count, 15);
+    auto match_nibble =
+        offset == 0 ? 0 : std::min<size_t>(match - k_min_match, 15);
+    if (!put(static_cast<Byte>(lit_nibble << 4 | match_nibble))) return false;
+    if (lit_nibble == 15 && !length(count - 15)) return false;
+
+    if (static_cast<size_t>(end_ - pos_) < count) return false;
+    std::memcpy(pos_, literals, count);
+    pos_ += count;
+    if (offset == 0) return true;
+
+    if (!put(static_cast<Byte>(offset)) || !put(static_cast<Byte>(offset >> 8)))
+      return false;
+    return match_nibble < 15 || length(match - k_min_match - 15);
+  }
+
+  size_t written(gsl::span<Byte> dst) const {
+    return static_cast<size_t>(pos_ - dst.data());
+  }
+
+private:
+  bool put(Byte b) {
+    if (pos_ == end_) return false;
+    *pos_++ = b;
+    return true;
+  }
+
+  bool length(size_t rest) {
+    for (; rest >= 255; rest -= 255)
+      if (!put(Byte(255))) return false;
+    return put(static_cast<Byte>(rest));
+  }
+
+  Byte* pos_;
+  Byte* end_;
+};
+
+size_t readLength(const Byte*& pos, const Byte* end) {
+  size_t length = 0;
+  Byte b;
+  do {
+    if (pos == end) throw ConsistencyError("Invalid compressed data");
+    b = *pos++;
+    length += static_cast<size_t>(b);
+  } while (b == Byte(255));
+  return length;
+}
+
+} // anonymous namespace
+
+size_t lzCompress(gsl::span<const Byte> src, gsl::span<Byte> dst) {
+  auto in = src.data();
+  auto size = static_cast<size_t>(src.size());
+  Output out{ dst };
+
+  // positions of the last occurrence of the hashed four bytes
+  std::array<uint32_t, size_t(1) << k_hash_bits> table;
+  table.fill(0);
+
+  size_t anchor = 0; // start of the pending literals
+  size_t i = 0;
+  while (size >= k_min_match && i <= size - k_min_match) {
+    auto v = load32(in + i);
+    auto& slot = table[hash(v)];
+    size_t candidate = slot;
+    slot = static_cast<uint32_t>(i);
+
+    if (candidate >= i || i - candidate > k_max_offset ||
+        load32(in + candidate) != v) {
+      // skip faster the longer nothing matched, incompressible data passes
+      // quickly
+      i += 1 + ((i - anchor) >> 5);
+      continue;
+    }
+
+    auto match = k_min_match;
+    while (i + match < size && in[candidate + match] == in[i + match]) ++match;
+
+    if (!out.sequence(in + anchor, i - anchor, i - candidate, match)) return 0;
+    i += match;
+    anchor = i;
+  }
+
+  if (!out.sequence(in + anchor, size - anchor, 0, 0)) return 0;
+  return out.written(dst);
+}
+
+void lzDecompress(gsl::span<const Byte> src, gsl::span<Byte> dst) {
+  auto in = src.data();
+  auto in_end = in + src.size();
+  auto out = dst.data();
+  auto out_end = out + dst.size();
+
+  for (;;) {
+    if (in == in_end) throw ConsistencyError("Invalid compressed data");
+    auto token = static_cast<size_t>(*in++);
+
+    auto literals = token >> 4;
+    if (literals == 15) literals += readLength(in, in_end);
+    if (literals > static_cast<size_t>(in_end - in) ||
+        literals > static_cast<size_t>(out_end - out))
+      throw ConsistencyError("Invalid compressed data");
+    std::memcpy(out, in, literals);
+    in += literals;
+    out += literals;
+    if (in == in_end) break;
+
+    if (in_end - in < 2) throw ConsistencyError("Invalid compressed data");
+    auto offset = static_cast<size_t>(in[0]) | static_cast<size_t>(in[1]) << 8;
+    in += 2;
+    auto match = token & 15;
+    if (match == 15) match += readLength(in, in_end);
+    match += k_min_match;
+    if (offset == 0 || offset > static_cast<size_t>(out - dst.data()) ||
+        match > static_cast<size_t>(out_end - out))
+      throw ConsistencyError("Invalid compressed data");
+
+    auto from = out - offset;
+    if (offset >= match) {
+      std::memcpy(out, from, match);
+      out += match;
+    } else {
+      // overlapping, repeats the last offset bytes
+      for (size_t i = 0; i < match; ++i) *out++ = *from++;
+    }
+  }
+
+  if (out != out_end) throw ConsistencyError("Invalid compressed data");
+}
+
+} // namespace cheesebase
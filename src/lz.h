@@ -0,0 +1,22 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Block compression of the LZ77 family, in the spirit of LZ4. The output is a
+// sequence of literal runs, each followed by a back reference to an earlier
+// occurrence of at least four bytes. Meant for small blocks such as pages,
+// speed is favored over ratio.
+
+#pragma once
+
+#include "common.h"
+
+namespace cheesebase {
+
+// Compress src into dst. Returns the compressed size, or 0 if the result
+// does not fit into dst.
+size_t lzCompress(gsl::span<const Byte> src, gsl::span<Byte> dst);
+
+// Decompress src, which has to expand to exactly dst.size() bytes. Throws
+// ConsistencyError if src is corrupted.
+void lzDecompress(gsl::span<const Byte> src, gsl::span<Byte> dst);
+
+} // namespace cheesebase
@@ -0,0 +1,56 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "memory_engine.h"
+#include "exceptions.h"
+
+#include <sys/mman.h>
+
+namespace cheesebase {
+
+MemoryEngine::MemoryEngine()
+    : chunks_{ std::make_unique<std::atomic<Byte*>[]>(k_memory_max_chunks) } {
+  for (size_t i = 0; i < k_memory_max_chunks; ++i) chunks_[i] = nullptr;
+}
+
+MemoryEngine::~MemoryEngine() {
+  for (size_t i = 0; i < k_memory_max_chunks; ++i) {
+    auto chunk = chunks_[i].load();
+    if (chunk != nullptr) ::munmap(chunk, k_map_chunk_size);
+  }
+}
+
+Byte* MemoryEngine::getPage(PageNr page_nr) {
+  auto chunk_nr = page_nr.addr() >> k_map_chunk_power;
+  if (chunk_nr >= k_memory_max_chunks)
+    throw DatabaseError("In-memory database is full");
+
+  auto chunk = chunks_[chunk_nr].load(std::memory_order_acquire);
+  if (chunk == nullptr) {
+    Guard<Mutex> guard{ grow_mtx_ };
+    chunk = chunks_[chunk_nr].load(std::memory_order_relaxed);
+    if (chunk == nullptr) {
+      auto mem = ::mmap(nullptr, k_map_chunk_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (mem == MAP_FAILED) throw std::bad_alloc();
+      chunk = static_cast<Byte*>(mem);
+      chunks_[chunk_nr].store(chunk, std::memory_order_release);
+    }
+  }
+  return chunk + (page_nr.addr() & (k_map_chunk_size - 1));
+}
+
+ShLock<RwMutex> MemoryEngine::lockPage(PageNr page_nr) {
+  return ShLock<RwMutex>{
+    locks_[PageNr::Hash{}(page_nr) % k_memory_lock_stripes]
+  };
+}
+
+PageRef<PageReadView> MemoryEngine::readPage(PageNr page_nr) {
+  return { PageReadView(getPage(page_nr), k_page_size), lockPage(page_nr) };
+}
+
+PageRef<PageWriteView> MemoryEngine::writePage(PageNr page_nr) {
+  return { PageWriteView(getPage(page_nr), k_page_size), lockPage(page_nr) };
+}
+
+} // namespace cheesebase
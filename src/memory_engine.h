@@ -0,0 +1,51 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Storage engine keeping all pages in anonymous memory, for databases that
+// are thrown away when closed.
+
+#pragma once
+
+#include "common.h"
+#include "storage_engine.h"
+#include "sync.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace cheesebase {
+
+// Pages live in chunks of k_map_chunk_size anonymous memory. Chunks are
+// reserved on first access and never move; the kernel only backs pages when
+// they are touched, untouched pages read as zeros.
+class MemoryEngine : public StorageEngine {
+public:
+  MemoryEngine();
+  ~MemoryEngine() override;
+
+  MemoryEngine(const MemoryEngine&) = delete;
+  MemoryEngine& operator=(const MemoryEngine&) = delete;
+
+  PageRef<PageReadView> readPage(PageNr page_nr) override;
+  PageRef<PageWriteView> writePage(PageNr page_nr) override;
+
+  // Nothing to write.
+  void flush() override {}
+
+  // All pages are in memory already.
+  void prefetch(std::vector<PageNr>) override {}
+
+  bool persistent() const noexcept override { return false; }
+
+private:
+  Byte* getPage(PageNr page_nr);
+
+  // Pages are never evicted, the locks only exist to hand out PageRefs.
+  ShLock<RwMutex> lockPage(PageNr page_nr);
+
+  Mutex grow_mtx_;
+  std::unique_ptr<std::atomic<Byte*>[]> chunks_;
+  std::array<RwMutex, k_memory_lock_stripes> locks_;
+};
+
+} // namespace cheesebase
@@ -0,0 +1,327 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "json_read.h"
+#include "../exceptions.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+
+namespace cheesebase {
+namespace model {
+
+namespace {
+
+// Objects and arrays nested deeper are rejected instead of overflowing the
+// stack.
+const size_t k_max_depth{ 1024 };
+
+// Powers of ten that are exact as double.
+const double k_pow10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                           1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                           1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// First quote or backslash in [pos, end), or end. Tests eight bytes at once,
+// the bytes of a string in between need no further look.
+const char* findStringEnd(const char* pos, const char* end) {
+  const uint64_t ones = 0x0101010101010101;
+  const uint64_t highs = 0x8080808080808080;
+  for (; end - pos >= 8; pos += 8) {
+    uint64_t word;
+    std::memcpy(&word, pos, sizeof(word));
+    auto quote = word ^ (ones * '"');
+    auto backslash = word ^ (ones * '\\');
+    // high bit set in bytes that were zero after the xor
+    if ((((quote - ones) & ~quote) | ((backslash - ones) & ~backslash)) &
+        highs)
+      break;
+  }
+  while (pos != end && *pos != '"' && *pos != '\\') ++pos;
+  return pos;
+}
+
+void appendUtf8(String& out, uint32_t cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xc0 | cp >> 6));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xe0 | cp >> 12));
+    out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  } else {
+    out.push_back(static_cast<char>(0xf0 | cp >> 18));
+    out.push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+  }
+}
+
+class Reader {
+public:
+  Reader(const char* data, size_t size)
+      : begin_{ data }, pos_{ data }, end_{ data + size } {}
+
+  Value document() {
+    skipSpace();
+    auto val = value(0);
+    skipSpace();
+    if (pos_ != end_) fail("end of input expected");
+    return val;
+  }
+
+private:
+  [[noreturn]] void fail(const char* what) const {
+    throw ParserError("Invalid JSON at offset " +
+                      std::to_string(pos_ - begin_) + ": " + what);
+  }
+
+  void skipSpace() {
+    while (pos_ != end_ && isSpace(*pos_)) ++pos_;
+  }
+
+  bool consume(char c) {
+    if (pos_ == end_ || *pos_ != c) return false;
+    ++pos_;
+    return true;
+  }
+
+  void literal(const char* word) {
+    auto size = std::strlen(word);
+    if (static_cast<size_t>(end_ - pos_) < size ||
+        std::memcmp(pos_, word, size) != 0)
+      fail("value expected");
+    pos_ += size;
+  }
+
+  Value value(size_t depth) {
+    if (pos_ == end_) fail("value expected");
+    switch (*pos_) {
+    case '{':
+      return object(depth + 1);
+    case '[':
+      return array(depth + 1);
+    case '"': {
+      String str;
+      string(str);
+      return Value(std::move(str));
+    }
+    case 't':
+      literal("true");
+      return Value(Bool(true));
+    case 'f':
+      literal("false");
+      return Value(Bool(false));
+    case 'n':
+      literal("null");
+      return Value(Null());
+    case 'm':
+      literal("missing");
+      return Value(Missing());
+    default:
+      return Value(number());
+    }
+  }
+
+  Value object(size_t depth) {
+    if (depth > k_max_depth) fail("nested too deep");
+    ++pos_;
+    Tuple_base members;
+    skipSpace();
+    if (consume('}')) return Value(std::move(members));
+
+    String key;
+    for (;;) {
+      if (pos_ == end_ || *pos_ != '"') fail("member name expected");
+      key.clear();
+      string(key);
+      skipSpace();
+      if (!consume(':')) fail("':' expected");
+      skipSpace();
+      // members are often in order already, the hint makes that cheap; the
+      // first of duplicate members is kept
+      members.emplace_hint(members.end(), std::move(key), value(depth));
+      skipSpace();
+      if (consume('}')) return Value(std::move(members));
+      if (!consume(',')) fail("',' or '}' expected");
+      skipSpace();
+    }
+  }
+
+  Value array(size_t depth) {
+    if (depth > k_max_depth) fail("nested too deep");
+    ++pos_;
+    skipSpace();
+    if (consume(']')) return Value(Collection_base());
+
+    // Elements are collected in a buffer kept per depth, the array itself is
+    // allocated once in its final size.
+    if (buffers_.size() < depth) buffers_.resize(depth);
+    auto& buffer = buffers_[depth - 1];
+    for (;;) {
+      buffer.push_back(value(depth));
+      skipSpace();
+      if (consume(']')) break;
+      if (!consume(',')) fail("',' or ']' expected");
+      skipSpace();
+    }
+    Collection_base elements(std::make_move_iterator(buffer.begin()),
+                             std::make_move_iterator(buffer.end()));
+    buffer.clear();
+    return Value(std::move(elements));
+  }
+
+  // Append the string starting at the opening quote to out, escapes decoded.
+  void string(String& out) {
+    ++pos_;
+    for (;;) {
+      auto stop = findStringEnd(pos_, end_);
+      out.append(pos_, stop);
+      pos_ = stop;
+      if (pos_ == end_) fail("unterminated string");
+      if (*pos_++ == '"') return;
+      escape(out);
+    }
+  }
+
+  void escape(String& out) {
+    if (pos_ == end_) fail("unterminated string");
+    switch (*pos_++) {
+    case '"':
+      out.push_back('"');
+      break;
+    case '\\':
+      out.push_back('\\');
+      break;
+    case '/':
+      out.push_back('/');
+      break;
+    case 'b':
+      out.push_back('\b');
+      break;
+    case 'f':
+      out.push_back('\f');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    case 'u': {
+      auto cp = hex4();
+      if (cp >= 0xdc00 && cp < 0xe000) fail("unpaired surrogate");
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        if (!consume('\\') || !consume('u')) fail("unpaired surrogate");
+        auto low = hex4();
+        if (low < 0xdc00 || low >= 0xe000) fail("unpaired surrogate");
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+      }
+      appendUtf8(out, cp);
+      break;
+    }
+    default:
+      --pos_;
+      fail("invalid escape");
+    }
+  }
+
+  uint32_t hex4() {
+    if (end_ - pos_ < 4) fail("four hex digits expected");
+    uint32_t cp = 0;
+    for (int i = 0; i < 4; ++i, ++pos_) {
+      auto c = *pos_;
+      uint32_t digit;
+      if (c >= '0' && c <= '9')
+        digit = static_cast<uint32_t>(c - '0');
+      else if (c >= 'a' && c <= 'f')
+        digit = static_cast<uint32_t>(c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F')
+        digit = static_cast<uint32_t>(c - 'A' + 10);
+      else
+        fail("four hex digits expected");
+      cp = cp << 4 | digit;
+    }
+    return cp;
+  }
+
+  void digits() {
+    if (pos_ == end_ || !isDigit(*pos_)) fail("digit expected");
+    while (pos_ != end_ && isDigit(*pos_)) ++pos_;
+  }
+
+  Number number() {
+    const auto start = pos_;
+    const bool negative = consume('-');
+    if (pos_ == end_ || !isDigit(*pos_)) fail("value expected");
+    const auto int_begin = pos_;
+    if (!consume('0')) digits();
+    const auto int_end = pos_;
+
+    auto frac_begin = pos_;
+    if (consume('.')) {
+      frac_begin = pos_;
+      digits();
+    }
+    const auto frac_end = pos_;
+
+    int exponent = 0;
+    if (consume('e') || consume('E')) {
+      bool negative_exp = false;
+      if (!consume('+')) negative_exp = consume('-');
+      if (pos_ == end_ || !isDigit(*pos_)) fail("digit expected");
+      for (; pos_ != end_ && isDigit(*pos_); ++pos_) {
+        if (exponent < 100000) exponent = exponent * 10 + (*pos_ - '0');
+      }
+      if (negative_exp) exponent = -exponent;
+    }
+
+    // Most numbers have few digits and a small exponent. The mantissa and the
+    // power of ten are exact then and one operation rounds correctly.
+    const auto int_digits = int_end - int_begin;
+    const auto frac_digits = frac_end - frac_begin;
+    if (int_digits + frac_digits <= 19) {
+      uint64_t mantissa = 0;
+      for (auto p = int_begin; p != int_end; ++p)
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+      for (auto p = frac_begin; p != frac_end; ++p)
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+      auto exp10 = exponent - frac_digits;
+      if (mantissa <= (static_cast<uint64_t>(1) << 53) && exp10 >= -22 &&
+          exp10 <= 22) {
+        auto d = static_cast<double>(mantissa);
+        d = exp10 < 0 ? d / k_pow10[-exp10] : d * k_pow10[exp10];
+        return negative ? -d : d;
+      }
+    }
+
+    // the C library rounds the rest correctly
+    return std::strtod(std::string(start, pos_).c_str(), nullptr);
+  }
+
+  const char* begin_;
+  const char* pos_;
+  const char* end_;
+  // a deque, references stay valid while nested arrays add buffers
+  std::deque<Collection_base> buffers_;
+};
+
+} // anonymous namespace
+
+Value readJson(const char* data, size_t size) {
+  return Reader(data, size).document();
+}
+
+} // namespace model
+} // namespace cheesebase
@@ -0,0 +1,20 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Reader of JSON text, the counterpart of JsonPrinter. Hand written instead of
+// using the grammar in parser.h, values are built in place while the text is
+// scanned once.
+
+#pragma once
+
+#include "model.h"
+
+namespace cheesebase {
+namespace model {
+
+// Parse one value, optionally surrounded by whitespace. Besides JSON the
+// literal missing is accepted. Throws ParserError with the offset of the
+// first invalid character.
+Value readJson(const char* data, size_t size);
+
+} // namespace model
+} // namespace cheesebase
@@ -29,6 +29,13 @@ Tuple_base& Tuple::getBase() const {
   return boost::get<Tuple_base>(impl_);
 }
 
+size_t Tuple::size() const {
+  auto base = boost::get<Tuple_base>(&impl_);
+  if (base) return base->size();
+
+  return gsl::narrow_cast<size_t>(boost::get<Tuple_lazy>(impl_).ref_->size());
+}
+
 Value& Tuple::operator[](const String& k) {
   auto base = boost::get<Tuple_base>(&impl_);
   if (base) return (*base)[k];
@@ -90,6 +97,14 @@ Collection_base& Collection::getBase() const {
   return boost::get<Collection_base>(impl_);
 }
 
+size_t Collection::size() const {
+  auto base = boost::get<Collection_base>(&impl_);
+  if (base) return base->size();
+
+  return gsl::narrow_cast<size_t>(
+      boost::get<Collection_lazy>(impl_).ref_->size());
+}
+
 Value& Collection::operator[](size_t k) {
   auto base = boost::get<Collection_base>(&impl_);
   if (base) return (*base)[k];
@@ -66,9 +66,10 @@ struct Tuple : boost::totally_ordered<Tuple> {
   auto end() { return getBase().end(); }
   auto begin() const { return getBase().cbegin(); }
   auto end() const { return getBase().cend(); }
-  auto size() const { return getBase().size(); }
+  // not fetching lazy tuples
+  size_t size() const;
   auto find(const String& k) const { return getBase().find(k); }
-  auto empty() const { return getBase().empty(); }
+  bool empty() const { return size() == 0; }
   auto count(const String& k) const { return getBase().count(k); }
   Value& operator[](const String& k);
   Value& at(const String& k);
@@ -125,8 +126,9 @@ struct Collection : boost::totally_ordered<Collection> {
   auto end() { return getBase().end(); }
   auto begin() const { return getBase().cbegin(); }
   auto end() const { return getBase().cend(); }
-  auto size() const { return getBase().size(); }
-  auto empty() const { return getBase().empty(); }
+  // not fetching lazy collections
+  size_t size() const;
+  bool empty() const { return size() == 0; }
   auto reserve(size_t s) const { return getBase().reserve(s); }
   Value& operator[](size_t k);
   Value& at(size_t k);
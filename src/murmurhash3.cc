@@ -128,4 +128,8 @@ uint32_t hashString(std::string str) {
   return MurmurHash3_x86_32(str.data(), str.size(), 0);
 }
 
+uint32_t hashBytes(const void* data, size_t len) {
+  return MurmurHash3_x86_32(data, len, 0);
+}
+
 } // namespace cheesebase
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -11,4 +12,6 @@ namespace cheesebase {
 
 uint32_t hashString(std::string str);
 
+uint32_t hashBytes(const void* data, size_t len);
+
 } // namespace cheesebase
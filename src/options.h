@@ -0,0 +1,52 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Settings applied when a database is opened.
+
+#pragma once
+
+#include "common.h"
+
+namespace cheesebase {
+
+enum class CachePolicy {
+  clock, // CLOCK (second chance), approximates LRU
+  two_q  // 2Q, pages seen only once can not displace the hot working set
+};
+
+enum class FileAccess {
+  mapped, // DB file mapped into memory, pages are cached by the kernel too
+  direct, // O_DIRECT reads and writes into buffers of the cache, batched
+          // through io_uring if the kernel supports it
+  compressed // pages are compressed on disk and decompressed into buffers of
+             // the cache, file I/O goes through the page cache of the kernel
+};
+
+struct Options {
+  // Maximum size of pages kept in cache, in bytes. Rounded down to whole
+  // pages, at least one page is used.
+  size_t cache_size{ k_default_cache_size };
+
+  // Replacement policy of the page cache. Use two_q if large scans are mixed
+  // with a frequently used working set.
+  CachePolicy cache_policy{ CachePolicy::clock };
+
+  // How pages of the DB file are read and written. With direct access pages
+  // are cached only once and memory use is bounded by cache_size, but the file
+  // system has to support O_DIRECT. Compressed access makes the file smaller at
+  // the cost of compressing pages on write back and decompressing them on
+  // every cache miss. A database always has to be opened with compression if
+  // it was created with it, and without it otherwise.
+  FileAccess file_access{ FileAccess::mapped };
+
+  // Keep the database in anonymous memory only. No file is created or read,
+  // nothing is written to disk and all content is lost when it is closed.
+  bool in_memory{ false };
+
+  // Size of the nodes of B-trees created from now on, a power of two from
+  // 256 bytes to 2 KB. Existing trees keep the size they were created with.
+  // Larger nodes make big objects and arrays shallower, but every object and
+  // array takes at least one node.
+  size_t node_size{ k_default_node_size };
+};
+
+} // namespace cheesebase
@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "query/parser.h"
+#include "model/json_read.h"
 #include "model/parser.h"
 #include "exceptions.h"
 
@@ -22,17 +23,7 @@ query::Expr parseQuery(const std::string& q) {
 
 
 model::Value parseValue(const std::string& q) {
-  auto iter = std::begin(q);
-  auto end = std::end(q);
-
-  model::Value val;
-  auto success =
-      x3::phrase_parse(iter, end, parser::value, x3::ascii::space, val);
-
-  if (!success) throw ParserError { "Parse unsuccessful" };
-  if (iter != end) throw ParserError { "Did not consume all input" };
-
-  return val;
+  return model::readJson(q.data(), q.size());
 }
 
 } // namespace cheesebase
@@ -1,32 +1,150 @@
 #include "array.h"
-#include "../model/model.h"
+#include "btree/read.h"
+#include "model.h"
 
 namespace cheesebase {
 namespace disk {
 
+////////////////////////////////////////////////////////////////////////////////
+// ArrayW
+
+ArrayW::ArrayW(Transaction& ta)
+    : ValueW(ta), dense_{ std::make_unique<dense::DenseWritable>(ta) } {
+  addr_ = dense_->addr();
+}
+
+ArrayW::ArrayW(Transaction& ta, Addr addr) : ValueW(ta, addr) {
+  if (dense::isDense(*ta.loadBlock<k_min_node_size>(addr))) {
+    dense_ = std::make_unique<dense::DenseWritable>(ta, addr);
+  } else {
+    tree_ = std::make_unique<btree::BtreeWritable>(ta, addr);
+  }
+}
+
+ArrayW::ArrayW(Transaction& ta, const btree::BulkEntries& entries)
+    : ValueW(ta) {
+  if (dense::DenseWritable::fits(entries)) {
+    dense_ = std::make_unique<dense::DenseWritable>(ta);
+    for (auto& e : entries) dense_->append(*e.second);
+    addr_ = dense_->addr();
+  } else {
+    tree_ = std::make_unique<btree::BtreeWritable>(ta, entries);
+    addr_ = tree_->addr();
+  }
+}
+
+Writes ArrayW::getWrites() const {
+  return dense_ ? dense_->getWrites() : tree_->getWrites();
+}
+
+void ArrayW::destroy() {
+  if (dense_) {
+    dense_->destroy();
+  } else {
+    tree_->destroy();
+  }
+}
+
+bool ArrayW::insert(Key index, const model::Value& val, Overwrite ow) {
+  if (dense_) {
+    if (valueType(val) == ValueType::missing) return true;
+    auto size = dense_->size();
+    auto exists = index.value < size;
+    if ((ow == Overwrite::Insert && exists) ||
+        (ow == Overwrite::Update && !exists)) {
+      return false;
+    }
+    if (index.value <= size && dense::DenseWritable::fits(val))
+      return dense_->insert(index.value, val, ow);
+    // a hole
+    toTree();
+  }
+  return tree_->insert(index, val, ow);
+}
+
+Key ArrayW::append(const model::Value& val) {
+  if (dense_) {
+    if (valueType(val) == ValueType::missing ||
+        dense::DenseWritable::fits(val)) {
+      return dense_->append(val);
+    }
+    toTree();
+  }
+  return tree_->append(val);
+}
+
+bool ArrayW::remove(Key key) {
+  if (dense_) {
+    // removing the last element leaves no hole
+    if (key.value + 1 >= dense_->size()) return dense_->remove(key.value);
+    toTree();
+  }
+  return tree_->remove(key);
+}
+
+void ArrayW::toTree() {
+  auto node_size = dense_->nodeSize();
+  tree_ = std::make_unique<btree::BtreeWritable>(ta_, dense_->toEntries(),
+                                                 addr_, node_size);
+  dense_.reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ArrayR
+
+ArrayR::ArrayR(Database& db, Addr addr) : ValueR(db, addr) {
+  if (dense::isDense(*db.loadBlock<k_min_node_size>(addr))) {
+    dense_ = std::make_unique<dense::DenseReadOnly>(db, addr);
+  } else {
+    tree_ = std::make_unique<btree::BtreeReadOnly>(db, addr);
+  }
+}
+
 model::Value ArrayR::getValue() { return getArray(); }
 
 model::Value ArrayR::getChildValue(uint64_t index) {
   if (index > Key::sMaxKey) throw IndexOutOfRangeError();
-  return tree_.getChildValue(Key(index));
+  if (dense_) return dense_->getChildValue(index);
+  return tree_->getChildValue(Key(index));
 }
 
 std::unique_ptr<ValueW> ArrayR::getChildCollectionW(Transaction& ta,
                                                     uint64_t index) {
   if (index > Key::sMaxKey) throw IndexOutOfRangeError();
-  return tree_.getChildCollectionW(ta, Key(index));
+  if (dense_) return dense_->getChildCollectionW(ta, index);
+  return tree_->getChildCollectionW(ta, Key(index));
 }
 
 std::unique_ptr<ValueR> ArrayR::getChildCollectionR(uint64_t index) {
   if (index > Key::sMaxKey) throw IndexOutOfRangeError();
-  return tree_.getChildCollectionR(Key(index));
+  if (dense_) return dense_->getChildCollectionR(index);
+  return tree_->getChildCollectionR(Key(index));
+}
+
+uint64_t ArrayR::size() {
+  if (dense_) return dense_->size();
+  auto last = tree_->lastKey();
+  return last ? last->value + 1 : 0;
+}
+
+std::pair<uint64_t, model::Value> ArrayR::nth(uint64_t n) {
+  if (dense_) {
+    // no holes, element n is at index n
+    if (n >= dense_->size()) throw IndexOutOfRangeError();
+    return { n, dense_->getChildValue(n) };
+  }
+  auto element = tree_->nth(n);
+  if (!element) throw IndexOutOfRangeError();
+  return { element->first.value, std::move(element->second) };
 }
 
 model::Collection ArrayR::getArray() {
+  if (dense_) return dense_->getArray();
+
   model::Collection val;
   val.has_order_ = true;
 
-  auto arr = tree_.getArray();
+  auto arr = tree_->getArray();
   auto last = arr.rbegin();
   if (last != arr.rend()) {
     val.resize(last->first + 1, model::Missing{});
@@ -39,5 +157,53 @@ model::Collection ArrayR::getArray() {
   return val;
 }
 
+ArrayCursor ArrayR::cursor() {
+  if (dense_) {
+    return ArrayCursor(std::make_unique<dense::DenseCursor>(db_, addr_));
+  }
+  return ArrayCursor(std::make_unique<btree::Cursor>(db_, addr_));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ArrayCursor
+
+ArrayCursor::ArrayCursor(std::unique_ptr<dense::DenseCursor> dense)
+    : dense_{ std::move(dense) } {}
+
+ArrayCursor::ArrayCursor(std::unique_ptr<btree::Cursor> tree)
+    : tree_{ std::move(tree) } {}
+
+ArrayCursor::ArrayCursor(ArrayCursor&&) = default;
+ArrayCursor::~ArrayCursor() = default;
+
+bool ArrayCursor::valid() const {
+  return dense_ ? dense_->valid() : tree_->valid();
+}
+
+uint64_t ArrayCursor::index() const {
+  return dense_ ? dense_->index() : tree_->key().value;
+}
+
+model::Value ArrayCursor::value() const {
+  return dense_ ? dense_->value() : tree_->value();
+}
+
+void ArrayCursor::next() {
+  if (dense_) {
+    dense_->next();
+  } else {
+    tree_->next();
+  }
+}
+
+void ArrayCursor::seek(uint64_t index) {
+  if (index > Key::sMaxKey) throw IndexOutOfRangeError();
+  if (dense_) {
+    dense_->seek(index);
+  } else {
+    tree_->seek(Key(index));
+  }
+}
+
 } // namespace disk
 } // namespace cheesebase
@@ -3,44 +3,90 @@
 
 #include "../exceptions.h"
 #include "btree/btree.h"
+#include "dense.h"
 #include "value.h"
 
 namespace cheesebase {
 namespace disk {
 
+// Arrays are stored densely while they have no holes and all elements fit a
+// slot, then they are moved to a B-tree for good.
 class ArrayW : public ValueW {
 public:
-  ArrayW(Transaction& ta) : ValueW(ta), tree_{ ta } { addr_ = tree_.addr(); }
+  ArrayW(Transaction& ta);
 
-  ArrayW(Transaction& ta, Addr addr) : ValueW(ta, addr), tree_{ ta, addr } {}
+  ArrayW(Transaction& ta, Addr addr);
 
-  Writes getWrites() const override { return tree_.getWrites(); }
+  // new array holding entries, built at once
+  ArrayW(Transaction& ta, const btree::BulkEntries& entries);
 
-  void destroy() override { return tree_.destroy(); }
+  Writes getWrites() const override;
 
-  bool insert(Key index, const model::Value& val, Overwrite ow) {
-    return tree_.insert(index, val, ow);
-  }
+  void destroy() override;
 
-  Key append(const model::Value& val) { return tree_.append(val); }
+  bool insert(Key index, const model::Value& val, Overwrite ow);
 
-  bool remove(Key key) { return tree_.remove(key); }
+  Key append(const model::Value& val);
+
+  bool remove(Key key);
+
+private:
+  // move the elements from the dense array to a B-tree at the same address
+  void toTree();
+
+  std::unique_ptr<dense::DenseWritable> dense_;
+  std::unique_ptr<btree::BtreeWritable> tree_;
+};
+
+// Forward cursor over the elements of an array in index order, holes are
+// skipped. See btree::Cursor, it is used while the ArrayR that handed it out
+// exists.
+class ArrayCursor {
+public:
+  ArrayCursor(ArrayCursor&&);
+  ~ArrayCursor();
+
+  // False after the last element.
+  bool valid() const;
+
+  uint64_t index() const;
+  model::Value value() const;
+  void next();
+
+  // Move to element index or the first one after it.
+  void seek(uint64_t index);
 
 private:
-  btree::BtreeWritable tree_;
+  friend class ArrayR;
+  explicit ArrayCursor(std::unique_ptr<dense::DenseCursor> dense);
+  explicit ArrayCursor(std::unique_ptr<btree::Cursor> tree);
+
+  std::unique_ptr<dense::DenseCursor> dense_;
+  std::unique_ptr<btree::Cursor> tree_;
 };
 
 class ArrayR : public ValueR {
 public:
-  ArrayR(Database& db, Addr addr) : ValueR(db, addr), tree_{ db, addr } {}
+  ArrayR(Database& db, Addr addr);
   model::Value getValue() override;
   model::Value getChildValue(uint64_t index);
   std::unique_ptr<ValueW> getChildCollectionW(Transaction& ta, uint64_t index);
   std::unique_ptr<ValueR> getChildCollectionR(uint64_t index);
   model::Collection getArray();
 
+  // Length including holes, the greatest index + 1.
+  uint64_t size();
+
+  // Element n not counting holes and its index. Throws IndexOutOfRangeError
+  // if there are not more than n elements.
+  std::pair<uint64_t, model::Value> nth(uint64_t n);
+
+  // Cursor at the first element, reading one leaf or segment at a time.
+  ArrayCursor cursor();
+
 private:
-  btree::BtreeReadOnly tree_;
+  std::unique_ptr<dense::DenseReadOnly> dense_;
+  std::unique_ptr<btree::BtreeReadOnly> tree_;
 };
 
 } // namespace disk
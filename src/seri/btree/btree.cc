@@ -4,13 +4,51 @@
 #include "../array.h"
 #include "../object.h"
 #include "common.h"
+#include "internal.h"
 #include "leaf.h"
 #include "read.h"
+#include <numeric>
 
 namespace cheesebase {
 namespace disk {
 namespace btree {
 
+namespace {
+
+// Node of a level of a tree built bottom-up, the lowest key and the number of
+// entries below it.
+struct BulkChild {
+  Key key;
+  uint64_t count;
+  std::unique_ptr<NodeW> node;
+};
+
+// Split items of the given sizes into consecutive nodes holding at most max.
+// Nodes are filled up to target while at least min is left for the next one,
+// the last two share the rest evenly. With target >= min + size of an item,
+// no node but a single one holds less than min. Returns the end of every
+// node.
+std::vector<size_t> partition(const std::vector<size_t>& sizes, size_t target,
+                              size_t min, size_t max) {
+  std::vector<size_t> ends;
+  auto rest = std::accumulate(sizes.begin(), sizes.end(), size_t(0));
+  size_t i = 0;
+  while (rest > max) {
+    size_t used = 0;
+    if (rest < target + min) {
+      while (used < rest / 2) used += sizes[i++];
+    } else {
+      while (used + sizes[i] <= target) used += sizes[i++];
+    }
+    ends.push_back(i);
+    rest -= used;
+  }
+  ends.push_back(sizes.size());
+  return ends;
+}
+
+} // anonymous namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 // BtreeWriteable
 
@@ -23,6 +61,129 @@ BtreeWritable::BtreeWritable(Transaction& ta) {
   root_ = std::make_unique<RootLeafW>(ta, *this);
 }
 
+BtreeWritable::BtreeWritable(Transaction& ta, const BulkEntries& all) {
+  BulkEntries entries;
+  entries.reserve(all.size());
+  std::vector<size_t> sizes;
+  sizes.reserve(all.size());
+  for (auto& e : all) {
+    if (valueType(*e.second) == ValueType::missing) continue;
+    entries.push_back(e);
+    sizes.push_back(nrExtraWords(*e.second) + 1);
+  }
+
+  build(ta, ta.nodeSize(), sizes,
+        [&](AbsLeafW& leaf, size_t i) {
+          leaf.insert(entries[i].first, *entries[i].second, Overwrite::Insert,
+                      nullptr);
+        },
+        [&](size_t i) { return entries[i].first; });
+}
+
+BtreeWritable::BtreeWritable(Transaction& ta, RawEntries entries, Addr root,
+                             size_t node_size) {
+  std::vector<size_t> sizes;
+  sizes.reserve(entries.size());
+  for (auto& e : entries) sizes.push_back(nrExtraWords(e.type) + 1);
+
+  build(ta, node_size, sizes,
+        [&](AbsLeafW& leaf, size_t i) {
+          auto& e = entries[i];
+          auto extras = gsl::span<const uint64_t>(&e.extra, 1);
+          leaf.appendEntry(e.key, e.type,
+                           extras.first(static_cast<std::ptrdiff_t>(
+                               nrExtraWords(e.type))));
+          if (e.linked) leaf.linked_.emplace(e.key, std::move(e.linked));
+        },
+        [&](size_t i) { return entries[i].key; }, root);
+}
+
+template <class Add, class KeyOf>
+void BtreeWritable::build(Transaction& ta, size_t node_size,
+                          const std::vector<size_t>& sizes, Add add,
+                          KeyOf key, boost::optional<Addr> root_addr) {
+  auto max_words = maxLeafWords(node_size);
+  auto ends = partition(sizes, max_words * k_bulk_fill_percent / 100,
+                        minLeafWords(node_size), max_words);
+  // allocated last, after the nodes below it
+  auto rootAddr = [&] {
+    return root_addr ? *root_addr : ta.alloc(node_size).addr;
+  };
+
+  if (ends.size() == 1) {
+    auto root = std::make_unique<RootLeafW>(ta, node_size, rootAddr(), *this);
+    for (size_t i = 0; i < sizes.size(); ++i) add(*root, i);
+    root_ = std::move(root);
+    return;
+  }
+
+  // allocate the leafs before their values, so they follow each other
+  std::vector<std::unique_ptr<LeafW>> leafs;
+  for (size_t i = 0; i < ends.size(); ++i)
+    leafs.push_back(std::make_unique<LeafW>(AllocateNew(), ta, node_size));
+
+  std::vector<BulkChild> level;
+  size_t begin = 0;
+  for (size_t i = 0; i < leafs.size(); ++i) {
+    if (i + 1 < leafs.size()) leafs[i]->setNext(leafs[i + 1]->addr());
+    // fits by the partition, never splits
+    for (auto j = begin; j < ends[i]; ++j) add(*leafs[i], j);
+    level.push_back({ key(begin), ends[i] - begin, std::move(leafs[i]) });
+    begin = ends[i];
+  }
+
+  // internal levels up to a single root, sized in children
+  auto tail = level.back().node->addr();
+  auto max_children = maxInternalEntries(node_size) + 1;
+  auto min_children = minInternalEntries(node_size) + 1;
+  for (;;) {
+    ends = partition(std::vector<size_t>(level.size(), 1),
+                     max_children * k_bulk_fill_percent / 100, min_children,
+                     max_children);
+
+    std::vector<BulkChild> upper;
+    begin = 0;
+    for (auto end : ends) {
+      std::vector<DskInternalPair> pairs(end - begin - 1);
+      uint64_t count = level[begin].count;
+      for (auto j = begin + 1; j < end; ++j) {
+        pairs[j - begin - 1].entry.fromKey(level[j].key);
+        pairs[j - begin - 1].addr = level[j].node->addr();
+        pairs[j - begin - 1].count = level[j].count;
+        count += level[j].count;
+      }
+
+      auto first = level[begin].node->addr();
+      auto first_count = level[begin].count;
+      std::unique_ptr<AbsInternalW> node;
+      if (ends.size() == 1) {
+        auto root =
+            new RootInternalW(ta, node_size, rootAddr(), first, first_count,
+                              pairs.begin(), pairs.end(), *this);
+        node.reset(root);
+        root->entries_.setTail(tail);
+      } else {
+        node = std::make_unique<InternalW>(AllocateNew(), ta, node_size, true,
+                                           first, first_count, pairs.begin(),
+                                           pairs.end());
+      }
+
+      for (auto j = begin; j < end; ++j) {
+        auto addr = level[j].node->addr();
+        node->appendChild({ addr, std::move(level[j].node) });
+      }
+      upper.push_back({ level[begin].key, count, std::move(node) });
+      begin = end;
+    }
+
+    if (upper.size() == 1) {
+      root_ = std::move(upper.front().node);
+      return;
+    }
+    level = std::move(upper);
+  }
+}
+
 BtreeWritable::~BtreeWritable() {}
 
 Addr BtreeWritable::addr() const { return root_->addr(); }
@@ -35,7 +196,13 @@ Key BtreeWritable::append(const model::Value& val) {
   return root_->append(val, nullptr);
 }
 
-bool BtreeWritable::remove(Key key) { return root_->remove(key, nullptr); }
+bool BtreeWritable::remove(Key key) {
+  auto removed = root_->remove(key, nullptr);
+  // the rightmost leaf may be merged, the root may be a leaf now
+  auto root = dynamic_cast<RootInternalW*>(root_.get());
+  if (root != nullptr) root->updateTail(false);
+  return removed;
+}
 
 void BtreeWritable::destroy() { root_->destroy(); }
 
@@ -62,6 +229,16 @@ model::Value BtreeReadOnly::getChildValue(Key key) {
   return NodeR::getChildValue(db_, root_, key);
 }
 
+uint64_t BtreeReadOnly::count() { return NodeR::count(db_, root_); }
+
+boost::optional<std::pair<Key, model::Value>> BtreeReadOnly::nth(uint64_t n) {
+  return NodeR::nth(db_, root_, n);
+}
+
+boost::optional<Key> BtreeReadOnly::lastKey() {
+  return NodeR::lastKey(db_, root_);
+}
+
 std::unique_ptr<ValueW> BtreeReadOnly::getChildCollectionW(Transaction& ta,
                                                            Key key) {
   return NodeR::getChildCollectionW(ta, root_, key);
@@ -4,6 +4,9 @@
 #include "../../common.h"
 
 #include <map>
+#include <boost/optional.hpp>
+#include <memory>
+#include <vector>
 
 namespace cheesebase {
 
@@ -31,6 +34,21 @@ enum class Overwrite { Insert, Update, Upsert };
 namespace btree {
 
 class NodeW;
+class Cursor;
+
+// Entries of a new tree, sorted by key without duplicates.
+using BulkEntries = std::vector<std::pair<Key, const model::Value*>>;
+
+// Entry of a new tree in its stored form: the value type, its extra word if
+// it has one and the writer of a value stored in blocks of its own if it was
+// created in the same transaction.
+struct RawEntry {
+  Key key;
+  uint8_t type;
+  uint64_t extra;
+  std::unique_ptr<ValueW> linked;
+};
+using RawEntries = std::vector<RawEntry>;
 
 class BtreeWritable {
   friend class RootLeafW;
@@ -41,6 +59,13 @@ public:
   BtreeWritable(Transaction& ta);
   // open existing tree
   BtreeWritable(Transaction& ta, Addr root);
+  // Create new tree holding entries. Leafs are filled one after the other to
+  // k_bulk_fill_percent, then the internal levels are built bottom-up.
+  BtreeWritable(Transaction& ta, const BulkEntries& entries);
+  // Create new tree of nodes of node_size holding entries, its root takes the
+  // place of the block at root of the same size.
+  BtreeWritable(Transaction& ta, RawEntries entries, Addr root,
+                size_t node_size);
 
   ~BtreeWritable();
 
@@ -52,6 +77,14 @@ public:
   Writes getWrites() const;
 
 private:
+  // Build the tree bottom-up from entries of the given sizes in words. add
+  // stores entry i in a leaf, key gives its key. The root is written to
+  // root_addr if given, else to a new block.
+  template <class Add, class KeyOf>
+  void build(Transaction& ta, size_t node_size,
+             const std::vector<size_t>& sizes, Add add, KeyOf key,
+             boost::optional<Addr> root_addr = boost::none);
+
   std::unique_ptr<btree::NodeW> root_;
 };
 
@@ -62,6 +95,16 @@ public:
   model::Tuple getObject();
   ArrayMap getArray();
   model::Value getChildValue(Key key);
+
+  // Number of entries, read from the root of counted trees.
+  uint64_t count();
+
+  // Entry n in key order, found by the counts of the internal nodes. None if
+  // the tree is smaller.
+  boost::optional<std::pair<Key, model::Value>> nth(uint64_t n);
+
+  // Greatest key, none if the tree is empty.
+  boost::optional<Key> lastKey();
   std::unique_ptr<ValueW> getChildCollectionW(Transaction&, Key key);
   std::unique_ptr<ValueR> getChildCollectionR(Key key);
   std::unique_ptr<ValueW> getChild(Key key);
@@ -9,16 +9,24 @@ namespace cheesebase {
 namespace disk {
 namespace btree {
 
-bool isNodeLeaf(const ReadRef<kBlockSize>& block) {
+bool isNodeLeaf(gsl::span<const Byte> block) {
   // first byte of Addr is always 0
   // next-ptr of leafs put a flag in the first byte, marking the node as leaf
-  return bytesAsType<const DskLeafHdr>(*block).hasMagic();
+  return bytesAsType<const DskLeafHdr>(block).hasMagic();
+}
+
+size_t nodeSize(gsl::span<const Byte> block) {
+  if (isNodeLeaf(block)) return bytesAsType<const DskLeafHdr>(block).nodeSize();
+
+  auto& hdr = bytesAsType<const DskInternalHdr>(block);
+  hdr.check();
+  return hdr.nodeSize();
 }
 
 std::unique_ptr<NodeW> openNodeW(Transaction& ta, Addr addr) {
-  auto block = ta.loadBlock<kBlockSize>(addr);
+  auto block = loadNode(ta, addr);
 
-  if (isNodeLeaf(block))
+  if (isNodeLeaf(*block))
     return std::make_unique<LeafW>(ta, addr);
   else
     return std::make_unique<InternalW>(ta, addr);
@@ -26,9 +34,9 @@ std::unique_ptr<NodeW> openNodeW(Transaction& ta, Addr addr) {
 
 std::unique_ptr<NodeW> openRootW(Transaction& ta, Addr addr,
                                  BtreeWritable& tree) {
-  auto block = ta.loadBlock<kBlockSize>(addr);
+  auto block = loadNode(ta, addr);
 
-  if (isNodeLeaf(block))
+  if (isNodeLeaf(*block))
     return std::make_unique<RootLeafW>(ta, addr, tree);
   else
     return std::make_unique<RootInternalW>(ta, addr, tree);
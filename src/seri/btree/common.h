@@ -10,7 +10,40 @@ namespace cheesebase {
 namespace disk {
 namespace btree {
 
-constexpr std::ptrdiff_t kBlockSize = 256;
+// All nodes of a tree have the same size. It is stored in the header of every
+// node as size class: size = k_min_node_size << class.
+constexpr size_t kMaxNodeSizeClass = 3;
+static_assert((k_min_node_size << kMaxNodeSizeClass) == k_max_node_size,
+              "Invalid node size classes");
+
+inline size_t nodeSizeOfClass(size_t c) {
+  if (c > kMaxNodeSizeClass) throw ConsistencyError("Invalid node size class");
+  return k_min_node_size << c;
+}
+
+inline uint64_t classOfNodeSize(size_t size) {
+  uint64_t c = 0;
+  while ((k_min_node_size << c) < size) ++c;
+  Expects(c <= kMaxNodeSizeClass && (k_min_node_size << c) == size);
+  return c;
+}
+
+// Locked view of a node.
+using NodeRef = PageRef<gsl::span<const Byte>>;
+
+// Size of the node starting with block, read from its header.
+size_t nodeSize(gsl::span<const Byte> block);
+
+// Load the node at addr in its full size.
+template <class Db>
+NodeRef loadNode(Db& db, Addr addr) {
+  // nodes are aligned to their size, so the node is part of the same page
+  auto head = db.template loadBlock<k_min_node_size>(addr);
+  auto size = nodeSize(*head);
+  return { gsl::span<const Byte>(head->data(),
+                                 static_cast<std::ptrdiff_t>(size)),
+           std::move(head) };
+}
 
 CB_PACKED(struct DskKey {
   DskKey() = default;
@@ -57,11 +90,14 @@ public:
   // delete value, returns true if found and removed
   virtual bool remove(Key key, AbsInternalW* parent) = 0;
 
+  // number of entries below the node
+  virtual uint64_t count() = 0;
+
 protected:
   Addr addr_;
 };
 
-bool isNodeLeaf(const ReadRef<kBlockSize>& block);
+bool isNodeLeaf(gsl::span<const Byte> block);
 std::unique_ptr<NodeW> openNodeW(Transaction& ta, Addr addr);
 std::unique_ptr<NodeW> openRootW(Transaction& ta, Addr addr,
                                  BtreeWritable& parent);
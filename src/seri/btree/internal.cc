@@ -9,6 +9,11 @@
 #include "../value.h"
 #include "leaf.h"
 #include <algorithm>
+#include <numeric>
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
 
 namespace cheesebase {
 namespace disk {
@@ -23,98 +28,315 @@ Key infiniteKey() {
   return k;
 }
 
+// SIMD compares signed, flipping the top bit keeps the unsigned order.
+constexpr uint64_t kSignFlip = uint64_t(1) << 63;
+
+// Below this many keys the keys of a node are compared all at once.
+constexpr size_t kInternalScanKeys = 16;
+
+// Number of sorted keys not greater than key. Without AVX2 or SSE4.2 the
+// loop is left to the auto vectorizer.
+size_t countNotGreater(const uint64_t* keys, size_t n, uint64_t key) {
+  size_t i = 0;
+  size_t greater = 0;
+#if defined(__AVX2__)
+  auto flip = _mm256_set1_epi64x(static_cast<long long>(kSignFlip));
+  auto k = _mm256_set1_epi64x(static_cast<long long>(key ^ kSignFlip));
+  for (; i + 4 <= n; i += 4) {
+    auto v = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), flip);
+    auto mask =
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k)));
+    greater += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+  }
+#elif defined(__SSE4_2__)
+  auto flip = _mm_set1_epi64x(static_cast<long long>(kSignFlip));
+  auto k = _mm_set1_epi64x(static_cast<long long>(key ^ kSignFlip));
+  for (; i + 2 <= n; i += 2) {
+    auto v = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), flip);
+    auto mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k)));
+    greater += (mask & 1) + (mask >> 1);
+  }
+#endif
+  for (; i < n; ++i) greater += keys[i] > key ? 1 : 0;
+  return n - greater;
+}
+
+//! Return \c Addr of sibling. Prefers left sibling if possible.
+auto searchSiblingAddrHelper(const InternalNode& node, Key key) {
+  auto it = std::upper_bound(node.begin(), node.end(), key);
+
+  // search result is one to high (begin() means node.first)
+  if (it == node.begin()) return it->addr; // right sibling
+  if (it == std::next(node.begin())) return node.first;
+  return std::prev(it, 2)->addr;
+}
+
 } // anonymous namespace
 
+////////////////////////////////////////////////////////////////////////////////
+// InternalView
+
+InternalView::InternalView(gsl::span<const Byte> block)
+    : data_{ reinterpret_cast<const uint64_t*>(block.data()) } {
+  hdr().check();
+  if (static_cast<size_t>(block.size()) < nodeSize())
+    throw ConsistencyError("Internal node exceeds block");
+  size_ = hdr().size();
+  capacity_ = maxInternalEntries(nodeSize(), counted());
+}
+
+Key InternalView::key(size_t i) const {
+  Expects(i < size_);
+  if (hdr().hasPairs()) return DskInternalEntry(data_[2 + 2 * i]).key.key();
+  return Key(data_[2 + i]);
+}
+
+Addr InternalView::addr(size_t i) const {
+  Expects(i < size_);
+  if (hdr().hasPairs()) return Addr(data_[3 + 2 * i]);
+  return Addr(data_[2 + capacity_ + i]);
+}
+
+uint64_t InternalView::count(size_t i) const {
+  Expects(counted() && i <= size_);
+  return data_[2 + 2 * capacity_ + i];
+}
+
+uint64_t InternalView::total() const {
+  Expects(counted());
+  auto counts = data_ + 2 + 2 * capacity_;
+  return std::accumulate(counts, counts + size_ + 1, uint64_t(0));
+}
+
+size_t InternalView::upperBound(Key key) const {
+  if (hdr().hasPairs()) {
+    size_t lo = 0;
+    size_t hi = size_;
+    while (lo < hi) {
+      auto mid = (lo + hi) / 2;
+      if (key < this->key(mid))
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    return lo;
+  }
+
+  // branch-free binary search down to a few cache lines, then compare the
+  // remaining keys at once
+  auto keys = data_ + 2;
+  auto base = keys;
+  auto n = size_;
+  while (n > kInternalScanKeys) {
+    auto half = n / 2;
+    base = base[half - 1] <= key.value ? base + half : base;
+    n -= half;
+  }
+  return static_cast<size_t>(base - keys) +
+         countNotGreater(base, n, key.value);
+}
+
+Addr InternalView::searchAddr(Key key) const {
+  auto i = upperBound(key);
+  return i == 0 ? first() : addr(i - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// InternalNode
+
+InternalNode::InternalNode(size_t node_size, bool counted)
+    : first{ 0 }, pairs(maxInternalEntries(node_size, counted)) {
+  hdr.setNodeSize(node_size);
+  hdr.setCounted(counted);
+  hdr.fromSize(0);
+  for (auto& p : pairs) p.zero();
+}
+
+InternalNode::InternalNode(const InternalView& view)
+    : InternalNode(view.nodeSize(), view.counted()) {
+  hdr.fromSize(view.size());
+  hdr.setTail(view.hdr().tail());
+  first = view.first();
+  if (view.counted()) first_count = view.count(0);
+  for (size_t i = 0; i < view.size(); ++i) {
+    pairs[i].entry.fromKey(view.key(i));
+    pairs[i].addr = view.addr(i);
+    if (view.counted()) pairs[i].count = view.count(i + 1);
+  }
+}
+
+Addr InternalNode::searchAddr(Key key) const {
+  auto it = std::upper_bound(begin(), end(), key);
+  return (it == begin() ? first : std::prev(it)->addr);
+}
+
+void InternalNode::store(std::vector<uint64_t>& buffer) const {
+  auto capacity = pairs.size();
+  buffer.assign(nodeSize() / 8, 0);
+  buffer[0] = hdr.data;
+  buffer[1] = first.value;
+  auto size = hdr.size();
+  for (size_t i = 0; i < size; ++i) {
+    buffer[2 + i] = pairs[i].entry.key.key().value;
+    buffer[2 + capacity + i] = pairs[i].addr.value;
+  }
+  if (counted()) {
+    buffer[2 + 2 * capacity] = first_count;
+    for (size_t i = 0; i < size; ++i)
+      buffer[3 + 2 * capacity + i] = pairs[i].count;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // InternalEntriesW
 
 InternalEntriesW::InternalEntriesW(Transaction& ta, Addr addr)
     : ta_{ ta }, addr_{ addr } {}
 
-InternalEntriesW::InternalEntriesW(Transaction& ta, Addr first,
-                                   DskInternalNode::iterator begin,
-                                   DskInternalNode::iterator end)
+InternalEntriesW::InternalEntriesW(Transaction& ta, size_t node_size,
+                                   Addr addr, bool counted, Addr first,
+                                   uint64_t first_count,
+                                   InternalNode::iterator begin,
+                                   InternalNode::iterator end)
     : ta_{ ta }
-    , addr_{ ta.alloc(kBlockSize).addr }
-    , node_{ std::make_unique<DskInternalNode>() } {
+    , addr_{ addr }
+    , node_{ std::make_unique<InternalNode>(node_size, counted) } {
   auto amount = gsl::narrow_cast<size_t>(std::distance(begin, end));
-  Expects(amount <= kMaxInternalEntries);
+  Expects(amount <= node_->pairs.size());
   Expects(amount > 0);
 
   node_->hdr.fromSize(amount);
   node_->first = first;
+  node_->first_count = first_count;
   std::copy(begin, end, node_->begin());
-  for (auto it = node_->pairs.begin() + amount; it < node_->pairs.end(); ++it) {
-    it->zero();
-  }
 }
 
-InternalEntriesW::InternalEntriesW(Transaction& ta, Addr addr, Addr left,
-                                   Key sep, Addr right)
-    : ta_{ ta }, addr_{ addr }, node_{ std::make_unique<DskInternalNode>() } {
+InternalEntriesW::InternalEntriesW(Transaction& ta, size_t node_size,
+                                   Addr addr, Addr left, Key sep, Addr right)
+    : ta_{ ta }
+    , addr_{ addr }
+    , node_{ std::make_unique<InternalNode>(node_size) } {
   node_->hdr.fromSize(1);
   node_->first = left;
   node_->begin()->entry.fromKey(sep);
   node_->begin()->addr = right;
-  for (auto it = std::next(node_->pairs.begin()); it < node_->pairs.end();
-       ++it) {
-    it->zero();
+}
+
+Addr InternalEntriesW::searchChildAddr(Key key) {
+  if (!node_) {
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).searchAddr(key);
   }
+  return node_->searchAddr(key);
 }
 
-Addr DskInternalNode::searchAddr(Key key) const {
-  auto it = std::upper_bound(begin(), end(), key);
-  return (it == begin() ? first : std::prev(it)->addr);
+Addr InternalEntriesW::searchSiblingAddr(Key key) {
+  init();
+  return searchSiblingAddrHelper(*node_, key);
 }
 
-namespace {
-//! Return \c Addr of sibling. Prefers left sibling if possible.
-auto searchSiblingAddrHelper(const DskInternalNode& node, Key key) {
-  auto it = std::upper_bound(node.begin(), node.end(), key);
+void InternalEntriesW::init() {
+  if (!node_) {
+    auto ref = loadNode(ta_, addr_);
+    node_ = std::make_unique<InternalNode>(InternalView(*ref));
+  }
+}
 
-  // search result is one to high (begin() means node.first)
-  if (it == node.begin()) return it->addr; // right sibling
-  if (it == std::next(node.begin())) return node.first;
-  return std::prev(it, 2)->addr;
+size_t InternalEntriesW::size() {
+  init();
+  return node_->hdr.size();
 }
 
-} // anonymous namespace
+size_t InternalEntriesW::nodeSize() {
+  init();
+  return node_->nodeSize();
+}
 
-Addr InternalEntriesW::searchChildAddr(Key key) {
+bool InternalEntriesW::isFull() { return size() >= node_->pairs.size(); }
+
+size_t InternalEntriesW::capacity() {
+  init();
+  return node_->pairs.size();
+}
+
+size_t InternalEntriesW::minSize() {
+  init();
+  return minInternalEntries(node_->nodeSize(), node_->counted());
+}
+
+bool InternalEntriesW::counted() {
+  if (!counted_) {
+    if (node_) {
+      counted_ = node_->counted();
+    } else {
+      auto ref = loadNode(ta_, addr_);
+      counted_ = InternalView(*ref).counted();
+    }
+  }
+  return *counted_;
+}
+
+size_t InternalEntriesW::position(Key key) {
   if (!node_) {
-    auto ref = ta_.loadBlock<kBlockSize>(addr_);
-    return bytesAsType<DskInternalNode>(*ref).searchAddr(key);
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).upperBound(key);
   }
-  return node_->searchAddr(key);
+  return gsl::narrow_cast<size_t>(
+      std::upper_bound(node_->begin(), node_->end(), key) - node_->begin());
 }
 
-Addr InternalEntriesW::searchSiblingAddr(Key key) {
+size_t InternalEntriesW::position(Addr addr) {
+  init();
+  if (node_->first == addr) return 0;
+  for (auto it = node_->begin(); it != node_->end(); ++it) {
+    if (it->addr == addr)
+      return gsl::narrow_cast<size_t>(it - node_->begin()) + 1;
+  }
+  throw ConsistencyError("Child not found in internal node");
+}
+
+Addr InternalEntriesW::child(size_t i) {
   if (!node_) {
-    auto ref = ta_.loadBlock<kBlockSize>(addr_);
-    return searchSiblingAddrHelper(bytesAsType<DskInternalNode>(*ref), key);
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).child(i);
   }
-  return searchSiblingAddrHelper(*node_, key);
+  Expects(i <= node_->hdr.size());
+  return i == 0 ? node_->first : node_->pairs[i - 1].addr;
 }
 
-void InternalEntriesW::init() {
+uint64_t InternalEntriesW::count(size_t i) {
+  if (!counted()) return 0;
   if (!node_) {
-    node_ = std::make_unique<DskInternalNode>();
-    auto ref = ta_.loadBlock<kBlockSize>(addr_);
-    auto target =
-        gsl::as_writeable_bytes(gsl::span<DskInternalNode>(node_.get(), 1));
-    std::copy(ref->begin(), ref->end(), target.begin());
-    node_->hdr.check();
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).count(i);
   }
+  Expects(i <= node_->hdr.size());
+  return i == 0 ? node_->first_count : node_->pairs[i - 1].count;
 }
 
-size_t InternalEntriesW::size() {
+void InternalEntriesW::setCount(size_t i, uint64_t count) {
+  if (!counted() || this->count(i) == count) return;
   init();
-  return node_->hdr.size();
+  if (i == 0)
+    node_->first_count = count;
+  else
+    node_->pairs[i - 1].count = count;
 }
 
-bool InternalEntriesW::isFull() { return size() >= kMaxInternalEntries; }
+uint64_t InternalEntriesW::total() {
+  if (!counted()) return 0;
+  if (!node_) {
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).total();
+  }
+  uint64_t total = node_->first_count;
+  for (auto& e : *node_) total += e.count;
+  return total;
+}
 
-void InternalEntriesW::insert(Key key, Addr addr) {
+void InternalEntriesW::insert(Key key, Addr addr, uint64_t count) {
   init();
   Expects(!isFull());
   Expects(size() > 0);
@@ -125,11 +347,12 @@ void InternalEntriesW::insert(Key key, Addr addr) {
 
   it->addr = addr;
   it->entry.fromKey(key);
+  it->count = count;
 
   ++(node_->hdr);
 }
 
-DskInternalNode::iterator InternalEntriesW::search(Key key) {
+InternalNode::iterator InternalEntriesW::search(Key key) {
   init();
   Expects(size() >= 1);
   auto it = std::upper_bound(node_->begin(), node_->end(), key);
@@ -137,7 +360,7 @@ DskInternalNode::iterator InternalEntriesW::search(Key key) {
   return std::prev(it);
 }
 
-void InternalEntriesW::remove(DskInternalNode::iterator e) {
+void InternalEntriesW::remove(InternalNode::iterator e) {
   init();
   Expects(e >= node_->begin() && e < node_->end());
   std::copy(std::next(e), node_->end(), e);
@@ -152,7 +375,7 @@ Key InternalEntriesW::remove(Key key) {
   return removed_key;
 }
 
-void InternalEntriesW::removeTail(DskInternalNode::iterator from) {
+void InternalEntriesW::removeTail(InternalNode::iterator from) {
   init();
   auto end = node_->end();
   auto begin = node_->begin();
@@ -163,7 +386,7 @@ void InternalEntriesW::removeTail(DskInternalNode::iterator from) {
   node_->hdr.fromSize(std::distance(begin, from));
 }
 
-void InternalEntriesW::removeHead(DskInternalNode::iterator to) {
+void InternalEntriesW::removeHead(InternalNode::iterator to) {
   init();
   auto end = node_->end();
   auto begin = node_->begin();
@@ -172,33 +395,36 @@ void InternalEntriesW::removeHead(DskInternalNode::iterator to) {
   Expects(to > begin);
 
   node_->first = to->addr;
+  node_->first_count = to->count;
   std::copy(std::next(to), end, begin);
   for (auto it = begin + amount; it < end; ++it) it->zero();
   node_->hdr.fromSize(amount);
 }
 
-void InternalEntriesW::prepend(DskInternalNode::iterator from,
-                               DskInternalNode::iterator to, Key sep) {
+void InternalEntriesW::prepend(InternalNode::iterator from,
+                               InternalNode::iterator to, Key sep) {
   init();
   auto amount = std::distance(from, to);
   if (amount == 0) return;
-  Expects(amount + size() <= kMaxInternalEntries);
+  Expects(amount + size() <= node_->pairs.size());
   Expects(sep > std::prev(to)->entry.key.key());
 
   std::copy_backward(begin(), end(), end() + amount);
   std::copy(std::next(from), to, begin());
   (begin() + amount - 1)->addr = node_->first;
+  (begin() + amount - 1)->count = node_->first_count;
   (begin() + amount - 1)->entry.fromKey(sep);
   node_->first = from->addr;
+  node_->first_count = from->count;
   node_->hdr.fromSize(size() + amount);
 }
 
-void InternalEntriesW::append(DskInternalNode::iterator from,
-                              DskInternalNode::iterator to) {
+void InternalEntriesW::append(InternalNode::iterator from,
+                              InternalNode::iterator to) {
   init();
   auto amount = std::distance(from, to);
   if (amount == 0) return;
-  Expects(amount + size() <= kMaxInternalEntries);
+  Expects(amount + size() <= node_->pairs.size());
   Expects(from->entry.key.key() > std::prev(end())->entry.key.key());
 
   std::copy(from, to, end());
@@ -208,8 +434,10 @@ void InternalEntriesW::append(DskInternalNode::iterator from,
 void InternalEntriesW::makeRoot(Addr left, Key sep, Addr right) {
   init();
   node_->first = left;
+  node_->first_count = 0;
   node_->begin()->entry.fromKey(sep);
   node_->begin()->addr = right;
+  node_->begin()->count = 0;
   for (auto it = std::next(node_->begin()); it < node_->end(); ++it) {
     it->zero();
   }
@@ -218,7 +446,23 @@ void InternalEntriesW::makeRoot(Addr left, Key sep, Addr right) {
 
 void InternalEntriesW::takeNodeFrom(InternalEntriesW& other) {
   init();
+  auto tail = node_->hdr.tail();
   node_ = std::move(other.node_);
+  node_->hdr.setTail(tail);
+}
+
+Addr InternalEntriesW::tail() {
+  if (!node_) {
+    auto ref = loadNode(ta_, addr_);
+    return InternalView(*ref).hdr().tail();
+  }
+  return node_->hdr.tail();
+}
+
+void InternalEntriesW::setTail(Addr addr) {
+  if (tail() == addr) return;
+  init();
+  node_->hdr.setTail(addr);
 }
 
 Addr InternalEntriesW::first() {
@@ -239,47 +483,37 @@ Key InternalEntriesW::update(Key key, Key new_key) {
   return updated_key;
 }
 
-void InternalEntriesW::addWrite(Writes& writes) const noexcept {
+void InternalEntriesW::addWrite(Writes& writes) const {
   if (node_) {
-    node_->hdr.check();
+    node_->store(buffer_);
     writes.push_back(
-        { addr_, gsl::as_bytes(gsl::span<DskInternalNode>(node_.get(), 1)) });
+        { addr_, gsl::as_bytes(gsl::span<const uint64_t>(buffer_)) });
   }
 }
 
 void InternalEntriesW::destroy() {
-  if (!node_) {
-    auto ref = ta_.loadBlock<kBlockSize>(addr_);
-    auto& node = bytesAsType<DskInternalNode>(*ref);
-
-    openNodeW(ta_, node.first)->destroy();
-    for (auto& e : node) {
-      openNodeW(ta_, e.addr)->destroy();
-    }
-
-  } else {
-    openNodeW(ta_, node_->first)->destroy();
-    for (auto& e : *node_) {
-      openNodeW(ta_, e.addr)->destroy();
-    }
+  init();
+  openNodeW(ta_, node_->first)->destroy();
+  for (auto& e : *node_) {
+    openNodeW(ta_, e.addr)->destroy();
   }
 
-  ta_.free(addr_, kBlockSize);
+  ta_.free(addr_, node_->nodeSize());
 }
 
-DskInternalNode::iterator InternalEntriesW::begin() {
+InternalNode::iterator InternalEntriesW::begin() {
   init();
   return node_->begin();
 }
 
-DskInternalNode::iterator InternalEntriesW::mid() {
+InternalNode::iterator InternalEntriesW::mid() {
   init();
   auto size = node_->hdr.size();
   Expects(size >= 3);
   return node_->begin() + size / 2;
 }
 
-DskInternalNode::iterator InternalEntriesW::end() {
+InternalNode::iterator InternalEntriesW::end() {
   init();
   return node_->end();
 }
@@ -290,16 +524,24 @@ DskInternalNode::iterator InternalEntriesW::end() {
 AbsInternalW::AbsInternalW(Transaction& ta, Addr addr)
     : NodeW(addr), entries_{ ta, addr } {}
 
-AbsInternalW::AbsInternalW(AllocateNew, Transaction& ta, Addr first,
-                           DskInternalNode::iterator begin,
-                           DskInternalNode::iterator end)
-    : NodeW(Addr(0)), entries_{ ta, first, begin, end } {
-  addr_ = entries_.addr_;
+AbsInternalW::AbsInternalW(AllocateNew, Transaction& ta, size_t node_size,
+                           bool counted, Addr first, uint64_t first_count,
+                           InternalNode::iterator begin,
+                           InternalNode::iterator end)
+    : AbsInternalW(ta, node_size, ta.alloc(node_size).addr, counted, first,
+                   first_count, begin, end) {}
+
+AbsInternalW::AbsInternalW(Transaction& ta, size_t node_size, Addr addr,
+                           bool counted, Addr first, uint64_t first_count,
+                           InternalNode::iterator begin,
+                           InternalNode::iterator end)
+    : NodeW(addr)
+    , entries_{ ta, node_size, addr, counted, first, first_count, begin, end } {
 }
 
-AbsInternalW::AbsInternalW(Transaction& ta, Addr addr, Addr left, Key sep,
-                           Addr right)
-    : NodeW(addr), entries_{ ta, addr, left, sep, right } {}
+AbsInternalW::AbsInternalW(Transaction& ta, size_t node_size, Addr addr,
+                           Addr left, Key sep, Addr right)
+    : NodeW(addr), entries_{ ta, node_size, addr, left, sep, right } {}
 
 bool AbsInternalW::insert(Key key, const model::Value& val, Overwrite ow,
                           AbsInternalW* parent) {
@@ -309,8 +551,12 @@ bool AbsInternalW::insert(Key key, const model::Value& val, Overwrite ow,
 
 void AbsInternalW::insert(Key key, std::unique_ptr<NodeW> c) {
   if (!entries_.isFull()) {
-    entries_.insert(key, c->addr());
-    childs_.emplace(c->addr(), std::move(c));
+    auto addr = c->addr();
+    entries_.insert(key, addr, entries_.counted() ? c->count() : 0);
+    childs_.emplace(addr, std::move(c));
+    // c was split from the child before it
+    auto left = entries_.child(entries_.position(addr) - 1);
+    if (childs_.find(left) != childs_.end()) recount(left);
   } else {
     split(key, std::move(c));
   }
@@ -326,6 +572,22 @@ bool AbsInternalW::remove(Key key, AbsInternalW* parent) {
   return searchChild(key).remove(key, this);
 }
 
+uint64_t AbsInternalW::count() { return entries_.total(); }
+
+void AbsInternalW::addCount(Key key, int64_t delta) {
+  if (!entries_.counted()) return;
+  auto i = entries_.position(key);
+  entries_.setCount(i, entries_.count(i) + static_cast<uint64_t>(delta));
+  if (parent_ != nullptr) parent_->addCount(key, delta);
+}
+
+void AbsInternalW::recount(Addr addr) {
+  if (!entries_.counted()) return;
+  auto lookup = childs_.find(addr);
+  Expects(lookup != childs_.end());
+  entries_.setCount(entries_.position(addr), lookup->second->count());
+}
+
 Writes AbsInternalW::getWrites() const {
   Writes w;
   w.reserve(1 + childs_.size()); // may be more, but a good guess
@@ -374,11 +636,11 @@ NodeW& AbsInternalW::getSibling(Key key) {
   }
 }
 
-DskInternalNode::iterator AbsInternalW::searchEntry(Key key) {
+InternalNode::iterator AbsInternalW::searchEntry(Key key) {
   return entries_.search(key);
 }
 
-void AbsInternalW::removeMerged(DskInternalNode::iterator it) {
+void AbsInternalW::removeMerged(InternalNode::iterator it) {
   auto lookup = childs_.find(it->addr);
   if (lookup == childs_.end()) {
     throw ConsistencyError("removeMerged with unknown Address");
@@ -386,7 +648,7 @@ void AbsInternalW::removeMerged(DskInternalNode::iterator it) {
   childs_.erase(lookup);
 
   entries_.remove(it);
-  if (entries_.size() < kMinInternalEntries) balance();
+  if (entries_.size() < minInternalEntries(entries_.nodeSize())) balance();
 }
 
 Key AbsInternalW::updateMerged(Key key, Key new_key) {
@@ -404,8 +666,9 @@ void InternalW::split(Key key, std::unique_ptr<NodeW> c) {
   auto end = entries_.end();
   auto mid_key = mid->entry.key.key();
 
-  auto sibling = std::make_unique<InternalW>(AllocateNew(), entries_.ta_,
-                                             mid->addr, std::next(mid), end);
+  auto sibling = std::make_unique<InternalW>(
+      AllocateNew(), entries_.ta_, entries_.nodeSize(), entries_.counted(),
+      mid->addr, static_cast<uint64_t>(mid->count), std::next(mid), end);
 
   for (auto it = mid; it < end; ++it) {
     tryTransfer(childs_, sibling->childs_, it->addr);
@@ -418,15 +681,17 @@ void InternalW::split(Key key, std::unique_ptr<NodeW> c) {
     sibling->insert(key, std::move(c));
   }
 
-  Ensures(entries_.size() >= kMinInternalEntries);
-  Ensures(sibling->entries_.size() >= kMinInternalEntries);
+  auto min_entries = entries_.minSize();
+  Ensures(entries_.size() >= min_entries);
+  Ensures(sibling->entries_.size() >= min_entries);
 
   parent_->insert(mid_key, std::move(sibling));
 }
 
 void InternalW::balance() {
   Expects(parent_ != nullptr);
-  Expects(entries_.size() < kMinInternalEntries);
+  auto min_entries = entries_.minSize();
+  Expects(entries_.size() < min_entries);
 
   auto first_key = entries_.begin()->entry.key.key();
   auto& sibl = static_cast<InternalW&>(parent_->getSibling(first_key));
@@ -434,7 +699,7 @@ void InternalW::balance() {
   sibl.parent_ = parent_;
   auto sibl_key = sibl.entries_.begin()->entry.key.key();
 
-  if (sibl.entries_.size() <= kMinInternalEntries) {
+  if (sibl.entries_.size() <= min_entries) {
     // merge
     if (first_key > sibl_key) {
       sibl.merge(*this);
@@ -444,7 +709,7 @@ void InternalW::balance() {
   } else {
     // pull stuff
     auto to_pull = (sibl.entries_.size() - entries_.size()) / 2;
-    Ensures(to_pull > 0 && to_pull < kMaxInternalEntries);
+    Ensures(to_pull > 0 && to_pull < entries_.capacity());
 
     if (first_key > sibl_key) {
       // pull biggest from left
@@ -466,7 +731,7 @@ void InternalW::balance() {
       auto from = sibl.entries_.begin();
       auto to = sibl.entries_.begin() + to_pull;
       auto sep_key = parent_->updateMerged(sibl_key, to->entry.key.key());
-      entries_.insert(sep_key, first);
+      entries_.insert(sep_key, first, sibl.entries_.count(0));
 
       tryTransfer(sibl.childs_, childs_, first);
       for (auto it = from; it < to; ++it) {
@@ -476,25 +741,31 @@ void InternalW::balance() {
       entries_.append(from, to);
       sibl.entries_.removeHead(to);
     }
+
+    parent_->recount(addr_);
+    parent_->recount(sibl.addr());
   }
 }
 
 void InternalW::merge(InternalW& right) {
   Expects(&right != this);
-  Expects(entries_.size() + right.entries_.size() + 1 <= kMaxInternalEntries);
+  Expects(entries_.size() + right.entries_.size() + 1 <=
+          entries_.capacity());
 
   auto from = right.entries_.begin();
   auto to = right.entries_.end();
 
   Expects(entries_.begin()->entry.key.key() < from->entry.key.key());
   auto right_entry = parent_->searchEntry(from->entry.key.key());
-  entries_.insert(right_entry->entry.key.key(), right.entries_.first());
+  entries_.insert(right_entry->entry.key.key(), right.entries_.first(),
+                  right.entries_.count(0));
   entries_.append(from, to);
 
   for (auto& c : right.childs_) {
     childs_.emplace(c.first, std::move(c.second));
   }
 
+  parent_->recount(addr_);
   parent_->removeMerged(right_entry);
 }
 
@@ -508,14 +779,139 @@ RootInternalW::RootInternalW(Transaction& ta, Addr addr,
                              std::unique_ptr<LeafW> left_leaf, Key sep,
                              std::unique_ptr<LeafW> right_leaf,
                              BtreeWritable& parent)
-    : AbsInternalW(ta, addr, left_leaf->addr(), sep, right_leaf->addr())
+    : AbsInternalW(ta, left_leaf->nodeSize(), addr, left_leaf->addr(), sep,
+                   right_leaf->addr())
     , parent_{ parent } {
+  entries_.setCount(0, left_leaf->count());
+  entries_.setCount(1, right_leaf->count());
   auto left_addr = left_leaf->addr();
   auto right_addr = right_leaf->addr();
   childs_.emplace(left_addr, std::move(left_leaf));
   childs_.emplace(right_addr, std::move(right_leaf));
 }
 
+RootInternalW::RootInternalW(Transaction& ta, size_t node_size, Addr addr,
+                             Addr first, uint64_t first_count,
+                             InternalNode::iterator begin,
+                             InternalNode::iterator end, BtreeWritable& parent)
+    : AbsInternalW(ta, node_size, addr, true, first, first_count, begin, end)
+    , parent_{ parent } {}
+
+bool RootInternalW::insert(Key key, const model::Value& val, Overwrite ow,
+                           AbsInternalW* parent) {
+  adoptTail();
+  auto inserted = AbsInternalW::insert(key, val, ow, parent);
+  updateTail(false);
+  return inserted;
+}
+
+Key RootInternalW::append(const model::Value& val, AbsInternalW* parent) {
+  if (!tail_ && childs_.empty()) {
+    auto tail = entries_.tail();
+    if (tail != Addr(0)) tail_ = std::make_unique<LeafW>(entries_.ta_, tail);
+  }
+  if (tail_) {
+    auto key = tail_->appendInPlace(val);
+    if (key) {
+      countTailAppend();
+      return *key;
+    }
+  }
+
+  adoptTail();
+  auto key = AbsInternalW::append(val, parent);
+  updateTail(true);
+  return key;
+}
+
+bool RootInternalW::remove(Key key, AbsInternalW* parent) {
+  // may replace this node by a RootLeafW, BtreeWritable updates the tail
+  adoptTail();
+  auto removed = AbsInternalW::remove(key, parent);
+  if (collapse_) collapse();
+  return removed;
+}
+
+Writes RootInternalW::getWrites() const {
+  auto w = AbsInternalW::getWrites();
+  if (tail_) {
+    auto tw = tail_->getWrites();
+    std::move(tw.begin(), tw.end(), std::back_inserter(w));
+  }
+  for (auto& c : tail_counts_)
+    w.push_back({ c.first, c.second + tail_appended_ });
+  return w;
+}
+
+void RootInternalW::destroy() {
+  adoptTail();
+  AbsInternalW::destroy();
+}
+
+void RootInternalW::countTailAppend() {
+  if (!entries_.counted()) return;
+  auto last = entries_.position(infiniteKey());
+  entries_.setCount(last, entries_.count(last) + 1);
+
+  if (tail_appended_++ > 0) return;
+  auto addr = entries_.child(last);
+  while (addr != tail_->addr()) {
+    auto ref = loadNode(entries_.ta_, addr);
+    InternalView node(*ref);
+    tail_counts_.emplace_back(Addr(addr.value + node.countOffset(node.size())),
+                              node.count(node.size()));
+    addr = node.child(node.size());
+  }
+}
+
+void RootInternalW::adoptTail() {
+  if (!tail_) return;
+  AbsInternalW* node = this;
+  for (;;) {
+    auto addr = node->entries_.searchChildAddr(infiniteKey());
+    if (addr == tail_->addr()) {
+      node->childs_.emplace(addr, std::move(tail_));
+      break;
+    }
+    node = static_cast<AbsInternalW*>(&node->searchChild(infiniteKey()));
+    // the counts of the nodes below the root were not changed yet
+    if (tail_appended_ > 0) {
+      auto last = node->entries_.position(infiniteKey());
+      node->entries_.setCount(last,
+                              node->entries_.count(last) + tail_appended_);
+    }
+  }
+  tail_appended_ = 0;
+  tail_counts_.clear();
+}
+
+void RootInternalW::updateTail(bool force) {
+  Expects(!tail_);
+  auto known = entries_.tail();
+  if (known == Addr(0) && !force) return;
+
+  AbsInternalW* node = this;
+  Addr addr;
+  for (;;) {
+    addr = node->entries_.searchChildAddr(infiniteKey());
+    auto lookup = node->childs_.find(addr);
+    if (lookup == node->childs_.end()) break;
+    node = dynamic_cast<AbsInternalW*>(lookup->second.get());
+    if (node == nullptr) {
+      entries_.setTail(addr);
+      return;
+    }
+  }
+  if (known != Addr(0)) return;
+
+  for (;;) {
+    auto ref = loadNode(entries_.ta_, addr);
+    if (isNodeLeaf(*ref)) break;
+    addr = InternalView(*ref).searchAddr(infiniteKey());
+  }
+  entries_.setTail(addr);
+}
+
 void RootInternalW::split(Key key, std::unique_ptr<NodeW> child) {
   Expects(entries_.isFull());
 
@@ -524,11 +920,16 @@ void RootInternalW::split(Key key, std::unique_ptr<NodeW> child) {
   auto end = entries_.end();
   auto mid_key = mid->entry.key.key();
 
+  auto node_size = entries_.nodeSize();
+  auto counted = entries_.counted();
   auto left = std::make_unique<InternalW>(AllocateNew(), entries_.ta_,
-                                          entries_.first(), beg, mid);
+                                          node_size, counted, entries_.first(),
+                                          entries_.count(0), beg, mid);
 
   auto right = std::make_unique<InternalW>(AllocateNew(), entries_.ta_,
-                                           mid->addr, std::next(mid), end);
+                                           node_size, counted, mid->addr,
+                                           static_cast<uint64_t>(mid->count),
+                                           std::next(mid), end);
 
   tryTransfer(childs_, left->childs_, entries_.first());
   for (auto it = beg; it < mid; ++it) {
@@ -549,9 +950,11 @@ void RootInternalW::split(Key key, std::unique_ptr<NodeW> child) {
 
   entries_.removeTail(std::next(beg));
   entries_.makeRoot(left->addr(), mid_key, right->addr());
+  entries_.setCount(0, left->count());
+  entries_.setCount(1, right->count());
 
-  Ensures(left->entries_.size() >= kMinInternalEntries);
-  Ensures(right->entries_.size() >= kMinInternalEntries);
+  Ensures(left->entries_.size() >= left->entries_.minSize());
+  Ensures(right->entries_.size() >= right->entries_.minSize());
   auto right_addr = right->addr();
   auto left_addr = left->addr();
   childs_.emplace(right_addr, std::move(right));
@@ -564,35 +967,38 @@ void RootInternalW::balance() {
 
   Expects(childs_.size() == 1);
 
-  auto childp = std::move(childs_.begin()->second);
-  childs_.clear();
-
-  auto child_internal = dynamic_cast<InternalW*>(childp.get());
+  auto child_internal = dynamic_cast<InternalW*>(childs_.begin()->second.get());
   if (child_internal != nullptr) {
     // the child is internal node
     // pull content into this node
 
+    auto childp = std::move(childs_.begin()->second);
+    childs_.clear();
     entries_.takeNodeFrom(child_internal->entries_);
     childs_ = std::move(child_internal->childs_);
-    entries_.ta_.free(child_internal->addr(), kBlockSize);
+    entries_.ta_.free(child_internal->addr(), entries_.nodeSize());
 
     return;
   }
 
-  auto child_leaf = dynamic_cast<LeafW*>(childp.get());
-  if (child_leaf != nullptr) {
-    // the child is leaf node
-    // tree becomes single RootLeafW
-
-    auto new_me = std::unique_ptr<RootLeafW>(
-        new RootLeafW(std::move(*child_leaf), addr_, parent_));
-    parent_.root_ = std::move(new_me);
+  // the child is leaf node, the tree becomes a single RootLeafW once the
+  // operation below this node is done
+  collapse_ = true;
+}
 
-    return;
-  }
+void RootInternalW::collapse() {
+  Expects(childs_.size() == 1);
+  auto childp = std::move(childs_.begin()->second);
+  childs_.clear();
 
+  auto child_leaf = dynamic_cast<LeafW*>(childp.get());
   // there should be now way this can happen.
-  throw ConsistencyError("Invalid merge below root node");
+  if (child_leaf == nullptr)
+    throw ConsistencyError("Invalid merge below root node");
+
+  auto new_me = std::unique_ptr<RootLeafW>(
+      new RootLeafW(std::move(*child_leaf), addr_, parent_));
+  parent_.root_ = std::move(new_me);
 }
 
 } // namespace btree
@@ -6,49 +6,102 @@
 #include "btree.h"
 #include "common.h"
 #include <boost/container/flat_map.hpp>
+#include <boost/optional.hpp>
 
 namespace cheesebase {
 namespace disk {
 namespace btree {
 
-constexpr size_t kMaxInternalEntries = (kBlockSize - 16) / 16;
-constexpr size_t kMinInternalEntries = (kMaxInternalEntries / 2) - 1;
+// Entries (separator key, child address and count) of an internal node of
+// node_size bytes, besides the leftmost child. Nodes written before version 6
+// hold no counts and more entries.
+constexpr size_t maxInternalEntries(size_t node_size, bool counted = true) {
+  return counted ? (node_size - 24) / 24 : (node_size - 16) / 16;
+}
+constexpr size_t minInternalEntries(size_t node_size, bool counted = true) {
+  return maxInternalEntries(node_size, counted) / 2 - 1;
+}
 
-// Magic byte + number of elements
+// the entry count is stored in a byte
+static_assert(maxInternalEntries(k_max_node_size, false) <= 0xff,
+              "Internal nodes to big");
+
+// Internal nodes start with a magic byte. Nodes written before version 3 hold
+// pairs of key and address, later nodes store all keys and all addresses in
+// separate arrays, so keys can be compared in bulk. Since version 6 they are
+// followed by the number of entries below every child. Trees are counted in
+// all their internal nodes or in none, nodes of older trees stay uncounted.
+constexpr uint8_t kInternalMagicPairs = 'I';
+constexpr uint8_t kInternalMagicArrays = 'N';
+constexpr uint8_t kInternalMagicCounts = 'C';
+
+// Magic byte, node size class, address of the rightmost leaf and number of
+// entries. Only root nodes keep the address of the rightmost leaf, as a hint
+// for appending. Like with the next leaf of DskLeafHdr, the lowest byte of the
+// address is always zero and holds the number of entries instead. Zero means
+// no hint, as in nodes written before version 4.
 CB_PACKED(struct DskInternalHdr {
-  DskInternalHdr() = default;
+  static constexpr uint64_t kTailMask = lowerBitmask(48) & ~lowerBitmask(8);
+
+  // Keeps the format, nodes of pairs are stored as arrays.
   DskInternalHdr& fromSize(uint64_t d) {
-    Expects((d & (static_cast<uint64_t>(0xff) << 56)) == 0);
-    constexpr uint64_t magic = static_cast<uint64_t>('I') << 56;
-    data = d + magic;
+    Expects((d & ~lowerBitmask(8)) == 0);
+    auto magic = hasCounts() ? kInternalMagicCounts : kInternalMagicArrays;
+    data = (static_cast<uint64_t>(magic) << 56) +
+           (data & ((lowerBitmask(8) << 48) | kTailMask)) + d;
     return *this;
   }
-  DskInternalHdr& fromRaw(uint64_t w) {
-    data = w;
-    if (!hasMagic()) throw ConsistencyError("No magic byte in internal node");
-    return *this;
+
+  void setCounted(bool counted) {
+    auto magic = counted ? kInternalMagicCounts : kInternalMagicArrays;
+    data = (data & lowerBitmask(56)) + (static_cast<uint64_t>(magic) << 56);
+  }
+
+  void setTail(Addr tail) {
+    Expects((tail.value & ~kTailMask) == 0);
+    data = (data & ~kTailMask) + tail.value;
   }
 
-  bool hasMagic() const noexcept { return (data >> 56) == 'I'; }
+  Addr tail() const noexcept {
+    return hasPairs() ? Addr(0) : Addr(data & kTailMask);
+  }
+
+  void setNodeSize(size_t size) {
+    data = (data & ~(lowerBitmask(8) << 48)) + (classOfNodeSize(size) << 48);
+  }
+
+  uint8_t magic() const noexcept { return static_cast<uint8_t>(data >> 56); }
+  bool hasMagic() const noexcept {
+    return magic() == kInternalMagicCounts ||
+           magic() == kInternalMagicArrays || magic() == kInternalMagicPairs;
+  }
+  bool hasPairs() const noexcept { return magic() == kInternalMagicPairs; }
+  bool hasCounts() const noexcept { return magic() == kInternalMagicCounts; }
   void check() const {
     if (!hasMagic()) throw ConsistencyError("Expected internal node header");
   }
 
+  size_t nodeSize() const {
+    return hasPairs() ? k_min_node_size
+                      : nodeSizeOfClass((data >> 48) & lowerBitmask(8));
+  }
+
   size_t size() const {
-    size_t s = gsl::narrow_cast<size_t>(data & lowerBitmask(56));
-    if (s > kMaxInternalEntries)
+    size_t s = gsl::narrow_cast<size_t>(
+        data & (hasPairs() ? lowerBitmask(48) : lowerBitmask(8)));
+    if (s > maxInternalEntries(nodeSize(), hasCounts()))
       throw ConsistencyError("Internal node entry count to big");
     return s;
   }
 
   void operator--() {
-    Expects(data & lowerBitmask(56));
+    Expects(data & lowerBitmask(8));
     data--;
   }
 
   void operator++() { data++; }
 
-  uint64_t data;
+  uint64_t data{ static_cast<uint64_t>(kInternalMagicCounts) << 56 };
 });
 static_assert(sizeof(DskInternalHdr) == 8, "Invalid DskInternalHdr size");
 
@@ -79,37 +132,88 @@ CB_PACKED(struct DskInternalEntry {
 });
 static_assert(sizeof(DskInternalEntry) == 8, "Invalid DskInternalEntry size");
 
+// Key and address as stored in nodes before version 3. Writers keep entries
+// in this form, followed by the number of entries below the address.
 CB_PACKED(struct DskInternalPair {
   DskInternalPair() = default;
 
   void zero() {
     addr.value = 0;
     entry.zero();
+    count = 0;
   }
 
   DskInternalEntry entry;
   Addr addr;
+  uint64_t count;
 });
-static_assert(sizeof(DskInternalPair) == 16, "Invalid DskInternalPair size");
 
 inline bool operator<(Key k, const DskInternalPair& p) {
   return k < p.entry.key.key();
 }
 
-CB_PACKED(struct DskInternalNode {
+// Read only view of an internal node in any format. In the current format the
+// header and leftmost address are followed by maxInternalEntries() keys, as
+// many addresses and the counts of all children, the leftmost one first.
+class InternalView {
+public:
+  explicit InternalView(gsl::span<const Byte> block);
+
+  const DskInternalHdr& hdr() const {
+    return *reinterpret_cast<const DskInternalHdr*>(data_);
+  }
+  size_t nodeSize() const { return hdr().nodeSize(); }
+  size_t size() const { return size_; }
+  Addr first() const { return Addr(data_[1]); }
+  Key key(size_t i) const;
+  Addr addr(size_t i) const;
+
+  // Child i counted from the leftmost one and the number of entries below it,
+  // the latter only in counted nodes.
+  Addr child(size_t i) const { return i == 0 ? first() : addr(i - 1); }
+  bool counted() const { return hdr().hasCounts(); }
+  uint64_t count(size_t i) const;
+
+  // Offset of the count of child i in the node in bytes.
+  size_t countOffset(size_t i) const { return 8 * (2 + 2 * capacity_ + i); }
+
+  // Number of entries below the node, only in counted nodes.
+  uint64_t total() const;
+
+  // Number of keys not greater than key.
+  size_t upperBound(Key key) const;
+
+  // Address of the child including key.
+  Addr searchAddr(Key key) const;
+
+private:
+  const uint64_t* data_;
+  size_t size_;
+  size_t capacity_;
+};
+
+// Internal node as modified by writers.
+struct InternalNode {
+  explicit InternalNode(size_t node_size, bool counted = true);
+  explicit InternalNode(const InternalView& view);
+
   DskInternalHdr hdr;
   Addr first;
-  std::array<DskInternalPair, kMaxInternalEntries> pairs;
+  uint64_t first_count{ 0 };
+  std::vector<DskInternalPair> pairs; // always maxInternalEntries() long
 
-  using iterator = decltype(pairs.begin());
+  using iterator = std::vector<DskInternalPair>::iterator;
   Addr searchAddr(Key key) const;
+  size_t nodeSize() const { return hdr.nodeSize(); }
+  bool counted() const { return hdr.hasCounts(); }
   auto begin() noexcept { return pairs.begin(); }
   auto end() noexcept { return pairs.begin() + hdr.size(); }
   auto begin() const noexcept { return pairs.begin(); }
   auto end() const noexcept { return pairs.begin() + hdr.size(); }
-});
-static_assert(sizeof(DskInternalNode) == kBlockSize,
-              "Invalid DskInternalNode size");
+
+  // Serialize in the current format into buffer.
+  void store(std::vector<uint64_t>& buffer) const;
+};
 
 class LeafW;
 class AbsInternalW;
@@ -118,19 +222,21 @@ class InternalEntriesW {
   friend class AbsInternalW;
 
 public:
-  InternalEntriesW(Transaction& ta, Addr first, DskInternalNode::iterator begin,
-                   DskInternalNode::iterator end);
+  InternalEntriesW(Transaction& ta, size_t node_size, Addr addr, bool counted,
+                   Addr first, uint64_t first_count,
+                   InternalNode::iterator begin, InternalNode::iterator end);
   InternalEntriesW(Transaction& ta, Addr addr);
-  InternalEntriesW(Transaction& ta, Addr addr, Addr left, Key sep, Addr right);
+  InternalEntriesW(Transaction& ta, size_t node_size, Addr addr, Addr left,
+                   Key sep, Addr right);
 
   Addr searchChildAddr(Key key);
   Addr searchSiblingAddr(Key key);
-  void insert(Key key, Addr addr);
+  void insert(Key key, Addr addr, uint64_t count);
 
   //! Get iterator to entry including \param key.
-  DskInternalNode::iterator search(Key key);
+  InternalNode::iterator search(Key key);
 
-  void remove(DskInternalNode::iterator entry);
+  void remove(InternalNode::iterator entry);
 
   //! Remove entry that includes key, returns lowest key of removed entry.
   Key remove(Key key);
@@ -144,49 +250,89 @@ public:
   //! True if no more space.
   bool isFull();
 
+  //! Maximum and minimum number of entries of the node.
+  size_t capacity();
+  size_t minSize();
+
+  //! True if the node keeps the number of entries below its children. Does
+  //! not load the node.
+  bool counted();
+
+  //! Position of the child including \param key, 0 is the leftmost child.
+  //! Does not load the node.
+  size_t position(Key key);
+
+  //! Position of the child at \param addr.
+  size_t position(Addr addr);
+
+  //! Address of child \param i, 0 is the leftmost child. Does not load the
+  //! node.
+  Addr child(size_t i);
+
+  //! Number of entries below child \param i. Does not load the node.
+  uint64_t count(size_t i);
+
+  //! Set number of entries below child \param i, loads the node if changed.
+  void setCount(size_t i, uint64_t count);
+
+  //! Number of entries below this node. Does not load the node.
+  uint64_t total();
+
   //! Number of entries == # \c Key == # \c Addr - 1.
   size_t size();
 
   //! Add \c Write of this node to the container.
-  void addWrite(Writes&) const noexcept;
+  void addWrite(Writes&) const;
+
+  //! Size of the node in bytes.
+  size_t nodeSize();
 
   //! Iterator to first entry.
-  DskInternalNode::iterator begin();
+  InternalNode::iterator begin();
 
   //! Iterator to middle entry. Rounds down on uneven entries.
-  DskInternalNode::iterator mid();
+  InternalNode::iterator mid();
 
   //! Iterator to past the last entry.
-  DskInternalNode::iterator end();
+  InternalNode::iterator end();
 
   //! Get leftmost \c Addr
   Addr first();
 
   //! Remove all entries starting at \param from.
-  void removeTail(DskInternalNode::iterator from);
+  void removeTail(InternalNode::iterator from);
 
   //! Remove all entries until \param to.
-  void removeHead(DskInternalNode::iterator to);
+  void removeHead(InternalNode::iterator to);
 
   //! Prepend range of entries. \param sep has to be a seperator between the
   //! last entry and the first of the existing node (\class Key used in parent).
-  void prepend(DskInternalNode::iterator from, DskInternalNode::iterator to,
+  void prepend(InternalNode::iterator from, InternalNode::iterator to,
                Key sep);
 
   //! Append range of entries.
-  void append(DskInternalNode::iterator from, DskInternalNode::iterator to);
+  void append(InternalNode::iterator from, InternalNode::iterator to);
 
   //! Transform to root, 2 childs and a seperator, dismiss old entries.
   void makeRoot(Addr left, Key sep, Addr right);
 
-  //! Take over \c DskInternalNode from \param other.
+  //! Take over \c InternalNode from \param other, keeps the rightmost leaf.
   void takeNodeFrom(InternalEntriesW& other);
 
+  //! Address of the rightmost leaf as kept in root nodes, 0 if unknown. Does
+  //! not load the node.
+  Addr tail();
+
+  //! Keep \param addr as address of the rightmost leaf.
+  void setTail(Addr addr);
+
   Transaction& ta_;
 
   void init();
   Addr addr_;
-  std::unique_ptr<DskInternalNode> node_;
+  boost::optional<bool> counted_;
+  std::unique_ptr<InternalNode> node_;
+  mutable std::vector<uint64_t> buffer_; // serialized node_ of addWrite
 };
 
 class AbsInternalW : public NodeW {
@@ -194,11 +340,17 @@ class AbsInternalW : public NodeW {
 
 public:
   AbsInternalW(Transaction& ta, Addr addr);
-  AbsInternalW(AllocateNew, Transaction& ta, Addr first,
-               DskInternalNode::iterator begin, DskInternalNode::iterator end);
+  AbsInternalW(AllocateNew, Transaction& ta, size_t node_size, bool counted,
+               Addr first, uint64_t first_count, InternalNode::iterator begin,
+               InternalNode::iterator end);
+  // same, but in the already allocated block at addr
+  AbsInternalW(Transaction& ta, size_t node_size, Addr addr, bool counted,
+               Addr first, uint64_t first_count, InternalNode::iterator begin,
+               InternalNode::iterator end);
 
   // used when extending single root leaf to internal root
-  AbsInternalW(Transaction& ta, Addr addr, Addr left, Key sep, Addr right);
+  AbsInternalW(Transaction& ta, size_t node_size, Addr addr, Addr left, Key sep,
+               Addr right);
 
   bool insert(Key key, const model::Value&, Overwrite,
               AbsInternalW* parent) override;
@@ -209,23 +361,32 @@ public:
   void insert(Key key, std::unique_ptr<NodeW> c);
   bool remove(Key key, AbsInternalW* parent) override;
   Writes getWrites() const override;
+  uint64_t count() override;
+
+  //! Add \param delta to the count of the child including \param key and
+  //! to the counts of the nodes above.
+  void addCount(Key key, int64_t delta);
+
+  //! Recount the open child at \param addr after entries moved to or from
+  //! it. The count of this node is unchanged.
+  void recount(Addr addr);
   NodeW& searchChild(Key k);
   void destroy() override;
   void appendChild(std::pair<Addr, std::unique_ptr<NodeW>>&&);
   NodeW& getSibling(Key key);
 
   //! Return Key-Addr-Pair iterator refered to by \param key.
-  DskInternalNode::iterator searchEntry(Key key);
+  InternalNode::iterator searchEntry(Key key);
 
   //! Remove Key-Addr-Pair referenced by \param entry.
-  void removeMerged(DskInternalNode::iterator entry);
+  void removeMerged(InternalNode::iterator entry);
 
   //! Replace \c Key which includes key with new_key, returns replaced \c Key.
   Key updateMerged(Key key, Key new_key);
 
 protected:
   InternalEntriesW entries_;
-  AbsInternalW* parent_;
+  AbsInternalW* parent_{ nullptr };
   boost::container::flat_map<Addr, std::unique_ptr<NodeW>> childs_;
 
 private:
@@ -243,21 +404,65 @@ private:
   void merge(InternalW& right);
 };
 
+// Root of a tree of more than one leaf. The address of the rightmost leaf is
+// kept in its header, values are appended to that leaf directly as long as it
+// has room.
 class RootInternalW : public AbsInternalW {
   friend class RootLeafW;
+  friend class BtreeWritable;
 
 public:
   RootInternalW(Transaction& ta, Addr addr, BtreeWritable& parent);
 
+  bool insert(Key key, const model::Value&, Overwrite,
+              AbsInternalW* parent) override;
+  Key append(const model::Value&, AbsInternalW* parent) override;
+  bool remove(Key key, AbsInternalW* parent) override;
+  Writes getWrites() const override;
+  void destroy() override;
+
+  //! Store the address of the rightmost leaf after the tree changed. Nodes
+  //! not opened by this writer are unchanged, below them the known address
+  //! is kept. Without one it is only searched if \param force is set.
+  void updateTail(bool force);
+
 private:
   // used to construct while splitting RootLeafW
   RootInternalW(Transaction& ta, Addr addr, std::unique_ptr<LeafW> left_leaf,
                 Key sep, std::unique_ptr<LeafW> right_leaf,
                 BtreeWritable& parent);
 
+  // used to construct while building a tree bottom-up, in the block at addr
+  RootInternalW(Transaction& ta, size_t node_size, Addr addr, Addr first,
+                uint64_t first_count, InternalNode::iterator begin,
+                InternalNode::iterator end, BtreeWritable& parent);
+
   void split(Key, std::unique_ptr<NodeW>) override;
   void balance() override;
+
+  // Replace this node by a RootLeafW of its only child, after the operation
+  // that emptied it.
+  void collapse();
+
+  // Count an entry appended to tail_ in this node and the nodes below.
+  void countTailAppend();
+
+  // Move tail_ to its parent below this node, before the tree is descended.
+  void adoptTail();
+
   BtreeWritable& parent_;
+
+  // rightmost leaf opened by its address in the header, while no other child
+  // is open
+  std::unique_ptr<LeafW> tail_;
+
+  // Entries appended to tail_ and the counts of its ancestors below this node
+  // before, each the address of the word holding it and its value. Only
+  // those words are written.
+  uint64_t tail_appended_{ 0 };
+  std::vector<std::pair<Addr, uint64_t>> tail_counts_;
+
+  bool collapse_{ false };
 };
 
 } // namespace btree
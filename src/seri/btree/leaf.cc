@@ -14,24 +14,149 @@ namespace cheesebase {
 namespace disk {
 namespace btree {
 
+////////////////////////////////////////////////////////////////////////////////
+// LeafView
+
+size_t LeafView::count() const {
+  auto c = hdr().count();
+  if (c > nr_words_) throw ConsistencyError("Leaf slot count to big");
+  return c;
+}
+
+gsl::span<const uint64_t> LeafView::extras(size_t i) const {
+  auto s = slot(i);
+  auto n = s.extraWords();
+  if (n == 0) return {};
+  if (s.offset < count() || s.offset + n > nr_words_)
+    throw ConsistencyError("Invalid leaf slot offset");
+  return { words() + s.offset, static_cast<std::ptrdiff_t>(n) };
+}
+
+size_t LeafView::search(Key key) const {
+  // branch-free lower bound
+  auto n = count();
+  if (n == 0) return 0;
+  auto base = words();
+  while (n > 1) {
+    auto half = n / 2;
+    base = slotKey(base[half]) < key.value ? base + half : base;
+    n -= half;
+  }
+  return static_cast<size_t>(base - words()) +
+         (slotKey(*base) < key.value ? 1 : 0);
+}
+
+size_t LeafView::usedWords() const {
+  size_t used = 0;
+  for (size_t i = 0; i < count(); ++i) used += entryWords(i);
+  return used;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LeafNode
+
+LeafNode::LeafNode(std::unique_ptr<uint64_t[]> buf, size_t node_size)
+    : LeafView(buf.get(), node_size), buf_{ std::move(buf) } {}
+
+LeafNode::LeafNode(size_t node_size)
+    : LeafNode(std::make_unique<uint64_t[]>(node_size / 8), node_size) {
+  hdr().setCount(0);
+  hdr().setNodeSize(node_size);
+}
+
+LeafNode::LeafNode(const LeafView& other) : LeafNode(other.nodeSize()) {
+  Expects(other.hdr().isSlotted());
+  std::copy(other.words() - 1, other.words() + other.nrWords(), buf_.get());
+}
+
+void LeafNode::insert(size_t pos, Key key, uint8_t type,
+                      gsl::span<const uint64_t> extras) {
+  auto n = count();
+  Expects(pos <= n);
+  auto extra_words = static_cast<size_t>(extras.size());
+  Expects(extra_words == nrExtraWords(type));
+  auto data_begin = nr_words_ - (usedWords() - n);
+  Expects(n + 1 + extra_words <= data_begin);
+
+  auto words = mutableWords();
+  data_begin -= extra_words;
+  std::copy(extras.begin(), extras.end(), words + data_begin);
+
+  std::copy_backward(words + pos, words + n, words + n + 1);
+  words[pos] =
+      DskLeafSlot(key, type,
+                  extra_words == 0 ? 0 : gsl::narrow<uint8_t>(data_begin))
+          .word();
+  hdr().setCount(n + 1);
+}
+
+void LeafNode::insert(size_t pos, const LeafView& other, size_t from,
+                      size_t to) {
+  Expects(from <= to && to <= other.count());
+  for (auto i = from; i < to; ++i)
+    insert(pos++, other.key(i), other.slot(i).type, other.extras(i));
+}
+
+void LeafNode::erase(size_t from, size_t to) {
+  Expects(from <= to && to <= count());
+  if (from == to) return;
+
+  // rebuild to keep the extra words packed at the back
+  LeafNode rest{ nodeSize() };
+  rest.hdr().setNext(hdr().next());
+  rest.insert(0, *this, 0, from);
+  rest.insert(from, *this, to, count());
+  std::copy(rest.buf_.get(), rest.buf_.get() + nr_words_ + 1, buf_.get());
+}
+
+LeafView leafView(gsl::span<const Byte> block, std::unique_ptr<LeafNode>& tmp) {
+  auto& hdr = bytesAsType<DskLeafHdr>(block);
+  if (!hdr.hasMagic()) throw ConsistencyError("No magic byte in leaf node");
+  auto size = hdr.nodeSize();
+  if (static_cast<size_t>(block.size()) < size)
+    throw ConsistencyError("Leaf exceeds block");
+
+  LeafView view{ reinterpret_cast<const uint64_t*>(block.data()), size };
+  if (hdr.isSlotted()) return view;
+
+  // migrate stream format
+  tmp = std::make_unique<LeafNode>(size);
+  tmp->hdr().setNext(hdr.next());
+  auto words = view.words();
+  size_t i = 0;
+  while (i < view.nrWords() && words[i] != 0) {
+    auto entry = DskLeafEntry(words[i++]);
+    auto n = entry.extraWords();
+    if (i + n > view.nrWords())
+      throw ConsistencyError("Leaf entry exceeds node");
+    tmp->insert(tmp->count(), entry.key.key(), entry.value.type,
+                { words + i, static_cast<std::ptrdiff_t>(n) });
+    i += n;
+  }
+  return *tmp;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // AbsLeafW
 
 AbsLeafW::AbsLeafW(AllocateNew, AbsLeafW&& o, Addr next)
-    : NodeW(o.ta_.alloc(kBlockSize).addr)
+    : NodeW(o.ta_.alloc(o.node_->nodeSize()).addr)
     , linked_(std::move(o.linked_))
     , ta_{ o.ta_ }
     , node_{ std::move(o.node_) }
     , size_{ o.size_ } {
-  node_->hdr.fromAddr(next);
+  node_->hdr().setNext(next);
 }
 
-AbsLeafW::AbsLeafW(AllocateNew, Transaction& ta, Addr next)
-    : NodeW(ta.alloc(kBlockSize).addr)
+AbsLeafW::AbsLeafW(AllocateNew, Transaction& ta, size_t node_size, Addr next)
+    : AbsLeafW(ta, node_size, ta.alloc(node_size).addr, next) {}
+
+AbsLeafW::AbsLeafW(Transaction& ta, size_t node_size, Addr addr, Addr next)
+    : NodeW(addr)
     , ta_{ ta }
-    , node_{ std::make_unique<DskLeafNode>() }
+    , node_{ std::make_unique<LeafNode>(node_size) }
     , size_{ 0 } {
-  node_->hdr.fromAddr(next);
+  node_->hdr().setNext(next);
 }
 
 AbsLeafW::AbsLeafW(Transaction& ta, Addr addr) : NodeW(addr), ta_{ ta } {}
@@ -40,9 +165,7 @@ Writes AbsLeafW::getWrites() const {
   Writes w;
   w.reserve(1 + linked_.size()); // may be more, but a good guess
 
-  if (node_)
-    w.push_back(
-        { addr_, gsl::as_bytes(gsl::span<DskLeafNode>(node_.get(), 1)) });
+  if (node_) w.push_back({ addr_, node_->bytes() });
 
   for (auto& c : linked_) {
     auto cw = c.second->getWrites();
@@ -53,71 +176,49 @@ Writes AbsLeafW::getWrites() const {
 }
 
 void AbsLeafW::destroy() {
-  auto dstr = [this](const DskLeafNode& node) {
-    auto it = node.words.begin();
-    while (it < node.words.end() && *it != 0) it += destroyValue(it);
-  };
-
-  if (node_) {
-    dstr(*node_);
-  } else {
-    auto ref = ta_.loadBlock<kBlockSize>(addr_);
-    dstr(bytesAsType<DskLeafNode>(*ref));
-  }
-
-  ta_.free(addr_, kBlockSize);
+  init();
+  for (size_t i = 0; i < node_->count(); ++i) destroyValue(i);
+  ta_.free(addr_, node_->nodeSize());
 }
 
-template <typename ConstIt>
-size_t AbsLeafW::destroyValue(ConstIt it) {
-  auto entry = DskLeafEntry(*it);
+size_t AbsLeafW::destroyValue(size_t i) {
+  auto slot = node_->slot(i);
 
-  if (entry.value.type == ValueType::object ||
-      entry.value.type == ValueType::string ||
-      entry.value.type == ValueType::array) {
-
-    auto lookup = linked_.find(entry.key.key());
+  if (isRemote(slot.type)) {
+    auto lookup = linked_.find(slot.key.key());
     if (lookup != linked_.end()) {
       lookup->second->destroy();
       linked_.erase(lookup);
     } else {
-      auto addr = Addr(*std::next(it));
-      switch (entry.value.type) {
-      case ValueType::object:
-        ObjectW(ta_, addr).destroy();
-        break;
-      case ValueType::string:
-        StringW(ta_, addr).destroy();
-        break;
-      case ValueType::array:
-        ArrayW(ta_, addr).destroy();
-        break;
-      }
+      destroyRemote(ta_, slot.type, Addr(node_->extras(i)[0]));
     }
   }
 
-  return entry.extraWords() + 1;
+  return slot.extraWords() + 1;
 }
 
 Key AbsLeafW::append(const model::Value& val, AbsInternalW* parent) {
   parent_ = parent;
   init();
-  Expects(node_->hdr.next() == Addr(0));
-
-  Key key{ 0 };
-  auto it = node_->words.begin();
-  while (it < node_->words.end() && *it != 0) {
-    auto e = DskLeafEntry(*it);
-    key = Key(e.key.key().value + 1);
-    it += 1 + e.extraWords();
-  }
+  Expects(node_->hdr().next() == Addr(0));
 
+  auto count = node_->count();
+  Key key{ count == 0 ? 0 : node_->key(count - 1).value + 1 };
 
   auto ins = insert(key, val, Overwrite::Insert, parent);
   Ensures(ins == true);
   return key;
 }
 
+boost::optional<Key> AbsLeafW::appendInPlace(const model::Value& val) {
+  init();
+  Expects(node_->hdr().next() == Addr(0));
+
+  auto words = 1 + nrExtraWords(valueType(val));
+  if (size_ + words > maxLeafWords(node_->nodeSize())) return boost::none;
+  return append(val, nullptr);
+}
+
 bool AbsLeafW::insert(Key key, const model::Value& val, Overwrite ow,
                       AbsInternalW* parent) {
   parent_ = parent;
@@ -125,80 +226,42 @@ bool AbsLeafW::insert(Key key, const model::Value& val, Overwrite ow,
   auto type = valueType(val);
   if (type == ValueType::missing) return true;
 
-  int extra_words = gsl::narrow_cast<int>(nrExtraWords(type));
+  auto extra_words = nrExtraWords(type);
 
   init();
 
   // find position to insert
-  auto it = node_->search(key);
-  Ensures(it <= node_->end());
-  auto top = node_->begin() + size_;
-  bool update = it < top && keyFromWord(*it) == key;
+  auto pos = node_->search(key);
+  bool update = pos < node_->count() && node_->key(pos) == key;
   if ((ow == Overwrite::Update && !update) ||
       (ow == Overwrite::Insert && update)) {
     return false;
   }
 
   // enough space to insert?
-  if (size_ + 1 + extra_words -
-          (update ? (DskLeafEntry(*it).extraWords() + 1) : 0) <=
-      kMaxLeafWords) {
+  auto old_size = update ? node_->entryWords(pos) : 0;
+  if (size_ + 1 + extra_words - old_size <= maxLeafWords(node_->nodeSize())) {
 
-    // make space
     if (update) {
-      auto old_size = destroyValue(it);
-      int diff = 1 + extra_words - old_size;
-      node_->shift(it + old_size, diff);
-      size_ += diff;
-    } else {
-      node_->shift(it, 1 + extra_words);
-      size_ += 1 + extra_words;
+      destroyValue(pos);
+      node_->erase(pos, pos + 1);
     }
 
-    // put the first word
-    *it = DskLeafEntry{ key, type }.word();
-
-    // put extra words
     // recurse into inserting remotely stored elements if needed
-    it++;
-    if (type == ValueType::object) {
-      auto& obj = boost::get<model::STuple>(val);
-      auto el = std::make_unique<ObjectW>(ta_);
-      for (auto& c : *obj) {
-        el->insert(ta_.key(c.first), c.second, Overwrite::Insert);
-      }
-      *it = el->addr().value;
-      auto emp = linked_.emplace(key, std::move(el));
-      Expects(emp.second);
-
-    } else if (type == ValueType::array) {
-      auto& arr = boost::get<model::SCollection>(val);
-      auto el = std::make_unique<ArrayW>(ta_);
-
-      Key idx{ 0 };
-      for (auto& c : *arr) {
-        if (c.get().type() != typeid(model::Missing)) {
-          el->insert(idx, c, Overwrite::Insert);
-        }
-        idx.value++;
-      }
-
-      *it = el->addr().value;
-      auto emp = linked_.emplace(key, std::move(el));
-      Expects(emp.second);
-
-    } else if (type == ValueType::string) {
-      auto& str = boost::get<model::String>(val);
-      auto el = std::make_unique<StringW>(ta_, str);
-      *it = el->addr().value;
+    std::vector<uint64_t> extras;
+    if (isRemote(type)) {
+      auto el = writeRemote(ta_, val);
+      extras.push_back(el->addr().value);
       auto emp = linked_.emplace(key, std::move(el));
       Expects(emp.second);
-
     } else {
-      auto extras = extraWords(val);
-      std::copy(extras.begin(), extras.end(), it);
+      extras = extraWords(val);
     }
 
+    node_->insert(pos, key, type, extras);
+    size_ += 1 + extra_words - old_size;
+    if (!update && parent_ != nullptr) parent_->addCount(key, 1);
+
   } else {
     split(key, val);
   }
@@ -206,25 +269,25 @@ bool AbsLeafW::insert(Key key, const model::Value& val, Overwrite ow,
   return true;
 }
 
-template <typename It>
-void AbsLeafW::appendWords(It from, It to) {
+void AbsLeafW::appendEntries(const LeafView& other, size_t from, size_t to) {
   init();
-  Expects(from <= to);
-  Expects(size_ + std::distance(from, to) <= kMaxLeafWords);
-
-  std::copy(from, to, node_->begin() + size_);
-  size_ += std::distance(from, to);
+  node_->insert(node_->count(), other, from, to);
+  size_ = node_->usedWords();
 }
 
-template <typename It>
-void AbsLeafW::prependWords(It from, It to) {
+void AbsLeafW::prependEntries(const LeafView& other, size_t from, size_t to) {
   init();
-  Expects(from <= to);
-  Expects(size_ + std::distance(from, to) <= kMaxLeafWords);
+  node_->insert(0, other, from, to);
+  size_ = node_->usedWords();
+}
 
-  node_->shift(node_->begin(), std::distance(from, to));
-  std::copy(from, to, node_->begin());
-  size_ += std::distance(from, to);
+void AbsLeafW::appendEntry(Key key, uint8_t type,
+                           gsl::span<const uint64_t> extras) {
+  init();
+  Expects(node_->count() == 0 || node_->key(node_->count() - 1) < key);
+  Expects(size_ + 1 + extras.size() <= maxLeafWords(node_->nodeSize()));
+  node_->insert(node_->count(), key, type, extras);
+  size_ += 1 + static_cast<size_t>(extras.size());
 }
 
 bool AbsLeafW::remove(Key key, AbsInternalW* parent) {
@@ -232,76 +295,91 @@ bool AbsLeafW::remove(Key key, AbsInternalW* parent) {
   init();
 
   // find position
-  auto it = node_->search(key);
+  auto pos = node_->search(key);
 
   // return false if not found
-  if (it == node_->end() || keyFromWord(*it) != key) return false;
+  if (pos == node_->count() || node_->key(pos) != key) return false;
 
-  auto val_size = destroyValue(it);
-  node_->shift(it + val_size, -gsl::narrow_cast<int>(val_size));
-  size_ -= val_size;
+  size_ -= destroyValue(pos);
+  node_->erase(pos, pos + 1);
+  if (parent_ != nullptr) parent_->addCount(key, -1);
 
-  if (size_ < kMinLeafWords) balance();
+  if (size_ < minLeafWords(node_->nodeSize())) balance();
 
   return true;
 }
 
 void AbsLeafW::init() {
   if (!node_) {
-    node_ = std::make_unique<DskLeafNode>();
-    auto block = ta_.loadBlock<kBlockSize>(addr_);
-    std::copy(block->begin(), block->end(),
-              gsl::as_writeable_bytes(gsl::span<DskLeafNode>(node_.get(), 1))
-                  .begin());
-    size_ = node_->findSize();
+    auto block = loadNode(ta_, addr_);
+    auto view = leafView(*block, node_);
+    if (!node_) node_ = std::make_unique<LeafNode>(view);
+    size_ = node_->usedWords();
   }
 }
 
 size_t AbsLeafW::size() const { return size_; }
 
+uint64_t AbsLeafW::count() {
+  init();
+  return node_->count();
+}
+
+size_t AbsLeafW::nodeSize() {
+  init();
+  return node_->nodeSize();
+}
+
+void AbsLeafW::setNext(Addr next) {
+  init();
+  node_->hdr().setNext(next);
+}
+
 std::unique_ptr<LeafW> AbsLeafW::splitHelper(Key key, const model::Value& val) {
   init();
-  Expects(size_ > kMinLeafWords && size_ <= kMaxLeafWords);
+  auto node_size = node_->nodeSize();
+  Expects(size_ > minLeafWords(node_size) && size_ <= maxLeafWords(node_size));
 
-  auto right_leaf =
-      std::make_unique<LeafW>(AllocateNew(), ta_, node_->hdr.next());
+  auto right_leaf = std::make_unique<LeafW>(AllocateNew(), ta_, node_size,
+                                            node_->hdr().next());
 
+  // find the first entry moved to the right leaf
   auto new_val_len = nrExtraWords(valueType(val)) + 1;
-  auto top = node_->begin() + size_;
-  auto it = node_->begin();
-  auto half = it + (size_ + new_val_len) / 2;
-  Ensures(half < node_->end());
+  auto half = (size_ + new_val_len) / 2;
+  size_t pos = 0;
+  size_t words = 0;
 
   bool new_here = false;
-  while (it < half) {
-    if (!new_here && key < keyFromWord(*it)) {
+  while (words < half) {
+    if (!new_here && key < node_->key(pos)) {
       new_here = true;
       half -= new_val_len;
     } else {
-      it += entrySize(*it);
+      words += node_->entryWords(pos++);
     }
   }
+  Ensures(pos < node_->count());
 
-  node_->hdr.fromAddr(right_leaf->addr());
-  right_leaf->appendWords(it, top);
+  node_->hdr().setNext(right_leaf->addr());
+  right_leaf->appendEntries(*node_, pos, node_->count());
   {
-    auto linked_from = linked_.lower_bound(keyFromWord(*it));
+    auto linked_from = linked_.lower_bound(node_->key(pos));
     for (auto it = linked_from; it < linked_.end(); ++it) {
       right_leaf->linked_.emplace(std::move(*it));
     }
     linked_.erase(linked_from, linked_.end());
   }
-  std::fill(it, top, 0);
-  size_ = std::distance(node_->begin(), it);
+  node_->erase(pos, node_->count());
+  size_ = words;
 
   if (new_here)
     insert(key, val, Overwrite::Upsert, parent_);
   else
     right_leaf->insert(key, val, Overwrite::Upsert, parent_);
 
-  Ensures(size_ >= kMinLeafWords && size_ <= kMaxLeafWords);
-  Ensures(right_leaf->size() >= kMinLeafWords &&
-          right_leaf->size() <= kMaxLeafWords);
+  Ensures(size_ >= minLeafWords(node_size) && size_ <= maxLeafWords(node_size));
+  Ensures(right_leaf->size() >= minLeafWords(node_size) &&
+          right_leaf->size() <= maxLeafWords(node_size));
 
   return right_leaf;
 }
@@ -311,37 +389,39 @@ std::unique_ptr<LeafW> AbsLeafW::splitHelper(Key key, const model::Value& val) {
 
 void LeafW::split(Key key, const model::Value& val) {
   auto right = splitHelper(key, val);
-  auto sep_key = keyFromWord(*right->node_->begin());
+  auto sep_key = right->node_->key(0);
   parent_->insert(sep_key, std::move(right));
 }
 
 void LeafW::merge(LeafW& right) {
-  appendWords(right.node_->begin(), right.node_->begin() + right.size());
+  appendEntries(*right.node_, 0, right.node_->count());
 
   for (auto& l : right.linked_) {
     linked_.emplace(std::move(l));
   }
   right.linked_.clear();
-  node_->hdr.fromAddr(right.node_->hdr.next());
-  ta_.free(right.addr(), kBlockSize);
-  parent_->removeMerged(
-      parent_->searchEntry(keyFromWord(*right.node_->begin())));
+  node_->hdr().setNext(right.node_->hdr().next());
+  ta_.free(right.addr(), right.node_->nodeSize());
+  parent_->recount(addr_);
+  parent_->removeMerged(parent_->searchEntry(right.node_->key(0)));
 }
 
 void LeafW::balance() {
   Expects(node_);
-  Expects(size_ < kMinLeafWords);
+  auto node_size = node_->nodeSize();
+  Expects(size_ < minLeafWords(node_size));
   Expects(size_ > 1); // even if merging, the node should not be empty
 
-  auto first_key = keyFromWord(*node_->begin());
+  auto first_key = node_->key(0);
   auto& sibl = dynamic_cast<LeafW&>(parent_->getSibling(first_key));
   sibl.init();
   sibl.parent_ = parent_;
-  Expects(sibl.size() <= kMaxLeafWords && sibl.size() >= kMinLeafWords);
+  Expects(sibl.size() <= maxLeafWords(node_size) &&
+          sibl.size() >= minLeafWords(node_size));
 
-  auto sibl_key = keyFromWord(*sibl.node_->begin());
+  auto sibl_key = sibl.node_->key(0);
 
-  if (sibl.size() + size_ <= kMaxLeafWords) {
+  if (sibl.size() + size_ <= maxLeafWords(node_size)) {
     // actually merge them
 
     if (sibl_key > first_key) {
@@ -353,43 +433,45 @@ void LeafW::balance() {
   } else {
     // too big, just steal some values
     auto medium = (size_ + sibl.size()) / 2;
-    Ensures(medium >= kMinLeafWords);
+    Ensures(medium >= minLeafWords(node_size));
 
     if (sibl_key > first_key) {
       // pull lowest
-      auto it = sibl.node_->begin();
-      auto sibl_beg = sibl.node_->begin();
-      while (size_ + std::distance(sibl_beg, it) < medium) {
-        auto entry = DskLeafEntry(*it);
-        tryTransfer(sibl.linked_, linked_, entry.key.key());
-        it += entry.extraWords() + 1;
+      size_t pos = 0;
+      size_t moved = 0;
+      while (size_ + moved < medium) {
+        tryTransfer(sibl.linked_, linked_, sibl.node_->key(pos));
+        moved += sibl.node_->entryWords(pos++);
       }
-      appendWords(sibl_beg, it);
-      sibl.node_->shift(it, -std::distance(sibl_beg, it));
-      sibl.size_ -= std::distance(sibl_beg, it);
+      appendEntries(*sibl.node_, 0, pos);
+      sibl.node_->erase(0, pos);
+      sibl.size_ -= moved;
 
-      Ensures(sibl_key < keyFromWord(*sibl_beg));
-      parent_->updateMerged(sibl_key, keyFromWord(*sibl_beg));
+      Ensures(sibl_key < sibl.node_->key(0));
+      parent_->updateMerged(sibl_key, sibl.node_->key(0));
 
     } else {
       // pull biggest
-      auto it = sibl.node_->begin();
-      auto sibl_top = sibl.node_->begin() + sibl.size();
-      while (size_ + std::distance(it, sibl_top) > medium) {
-        auto entry = DskLeafEntry(*it);
-        tryTransfer(sibl.linked_, linked_, entry.key.key());
-        it += entry.extraWords() + 1;
+      auto count = sibl.node_->count();
+      auto pos = count;
+      size_t moved = 0;
+      while (size_ + moved < medium) {
+        --pos;
+        tryTransfer(sibl.linked_, linked_, sibl.node_->key(pos));
+        moved += sibl.node_->entryWords(pos);
       }
-      prependWords(it, sibl_top);
-      sibl.node_->shift(sibl_top, -std::distance(it, sibl_top));
-      sibl.size_ -= std::distance(it, sibl_top);
+      prependEntries(*sibl.node_, pos, count);
+      sibl.node_->erase(pos, count);
+      sibl.size_ -= moved;
 
-      Ensures(sibl_key < keyFromWord(*node_->begin()));
-      parent_->updateMerged(first_key, keyFromWord(*node_->begin()));
+      Ensures(sibl_key < node_->key(0));
+      parent_->updateMerged(first_key, node_->key(0));
     }
 
-    Ensures(size_ >= kMinLeafWords);
-    Ensures(sibl.size() >= kMinLeafWords);
+    Ensures(size_ >= minLeafWords(node_size));
+    Ensures(sibl.size() >= minLeafWords(node_size));
+    parent_->recount(addr_);
+    parent_->recount(sibl.addr());
   }
 }
 
@@ -399,7 +481,11 @@ void LeafW::balance() {
 RootLeafW::~RootLeafW() {}
 
 RootLeafW::RootLeafW(Transaction& ta, BtreeWritable& parent)
-    : AbsLeafW(AllocateNew(), ta), tree_(parent) {}
+    : AbsLeafW(AllocateNew(), ta, ta.nodeSize()), tree_(parent) {}
+
+RootLeafW::RootLeafW(Transaction& ta, size_t node_size, Addr addr,
+                     BtreeWritable& parent)
+    : AbsLeafW(ta, node_size, addr, Addr(0)), tree_(parent) {}
 
 RootLeafW::RootLeafW(Transaction& ta, Addr addr, BtreeWritable& parent)
     : AbsLeafW(ta, addr), tree_(parent) {}
@@ -409,7 +495,7 @@ RootLeafW::RootLeafW(LeafW&& o, Addr a, BtreeWritable& parent)
   node_ = std::move(o.node_);
   linked_ = std::move(o.linked_);
   size_ = o.size();
-  ta_.free(o.addr_, kBlockSize);
+  ta_.free(o.addr_, node_->nodeSize());
 }
 
 void RootLeafW::split(Key key, const model::Value& val) {
@@ -417,7 +503,7 @@ void RootLeafW::split(Key key, const model::Value& val) {
   auto left =
       std::make_unique<LeafW>(AllocateNew(), std::move(*this), right->addr());
 
-  auto sep_key = keyFromWord(*right->node_->begin());
+  auto sep_key = right->node_->key(0);
   auto new_me = std::unique_ptr<RootInternalW>(new RootInternalW(
       ta_, addr_, std::move(left), sep_key, std::move(right), tree_));
   tree_.root_ = std::move(new_me);
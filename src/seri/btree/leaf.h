@@ -8,14 +8,28 @@
 #include "btree.h"
 #include "common.h"
 #include <boost/container/flat_map.hpp>
+#include <boost/optional.hpp>
 
 namespace cheesebase {
 namespace disk {
 namespace btree {
 
-constexpr size_t kLeafEntryMaxWords = 4; // hdr + 24 byte inline string
-constexpr size_t kMaxLeafWords = (kBlockSize - 8) / 8;
-constexpr size_t kMinLeafWords = kMaxLeafWords / 2 - kLeafEntryMaxWords;
+constexpr size_t kLeafEntryMaxWords = 4; // slot + 24 byte inline string
+
+// Words after the header of a leaf of node_size bytes.
+constexpr size_t leafWords(size_t node_size) { return node_size / 8 - 1; }
+constexpr size_t maxLeafWords(size_t node_size) { return leafWords(node_size); }
+constexpr size_t minLeafWords(size_t node_size) {
+  return maxLeafWords(node_size) / 2 - kLeafEntryMaxWords;
+}
+
+// slot offsets and the slot count are stored in a byte
+static_assert(leafWords(k_max_node_size) <= 0xff, "Leaf nodes to big");
+
+// Leafs start with a magic byte. Leafs written before version 2 are a plain
+// stream of entries, current leafs have a sorted slot directory.
+constexpr uint8_t kLeafMagicStream = 'L';
+constexpr uint8_t kLeafMagicSlotted = 'S';
 
 CB_PACKED(struct DskValueHdr {
   uint8_t magic_byte;
@@ -23,93 +37,162 @@ CB_PACKED(struct DskValueHdr {
 });
 static_assert(sizeof(DskValueHdr) == 2, "Invalid disk value header size");
 
+// Entry of a leaf in the stream format, followed by its extra words. Only
+// read to migrate old leafs.
 CB_PACKED(struct DskLeafEntry {
   DskLeafEntry(uint64_t w) {
     *reinterpret_cast<uint64_t*>(this) = w;
     if (value.magic_byte != '!')
       throw ConsistencyError("No magic byte in value");
   }
-  DskLeafEntry(Key k, ValueType t) : value{ '!', t }, key{ k } {}
 
   size_t extraWords() const { return nrExtraWords(value.type); }
-  uint64_t word() { return *reinterpret_cast<uint64_t*>(this); }
 
   DskValueHdr value;
   DskKey key;
 });
 static_assert(sizeof(DskLeafEntry) == 8, "Invalid DskLeafEntry size");
 
-inline Key keyFromWord(uint64_t w) { return DskLeafEntry(w).key.key(); }
-inline size_t entrySize(uint64_t e) { return DskLeafEntry(e).extraWords() + 1; }
+// Entry of the slot directory. The key is stored in the upper 48 bits, so
+// slots compare like their keys when read as words.
+CB_PACKED(struct DskLeafSlot {
+  DskLeafSlot(uint64_t w) { *reinterpret_cast<uint64_t*>(this) = w; }
+  DskLeafSlot(Key k, uint8_t t, uint8_t o) : offset{ o }, type{ t }, key{ k } {}
 
+  size_t extraWords() const { return nrExtraWords(type); }
+  uint64_t word() const { return *reinterpret_cast<const uint64_t*>(this); }
+
+  uint8_t offset; // index of the first extra word
+  uint8_t type;
+  DskKey key;
+});
+static_assert(sizeof(DskLeafSlot) == 8, "Invalid DskLeafSlot size");
+
+inline uint64_t slotKey(uint64_t w) noexcept { return w >> 16; }
+
+// Magic byte, number of slots and address of the next leaf. Nodes are aligned
+// to at least k_min_node_size, the lowest byte of the address holds the node
+// size class instead.
 CB_PACKED(struct DskLeafHdr {
-  DskLeafHdr() = default;
+  static constexpr uint64_t kNextMask = lowerBitmask(48) & ~lowerBitmask(8);
 
-  DskLeafHdr& fromAddr(Addr d) {
-    Expects((d.value & (static_cast<uint64_t>(0xff) << 56)) == 0);
-    constexpr uint64_t magic = static_cast<uint64_t>('L') << 56;
-    data = d.value + magic;
-    return *this;
+  void setNext(Addr d) {
+    Expects((d.value & ~kNextMask) == 0);
+    data = (data & ~kNextMask) + d.value;
   }
 
-  DskLeafHdr& fromDsk(uint64_t w) {
-    data = w;
-    if (!hasMagic()) throw ConsistencyError("No magic byte in leaf node");
-    return *this;
+  void setCount(size_t c) {
+    Expects(c <= 0xff);
+    data = (static_cast<uint64_t>(kLeafMagicSlotted) << 56) +
+           (static_cast<uint64_t>(c) << 48) + (data & lowerBitmask(48));
   }
 
-  bool hasMagic() const { return (data >> 56) == 'L'; }
-  Addr next() const { return Addr(data & lowerBitmask(56)); }
+  void setNodeSize(size_t size) {
+    data = (data & ~lowerBitmask(8)) + classOfNodeSize(size);
+  }
+
+  uint8_t magic() const { return static_cast<uint8_t>(data >> 56); }
+  bool hasMagic() const {
+    return magic() == kLeafMagicSlotted || magic() == kLeafMagicStream;
+  }
+  bool isSlotted() const { return magic() == kLeafMagicSlotted; }
+
+  Addr next() const {
+    return Addr(data & (isSlotted() ? kNextMask : lowerBitmask(56)));
+  }
+
+  size_t nodeSize() const {
+    return isSlotted() ? nodeSizeOfClass(data & lowerBitmask(8))
+                       : k_min_node_size;
+  }
+
+  size_t count() const { return static_cast<size_t>((data >> 48) & 0xff); }
 
   uint64_t data;
 });
 static_assert(sizeof(DskLeafHdr) == 8, "Invalid DskLeafHdr size");
 
-CB_PACKED(struct DskLeafNode {
-  DskLeafNode() = default;
+// Read only view of a leaf. Slots are sorted by key and fill the words from
+// the front, the extra words of the entries fill them from the back.
+class LeafView {
+public:
+  LeafView(const uint64_t* data, size_t node_size)
+      : data_{ data }, nr_words_{ leafWords(node_size) } {}
 
-  DskLeafHdr hdr;
-  std::array<uint64_t, (kBlockSize - ssizeof<DskLeafHdr>()) / 8> words;
+  const DskLeafHdr& hdr() const {
+    return *reinterpret_cast<const DskLeafHdr*>(data_);
+  }
+  const uint64_t* words() const { return data_ + 1; }
+  size_t nodeSize() const { return (nr_words_ + 1) * 8; }
+  size_t nrWords() const { return nr_words_; }
 
-  using iterator = decltype(words)::iterator;
-  using const_iterator = decltype(words)::const_iterator;
+  size_t count() const;
+  DskLeafSlot slot(size_t i) const { return DskLeafSlot(words()[i]); }
+  Key key(size_t i) const { return Key(slotKey(words()[i])); }
+  size_t entryWords(size_t i) const { return slot(i).extraWords() + 1; }
 
-  size_t findSize() const {
-    auto it = words.begin();
-    while (it < words.end() && *it != 0) {
-      it += entrySize(*it);
-    }
-    return std::distance(words.begin(), it);
-  }
+  // Extra words of entry i.
+  gsl::span<const uint64_t> extras(size_t i) const;
 
-  auto begin() noexcept { return words.begin(); }
-  auto end() noexcept { return words.end(); }
+  // Index of the first slot with a key not less than key (binary search).
+  size_t search(Key key) const;
 
-  auto search(Key key) {
-    auto it = words.begin();
-    while ((it < words.end()) && (*it != 0) && (keyFromWord(*it) < key)) {
-      it += entrySize(*it);
-    }
-    return it;
-  }
+  // Number of words used by slots and extra words.
+  size_t usedWords() const;
 
-  void shift(iterator it, std::ptrdiff_t amount) {
-    if (amount >= 0) {
-      std::copy_backward(it, end() - amount, end());
-    } else {
-      std::copy(it, end(), it + amount);
-      std::fill(end() + amount, end(), 0);
-    }
+  // The whole node.
+  gsl::span<const Byte> bytes() const {
+    return gsl::as_bytes(gsl::span<const uint64_t>(
+        data_, static_cast<std::ptrdiff_t>(nr_words_ + 1)));
   }
-});
-static_assert(ssizeof<DskLeafNode>() == kBlockSize, "Invalid DskLeafNode size");
+
+protected:
+  const uint64_t* data_;
+  size_t nr_words_;
+};
+
+// Leaf owning its memory, modified by writers.
+class LeafNode : public LeafView {
+public:
+  // Empty leaf.
+  explicit LeafNode(size_t node_size);
+
+  // Copy of a leaf in the current format.
+  explicit LeafNode(const LeafView& other);
+
+  using LeafView::hdr;
+  DskLeafHdr& hdr() { return *reinterpret_cast<DskLeafHdr*>(buf_.get()); }
+
+  // Insert an entry in front of slot pos. The caller checks for free space.
+  void insert(size_t pos, Key key, uint8_t type,
+              gsl::span<const uint64_t> extras);
+
+  // Copy entries [from, to) of other in front of slot pos.
+  void insert(size_t pos, const LeafView& other, size_t from, size_t to);
+
+  // Remove entries [from, to).
+  void erase(size_t from, size_t to);
+
+private:
+  LeafNode(std::unique_ptr<uint64_t[]> buf, size_t node_size);
+  uint64_t* mutableWords() { return buf_.get() + 1; }
+
+  std::unique_ptr<uint64_t[]> buf_;
+};
+
+// View a leaf in the current format. Leafs in the stream format are converted
+// into a copy owned by tmp.
+LeafView leafView(gsl::span<const Byte> block, std::unique_ptr<LeafNode>& tmp);
 
 class LeafW;
 
 class AbsLeafW : public NodeW {
 public:
   AbsLeafW(AllocateNew, AbsLeafW&& o, Addr next);
-  AbsLeafW(AllocateNew, Transaction& ta, Addr next = Addr(0));
+  AbsLeafW(AllocateNew, Transaction& ta, size_t node_size,
+           Addr next = Addr(0));
+  // empty leaf in the already allocated block at addr
+  AbsLeafW(Transaction& ta, size_t node_size, Addr addr, Addr next);
   AbsLeafW(Transaction& ta, Addr addr);
 
   // serialize and insert value, may trigger split
@@ -119,10 +202,16 @@ public:
   // find maximum key and insert value as key+1
   Key append(const model::Value&, AbsInternalW* parent) override;
 
-  template <typename It>
-  void appendWords(It from, It to);
-  template <typename It>
-  void prependWords(It from, It to);
+  // append like above if the value fits without a split, the leaf has to be
+  // the rightmost one
+  boost::optional<Key> appendInPlace(const model::Value&);
+
+  // copy entries [from, to) of other to the end or the front of this leaf
+  void appendEntries(const LeafView& other, size_t from, size_t to);
+  void prependEntries(const LeafView& other, size_t from, size_t to);
+
+  // add an entry in its stored form behind the last one, it has to fit
+  void appendEntry(Key key, uint8_t type, gsl::span<const uint64_t> extras);
 
   bool remove(Key key, AbsInternalW* parent) override;
 
@@ -130,22 +219,29 @@ public:
 
   void destroy() override;
 
+  uint64_t count() override;
+
   boost::container::flat_map<Key, std::unique_ptr<ValueW>> linked_;
 
   size_t size() const;
 
+  // size of the node on disk in bytes, loads the node if needed
+  size_t nodeSize();
+
+  // link the leaf to the one following it, used when building a tree
+  void setNext(Addr next);
+
 protected:
   void init();
 
   Transaction& ta_;
-  std::unique_ptr<DskLeafNode> node_;
+  std::unique_ptr<LeafNode> node_;
   size_t size_{ 0 };
   std::unique_ptr<LeafW> splitHelper(Key, const model::Value&);
   virtual void split(Key, const model::Value&) = 0;
   virtual void balance() = 0;
-  // Destroy value at pos (if remote). Return size of the entry.
-  template <typename ConstIt>
-  size_t destroyValue(ConstIt it);
+  // Destroy value of entry i (if remote). Return size of the entry.
+  size_t destroyValue(size_t i);
   AbsInternalW* parent_;
 };
 
@@ -164,9 +260,12 @@ private:
 // tree just a single leaf
 class RootLeafW : public AbsLeafW {
   friend class RootInternalW;
+  friend class BtreeWritable;
 
 public:
   RootLeafW(Transaction& ta, BtreeWritable& tree);
+  RootLeafW(Transaction& ta, size_t node_size, Addr addr,
+            BtreeWritable& tree);
   RootLeafW(Transaction& ta, Addr addr, BtreeWritable& tree);
   virtual ~RootLeafW();
 
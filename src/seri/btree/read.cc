@@ -10,115 +10,138 @@
 namespace cheesebase {
 namespace disk {
 namespace btree {
-namespace NodeR {
-namespace {
+// Follows a scan of the leaf chain through the internal nodes above it, to
+// know the leafs the scan reaches next before it reads them. Keeps up to
+// k_readahead_leafs of them prefetched.
+class LeafReadahead {
+public:
+  // Descends to the leftmost leaf of the tree at root.
+  LeafReadahead(Database& db, Addr root) : db_{ db } {
+    descend(root, nullptr);
+  }
 
-template <typename ConstIt>
-std::pair<Key, model::Value> readValue(Database& db, ConstIt& it) {
-  auto entry = DskLeafEntry(*it++);
-  std::pair<Key, model::Value> ret;
-  ret.first = entry.key.key();
-
-  if (entry.value.type & 0b10000000) {
-    // short string
-    size_t size = (entry.value.type & 0b00111111);
-    std::string str;
-    str.reserve(size);
-    uint64_t word = 0;
-    for (size_t i = 0; i < size; ++i) {
-      if (i % 8 == 0) word = *it++;
-      str.push_back(static_cast<char>(word));
-      word >>= 8;
-    }
-    ret.second = std::move(str);
-  } else {
-    switch (entry.value.type) {
-    case ValueType::object:
-      ret.second = model::Tuple(std::make_unique<ObjectR>(db, Addr(*it++)));
-      break;
-    case ValueType::array:
-      ret.second = model::Collection(std::make_unique<ArrayR>(db, Addr(*it++)));
-      break;
-    case ValueType::number:
-      union {
-        uint64_t word;
-        model::Number number;
-      } num;
-      num.word = *it++;
-      ret.second = num.number;
-      break;
-    case ValueType::string:
-      ret.second = StringR(db, Addr(*it++)).getValue();
-      break;
-    case ValueType::boolean_true:
-      ret.second = model::Bool{ true };
-      break;
-    case ValueType::boolean_false:
-      ret.second = model::Bool{ false };
-      break;
-    case ValueType::null:
-      ret.second = model::Null{};
-      break;
-    default:
-      throw ConsistencyError("Unknown value type");
-    }
+  // Descends to the leaf of the tree at root that would hold key, the scan
+  // starts there.
+  LeafReadahead(Database& db, Addr root, Key key) : db_{ db } {
+    descend(root, &key);
   }
 
-  return ret;
-}
+  Addr firstLeaf() const noexcept { return first_; }
 
-const DskLeafNode& leafView(ReadRef<kBlockSize>& block) {
-  return bytesAsType<DskLeafNode>(*block);
-}
+  // Called before the scan reads the next leaf.
+  void advance() {
+    if (ahead_ > 0) --ahead_;
+    if (ahead_ <= k_readahead_leafs / 2) fill();
+  }
 
-Addr getAllInLeaf(Database& db, ReadRef<kBlockSize>& block, model::Tuple& obj) {
-  auto node = leafView(block);
-  auto it = node.begin();
-  auto next = node.hdr.next();
+private:
+  void descend(Addr addr, const Key* key) {
+    for (;;) {
+      auto block = loadNode(db_, addr);
+      if (isNodeLeaf(*block)) break;
+      InternalView node(*block);
+      levels_.emplace_back();
+      auto& children = levels_.back();
+      pushChildren(node, children);
+      // skip the children left of the one holding key
+      if (key) children.resize(children.size() - node.upperBound(*key));
+      addr = children.back();
+      children.pop_back();
+    }
+    first_ = addr;
+  }
+
+  // children of node, in reverse order so the next one is at the back
+  static void pushChildren(const InternalView& node, std::vector<Addr>& out) {
+    out.clear();
+    for (size_t i = node.size(); i > 0; --i) out.push_back(node.addr(i - 1));
+    out.push_back(node.first());
+  }
 
-  while (it != node.end() && *it != 0) {
-    auto pair = readValue(db, it);
-    obj.emplace(db.resolveKey(pair.first), std::move(pair.second));
+  void fill() {
+    std::vector<PageNr> pages;
+    try {
+      while (!levels_.empty() && ahead_ < k_readahead_leafs) {
+        auto& leafs = levels_.back();
+        if (leafs.empty()) {
+          if (!refill(levels_.size() - 1)) levels_.clear();
+          continue;
+        }
+        pages.push_back(leafs.back().pageNr());
+        leafs.pop_back();
+        ++ahead_;
+      }
+    } catch (const ConsistencyError&) {
+      // the tree changed behind the scan, readahead is only a hint anyway
+      levels_.clear();
+    }
+    if (!pages.empty()) db_.prefetch(std::move(pages));
+  }
+
+  // load the next node of level from the level above, false if there is none
+  bool refill(size_t level) {
+    if (level == 0) return false;
+    auto& parents = levels_[level - 1];
+    if (parents.empty() && !refill(level - 1)) return false;
+
+    auto addr = parents.back();
+    parents.pop_back();
+    auto block = loadNode(db_, addr);
+    pushChildren(InternalView(*block), levels_[level]);
+    return true;
   }
 
-  return next;
+  Database& db_;
+  Addr first_;
+  // per level of internal nodes the children not visited yet, the last level
+  // holds leafs
+  std::vector<std::vector<Addr>> levels_;
+  size_t ahead_{ 0 };
+};
+
+namespace NodeR {
+namespace {
+
+model::Value readValue(Database& db, const LeafView& node, size_t i) {
+  return readStored(db, node.slot(i).type, node.extras(i).data());
 }
 
-Addr getAllInLeaf(Database& db, ReadRef<kBlockSize>& block, ArrayMap& arr) {
-  auto node = leafView(block);
-  auto it = node.begin();
-  auto next = node.hdr.next();
+Addr getAllInLeaf(Database& db, NodeRef& block, model::Tuple& obj) {
+  std::unique_ptr<LeafNode> tmp;
+  auto node = leafView(*block, tmp);
 
-  while (it < node.end() && *it != 0) {
-    auto pair = readValue(db, it);
-    arr.emplace(pair.first.value, std::move(pair.second));
-  }
+  for (size_t i = 0; i < node.count(); ++i)
+    obj.emplace(db.resolveKey(node.key(i)), readValue(db, node, i));
 
-  return next;
+  return node.hdr().next();
 }
 
-const DskInternalNode& internalView(ReadRef<kBlockSize>& block) {
-  auto& n = bytesAsType<DskInternalNode>(*block);
-  n.hdr.check();
-  return n;
+Addr getAllInLeaf(Database& db, NodeRef& block, ArrayMap& arr) {
+  std::unique_ptr<LeafNode> tmp;
+  auto node = leafView(*block, tmp);
+
+  for (size_t i = 0; i < node.count(); ++i)
+    arr.emplace(node.key(i).value, readValue(db, node, i));
+
+  return node.hdr().next();
 }
 
 template <class Val, class Obj, class Arr, class Ta>
 std::unique_ptr<Val> getChildCollection(Ta& ta, Addr addr, Key key) {
-  auto block = ta.template loadBlock<kBlockSize>(addr);
+  auto block = loadNode(ta, addr);
 
-  if (isNodeLeaf(block)) {
-    auto node = leafView(block);
-    auto it = node.search(key);
+  if (isNodeLeaf(*block)) {
+    std::unique_ptr<LeafNode> tmp;
+    auto node = leafView(*block, tmp);
+    auto pos = node.search(key);
 
-    if (std::next(it) >= node.end() || *it == 0) return nullptr;
-    auto entry = DskLeafEntry(*it);
-    if (entry.key.key() != key) return nullptr;
-    Addr child_addr{ *std::next(it) };
+    if (pos == node.count() || node.key(pos) != key) return nullptr;
+    auto t = node.slot(pos).type;
+    if (t != ValueType::object && t != ValueType::array) return nullptr;
+    Addr child_addr{ node.extras(pos)[0] };
 
     block.free();
 
-    auto t = entry.value.type;
     if (t == ValueType::object) {
       return std::make_unique<Obj>(ta, child_addr);
     } else if (t == ValueType::array) {
@@ -128,8 +151,7 @@ std::unique_ptr<Val> getChildCollection(Ta& ta, Addr addr, Key key) {
     }
 
   } else {
-    auto node = internalView(block);
-    auto child_addr = node.searchAddr(key);
+    auto child_addr = InternalView(*block).searchAddr(key);
     block.free();
     return getChildCollection<Val, Obj, Arr>(ta, child_addr, key);
   }
@@ -139,20 +161,13 @@ std::unique_ptr<Val> getChildCollection(Ta& ta, Addr addr, Key key) {
 
 template <class C>
 void getAll(Database& db, Addr addr, C& obj) {
-  auto block = db.loadBlock<kBlockSize>(addr);
-
-  if (isNodeLeaf(block)) {
-    auto next = getAllInLeaf(db, block, obj);
-    block.free();
-    while (!next.isNull()) {
-      auto next_block = db.loadBlock<kBlockSize>(next);
-      next = getAllInLeaf(db, next_block, obj);
-    }
+  LeafReadahead readahead{ db, addr };
 
-  } else {
-    auto leftmost = internalView(block).first;
-    block.free();
-    getAll(db, leftmost, obj);
+  auto next = readahead.firstLeaf();
+  while (!next.isNull()) {
+    readahead.advance();
+    auto block = loadNode(db, next);
+    next = getAllInLeaf(db, block, obj);
   }
 }
 
@@ -160,22 +175,96 @@ void getAll(Database& db, Addr addr, C& obj) {
 template void getAll<model::Tuple>(Database& db, Addr addr, model::Tuple& obj);
 template void getAll<ArrayMap>(Database& db, Addr addr, ArrayMap& obj);
 
+uint64_t count(Database& db, Addr addr) {
+  {
+    auto block = loadNode(db, addr);
+    if (!isNodeLeaf(*block)) {
+      InternalView node(*block);
+      if (node.counted()) return node.total();
+    }
+  }
+
+  uint64_t count = 0;
+  LeafReadahead readahead{ db, addr };
+  auto next = readahead.firstLeaf();
+  while (!next.isNull()) {
+    readahead.advance();
+    auto block = loadNode(db, next);
+    std::unique_ptr<LeafNode> tmp;
+    auto node = leafView(*block, tmp);
+    count += node.count();
+    next = node.hdr().next();
+  }
+  return count;
+}
+
+boost::optional<std::pair<Key, model::Value>> nth(Database& db, Addr addr,
+                                                  uint64_t n) {
+  auto block = loadNode(db, addr);
+  while (!isNodeLeaf(*block)) {
+    InternalView node(*block);
+    if (!node.counted()) {
+      // walk the leafs of trees written before version 6
+      block.free();
+      LeafReadahead readahead{ db, addr };
+      addr = readahead.firstLeaf();
+      for (;;) {
+        if (addr.isNull()) return boost::none;
+        readahead.advance();
+        block = loadNode(db, addr);
+        std::unique_ptr<LeafNode> tmp;
+        auto leaf = leafView(*block, tmp);
+        if (n < leaf.count())
+          return std::make_pair(leaf.key(n), readValue(db, leaf, n));
+        n -= leaf.count();
+        addr = leaf.hdr().next();
+      }
+    }
+
+    size_t i = 0;
+    for (; i < node.size() && n >= node.count(i); ++i) n -= node.count(i);
+    if (n >= node.count(i)) return boost::none;
+    addr = node.child(i);
+    block.free();
+    block = loadNode(db, addr);
+  }
+
+  std::unique_ptr<LeafNode> tmp;
+  auto leaf = leafView(*block, tmp);
+  if (n >= leaf.count()) return boost::none;
+  return std::make_pair(leaf.key(n), readValue(db, leaf, n));
+}
+
+boost::optional<Key> lastKey(Database& db, Addr addr) {
+  auto block = loadNode(db, addr);
+  while (!isNodeLeaf(*block)) {
+    InternalView node(*block);
+    addr = node.child(node.size());
+    block.free();
+    block = loadNode(db, addr);
+  }
+
+  std::unique_ptr<LeafNode> tmp;
+  auto leaf = leafView(*block, tmp);
+  if (leaf.count() == 0) return boost::none;
+  return leaf.key(leaf.count() - 1);
+}
+
 model::Value getChildValue(Database& db, Addr addr, Key key) {
-  auto block = db.loadBlock<kBlockSize>(addr);
+  auto block = loadNode(db, addr);
 
-  if (isNodeLeaf(block)) {
-    auto node = leafView(block);
-    auto it = node.search(key);
+  if (isNodeLeaf(*block)) {
+    std::unique_ptr<LeafNode> tmp;
+    auto node = leafView(*block, tmp);
+    auto pos = node.search(key);
 
-    if (it >= node.end() || *it == 0) return model::Missing{};
-    if (DskLeafEntry(*it).key.key() != key) return model::Missing{};
+    if (pos == node.count() || node.key(pos) != key) return model::Missing{};
 
     // TODO: should free block here, but readValue needs it and may recurse
-    return readValue(db, it).second;
+    return readValue(db, node, pos);
 
   } else {
-    auto node = internalView(block);
-    auto child_addr = node.searchAddr(key);
+    auto child_addr = InternalView(*block).searchAddr(key);
     block.free();
     return getChildValue(db, child_addr, key);
   }
@@ -191,6 +280,68 @@ std::unique_ptr<ValueR> getChildCollectionR(Database& db, Addr addr, Key key) {
 }
 
 } // namespace NodeR
+
+////////////////////////////////////////////////////////////////////////////////
+// Cursor
+
+Cursor::Cursor(Database& db, Addr root)
+    : db_{ db }
+    , root_{ root }
+    , readahead_{ std::make_unique<LeafReadahead>(db, root) } {
+  load(readahead_->firstLeaf());
+  skipEmpty();
+}
+
+Cursor::Cursor(Cursor&&) = default;
+Cursor::~Cursor() = default;
+
+Key Cursor::key() const {
+  Expects(valid());
+  return leaf_->key(pos_);
+}
+
+model::Value Cursor::value() const {
+  Expects(valid());
+  return readStored(db_, leaf_->slot(pos_).type, leaf_->extras(pos_).data());
+}
+
+void Cursor::next() {
+  Expects(valid());
+  ++pos_;
+  skipEmpty();
+}
+
+void Cursor::seek(Key key) {
+  // most seeks stay in the current leaf
+  if (valid() && leaf_->key(0) <= key &&
+      key <= leaf_->key(leaf_->count() - 1)) {
+    pos_ = leaf_->search(key);
+    return;
+  }
+
+  leaf_.reset();
+  readahead_ = std::make_unique<LeafReadahead>(db_, root_, key);
+  load(readahead_->firstLeaf());
+  if (valid()) pos_ = leaf_->search(key);
+  skipEmpty();
+}
+
+void Cursor::load(Addr addr) {
+  leaf_.reset();
+  pos_ = 0;
+  if (addr.isNull()) return;
+
+  readahead_->advance();
+  auto block = loadNode(db_, addr);
+  std::unique_ptr<LeafNode> tmp;
+  auto view = leafView(*block, tmp);
+  leaf_ = tmp ? std::move(tmp) : std::make_unique<LeafNode>(view);
+}
+
+void Cursor::skipEmpty() {
+  while (valid() && pos_ == leaf_->count()) load(leaf_->hdr().next());
+}
+
 } // namespace btree
 } // namespace disk
 } // namespace cheesebase
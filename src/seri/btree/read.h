@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "../../model/model.h"
+#include <boost/optional.hpp>
 
 namespace cheesebase {
 class Database;
@@ -19,10 +20,60 @@ namespace NodeR {
 template <class C>
 void getAll(Database& db, Addr addr, C& obj);
 model::Value getChildValue(Database& db, Addr addr, Key key);
+
+// Number of entries of the tree at addr. Counted trees read their root, others
+// the slots of all leafs.
+uint64_t count(Database& db, Addr addr);
+
+// Entry n in key order, none if the tree is smaller.
+boost::optional<std::pair<Key, model::Value>> nth(Database& db, Addr addr,
+                                                  uint64_t n);
+
+// Greatest key of the tree, none if empty.
+boost::optional<Key> lastKey(Database& db, Addr addr);
 std::unique_ptr<ValueW> getChildCollectionW(Transaction& ta, Addr addr, Key);
 std::unique_ptr<ValueR> getChildCollectionR(Database& db, Addr addr, Key key);
 
 } // namespace NodeR
+
+class LeafNode;
+class LeafReadahead;
+
+// Forward cursor over the entries of a tree in key order. The leaf of the
+// current entry is copied, no page stays locked between calls. Memory use does
+// not depend on the size of the tree. The tree must not change while the
+// cursor is used, readers hold a lock on the value for that.
+class Cursor {
+public:
+  // Positioned at the first entry.
+  Cursor(Database& db, Addr root);
+  Cursor(Cursor&&);
+  ~Cursor();
+
+  // False after the last entry.
+  bool valid() const noexcept { return leaf_ != nullptr; }
+
+  Key key() const;
+  model::Value value() const;
+  void next();
+
+  // Move to the first entry with a key not less than key, in either
+  // direction.
+  void seek(Key key);
+
+private:
+  // copy the leaf at addr, release the leaf if addr is null
+  void load(Addr addr);
+  // move on to the next leaf while at the end of the current one
+  void skipEmpty();
+
+  Database& db_;
+  Addr root_;
+  std::unique_ptr<LeafReadahead> readahead_;
+  std::unique_ptr<LeafNode> leaf_;
+  size_t pos_{ 0 };
+};
+
 } // namespace btree
 } // namespace disk
 } // namespace cheesebase
@@ -0,0 +1,565 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "dense.h"
+
+#include "../core.h"
+#include "array.h"
+#include "model.h"
+#include "object.h"
+#include "string.h"
+#include <algorithm>
+
+namespace cheesebase {
+namespace disk {
+namespace dense {
+
+namespace {
+
+struct Slot {
+  uint8_t type;
+  uint64_t word;
+};
+
+const uint64_t* wordsOf(gsl::span<const Byte> block) {
+  return reinterpret_cast<const uint64_t*>(block.data());
+}
+
+// Slot of element index of the array at root, none past the end.
+template <class Db>
+boost::optional<Slot> readSlot(Db& db, Addr root, uint64_t index) {
+  auto head = db.template loadBlock<k_min_node_size>(root);
+  auto hdr = bytesAsType<DskDenseHdr>(*head);
+  hdr.check(kRootMagic);
+  if (index >= hdr.size()) return boost::none;
+
+  // nodes are aligned to their size, so the root is part of the same page
+  auto data = wordsOf(*head);
+  if (hdr.depth() == 0) {
+    SlotLayout layout{ hdr.nodeSize() / 8 };
+    return Slot{ layout.type(data, index), data[layout.valueWord(index)] };
+  }
+
+  auto below = elementsBelow(hdr.depth());
+  Addr addr{ data[1 + index / below] };
+  index %= below;
+  head.free();
+
+  for (auto level = hdr.depth(); level > 1; --level) {
+    auto page = db.template loadBlock<k_page_size>(addr);
+    bytesAsType<DskDenseHdr>(*page).check(kPageMagic);
+    below /= kDirectoryAddrs;
+    addr = Addr(wordsOf(*page)[1 + index / below]);
+    index %= below;
+  }
+
+  auto page = db.template loadBlock<k_page_size>(addr);
+  bytesAsType<DskDenseHdr>(*page).check(kPageMagic);
+  SlotLayout layout{ kPageWords };
+  data = wordsOf(*page);
+  return Slot{ layout.type(data, index), data[layout.valueWord(index)] };
+}
+
+// Type of val in a slot. Strings longer than a word are stored in blocks of
+// their own, even those a leaf keeps in its extra words.
+uint8_t slotType(const model::Value& val) {
+  auto type = valueType(val);
+  return nrExtraWords(type) > 1 ? ValueType::string : type;
+}
+
+void putSlot(const SlotLayout& layout, std::vector<uint64_t>& words, size_t i,
+             uint8_t type, uint64_t word) {
+  auto shift = layout.typeShift(i);
+  auto& types = words[layout.typeWord(i)];
+  types = (types & ~(lowerBitmask(8) << shift)) +
+          (static_cast<uint64_t>(type) << shift);
+  words[layout.valueWord(i)] = word;
+}
+
+} // anonymous namespace
+
+uint64_t elementsBelow(size_t depth) {
+  Expects(depth >= 1);
+  uint64_t below = kSegmentSlots;
+  for (size_t level = 1; level < depth; ++level) below *= kDirectoryAddrs;
+  return below;
+}
+
+bool isDense(gsl::span<const Byte> block) {
+  return bytesAsType<DskDenseHdr>(block).magic() == kRootMagic;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DenseWritable
+
+DenseWritable::DenseWritable(Transaction& ta)
+    : ta_{ ta }
+    , root_{ ta.alloc(ta.nodeSize()).addr,
+             std::vector<uint64_t>(ta.nodeSize() / 8, 0), true, {} }
+    , root_layout_{ ta.nodeSize() / 8 } {
+  storeHeader();
+}
+
+DenseWritable::DenseWritable(Transaction& ta, Addr root)
+    : ta_{ ta }, root_{ root, {}, false, {} }, root_layout_{ 0 } {
+  auto head = ta.loadBlock<k_min_node_size>(root);
+  auto hdr = bytesAsType<DskDenseHdr>(*head);
+  hdr.check(kRootMagic);
+  auto data = wordsOf(*head);
+  root_.words.assign(data, data + hdr.nodeSize() / 8);
+  root_layout_ = SlotLayout{ root_.words.size() };
+  depth_ = hdr.depth();
+  size_ = hdr.size();
+}
+
+bool DenseWritable::fits(const model::Value& val) {
+  return valueType(val) != ValueType::missing;
+}
+
+bool DenseWritable::fits(const btree::BulkEntries& entries) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].first.value != i || !fits(*entries[i].second)) return false;
+  }
+  return true;
+}
+
+bool DenseWritable::insert(uint64_t index, const model::Value& val,
+                           Overwrite ow) {
+  Expects(index <= size_ && fits(val));
+  auto update = index < size_;
+  if ((ow == Overwrite::Update && !update) ||
+      (ow == Overwrite::Insert && update)) {
+    return false;
+  }
+
+  if (update) {
+    destroyValue(index);
+  } else {
+    if (size_ == capacity()) deepen();
+    ++size_;
+    storeHeader();
+  }
+
+  auto type = slotType(val);
+  uint64_t word = 0;
+  if (isRemote(type)) {
+    std::unique_ptr<ValueW> el;
+    if (type == ValueType::string)
+      el = std::make_unique<StringW>(ta_, boost::get<model::String>(val));
+    else
+      el = writeRemote(ta_, val);
+    word = el->addr().value;
+    linked_.emplace(index, std::move(el));
+  } else {
+    auto extras = extraWords(val);
+    if (!extras.empty()) word = extras.front();
+  }
+  setSlot(index, type, word);
+  return true;
+}
+
+Key DenseWritable::append(const model::Value& val) {
+  Key key{ size_ };
+  if (valueType(val) != ValueType::missing)
+    insert(size_, val, Overwrite::Insert);
+  return key;
+}
+
+bool DenseWritable::remove(uint64_t index) {
+  Expects(index + 1 >= size_);
+  if (index >= size_) return false;
+
+  destroyValue(index);
+  setSlot(index, 0, 0);
+  --size_;
+  freeEmpty();
+  storeHeader();
+  return true;
+}
+
+void DenseWritable::destroy() {
+  for (uint64_t i = 0; i < size_; ++i) destroyValue(i);
+  freeAll();
+  ta_.free(root_.addr, nodeSize());
+  root_.fresh = false;
+  root_.dirty.clear();
+}
+
+Writes DenseWritable::getWrites() const {
+  Writes w;
+  auto add = [&w](const Block& block) {
+    if (block.fresh) {
+      w.push_back({ block.addr,
+                    gsl::as_bytes(gsl::span<const uint64_t>(block.words)) });
+    } else {
+      for (auto i : block.dirty)
+        w.push_back({ Addr(block.addr.value + 8 * i), block.words[i] });
+    }
+  };
+
+  add(root_);
+  for (auto& p : pages_) add(p.second);
+  for (auto& l : linked_) {
+    auto lw = l.second->getWrites();
+    std::move(lw.begin(), lw.end(), std::back_inserter(w));
+  }
+  return w;
+}
+
+btree::RawEntries DenseWritable::toEntries() {
+  btree::RawEntries entries;
+  entries.reserve(size_);
+  for (uint64_t i = 0; i < size_; ++i) {
+    auto s = slot(i, false);
+    auto& layout = layoutOf(*s.first);
+    btree::RawEntry e{ Key(i), layout.type(s.first->words.data(), s.second),
+                       s.first->words[layout.valueWord(s.second)], nullptr };
+    auto lookup = linked_.find(i);
+    if (lookup != linked_.end()) e.linked = std::move(lookup->second);
+    entries.push_back(std::move(e));
+  }
+
+  linked_.clear();
+  freeAll();
+  root_.fresh = false;
+  root_.dirty.clear();
+  return entries;
+}
+
+uint64_t DenseWritable::capacity() const {
+  if (depth_ == 0) return root_layout_.slots;
+  return (root_.words.size() - 1) * elementsBelow(depth_);
+}
+
+const SlotLayout& DenseWritable::layoutOf(const Block& block) const {
+  return &block == &root_ ? root_layout_ : segment_layout_;
+}
+
+DenseWritable::Block& DenseWritable::page(Addr addr) {
+  auto lookup = pages_.find(addr);
+  if (lookup != pages_.end()) return lookup->second;
+
+  auto ref = ta_.loadBlock<k_page_size>(addr);
+  bytesAsType<DskDenseHdr>(*ref).check(kPageMagic);
+  auto data = wordsOf(*ref);
+  return pages_
+      .emplace_hint(lookup, addr,
+                    Block{ addr,
+                           std::vector<uint64_t>(data, data + kPageWords),
+                           false,
+                           {} })
+      ->second;
+}
+
+Addr DenseWritable::newPage(size_t level) {
+  auto addr = ta_.alloc(k_page_size).addr;
+  Block block{ addr, std::vector<uint64_t>(kPageWords, 0), true, {} };
+  block.words[0] = DskDenseHdr::page(level).data;
+  pages_.emplace(addr, std::move(block));
+  return addr;
+}
+
+void DenseWritable::freePages(Addr addr, size_t level) {
+  if (level > 1) {
+    auto& block = page(addr);
+    for (size_t w = 1; w < kPageWords; ++w) {
+      if (block.words[w] != 0) freePages(Addr(block.words[w]), level - 1);
+    }
+  }
+  pages_.erase(addr);
+  ta_.free(addr, k_page_size);
+}
+
+void DenseWritable::freeAll() {
+  if (depth_ > 0) {
+    for (size_t w = 1; w < root_.words.size(); ++w) {
+      if (root_.words[w] != 0) freePages(Addr(root_.words[w]), depth_);
+    }
+  }
+  Ensures(pages_.empty());
+  depth_ = 0;
+  size_ = 0;
+}
+
+std::pair<DenseWritable::Block*, size_t> DenseWritable::slot(uint64_t index,
+                                                             bool create) {
+  if (depth_ == 0) return { &root_, index };
+
+  auto below = elementsBelow(depth_);
+  auto block = &root_;
+  for (auto level = depth_;; --level) {
+    auto pos = 1 + index / below;
+    index %= below;
+
+    Addr addr{ block->words[pos] };
+    if (addr.isNull()) {
+      if (!create) throw ConsistencyError("Missing page of dense array");
+      addr = newPage(level);
+      block->set(pos, addr.value);
+    }
+    block = &page(addr);
+    if (level == 1) return { block, index };
+    below /= kDirectoryAddrs;
+  }
+}
+
+void DenseWritable::setSlot(uint64_t index, uint8_t type, uint64_t word) {
+  auto s = slot(index, true);
+  auto& block = *s.first;
+  auto& layout = layoutOf(block);
+  auto type_word = layout.typeWord(s.second);
+  auto value_word = layout.valueWord(s.second);
+  putSlot(layout, block.words, s.second, type, word);
+  if (!block.fresh) {
+    block.dirty.insert(type_word);
+    block.dirty.insert(value_word);
+  }
+}
+
+void DenseWritable::deepen() {
+  auto addr = newPage(depth_ + 1);
+  auto& below = pages_.at(addr);
+
+  if (depth_ == 0) {
+    for (size_t i = 0; i < root_layout_.slots; ++i) {
+      putSlot(segment_layout_, below.words, i,
+              root_layout_.type(root_.words.data(), i),
+              root_.words[root_layout_.valueWord(i)]);
+    }
+  } else {
+    std::copy(root_.words.begin() + 1, root_.words.end(),
+              below.words.begin() + 1);
+  }
+
+  for (size_t w = 1; w < root_.words.size(); ++w) root_.set(w, 0);
+  root_.set(1, addr.value);
+  ++depth_;
+}
+
+void DenseWritable::freeEmpty() {
+  if (depth_ == 0) return;
+
+  // the first page not holding an element anymore and the pages after it
+  auto index = size_;
+  auto below = elementsBelow(depth_);
+  auto block = &root_;
+  for (auto level = depth_; level >= 1; --level) {
+    auto pos = 1 + index / below;
+    index %= below;
+    Addr addr{ block->words[pos] };
+    if (index == 0) {
+      if (!addr.isNull()) {
+        freePages(addr, level);
+        block->set(pos, 0);
+      }
+      break;
+    }
+    if (level == 1) break;
+    block = &page(addr);
+    below /= kDirectoryAddrs;
+  }
+
+  if (size_ == 0) depth_ = 0;
+}
+
+void DenseWritable::destroyValue(uint64_t index) {
+  auto s = slot(index, false);
+  auto& layout = layoutOf(*s.first);
+  auto type = layout.type(s.first->words.data(), s.second);
+  if (!isRemote(type)) return;
+
+  auto lookup = linked_.find(index);
+  if (lookup != linked_.end()) {
+    lookup->second->destroy();
+    linked_.erase(lookup);
+  } else {
+    destroyRemote(ta_, type, Addr(s.first->words[layout.valueWord(s.second)]));
+  }
+}
+
+void DenseWritable::storeHeader() {
+  root_.set(0, DskDenseHdr::root(nodeSize(), depth_, size_).data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DenseReadOnly
+
+DenseReadOnly::DenseReadOnly(Database& db, Addr root) : db_(db), root_(root) {}
+
+uint64_t DenseReadOnly::size() {
+  auto head = db_.loadBlock<k_min_node_size>(root_);
+  auto& hdr = bytesAsType<DskDenseHdr>(*head);
+  hdr.check(kRootMagic);
+  return hdr.size();
+}
+
+model::Collection DenseReadOnly::getArray() {
+  model::Collection_base out;
+  auto head = db_.loadBlock<k_min_node_size>(root_);
+  auto hdr = bytesAsType<DskDenseHdr>(*head);
+  hdr.check(kRootMagic);
+  auto rest = hdr.size();
+  out.reserve(rest);
+
+  auto data = wordsOf(*head);
+  auto words = hdr.nodeSize() / 8;
+  if (hdr.depth() == 0) {
+    SlotLayout layout{ words };
+    for (size_t i = 0; i < rest; ++i) {
+      out.push_back(readStored(db_, layout.type(data, i),
+                               &data[layout.valueWord(i)]));
+    }
+  } else {
+    std::vector<Addr> pages;
+    for (size_t w = 1; w < words; ++w) pages.emplace_back(data[w]);
+    head.free();
+    readPages(pages, hdr.depth(), rest, out);
+  }
+
+  model::Collection val{ std::move(out) };
+  val.has_order_ = true;
+  return val;
+}
+
+void DenseReadOnly::readPages(const std::vector<Addr>& pages, size_t level,
+                              uint64_t& rest, model::Collection_base& out) {
+  for (size_t i = 0; i < pages.size() && rest > 0; ++i) {
+    // segments follow each other, prefetch the next ones in one go
+    if (level == 1 && i % k_readahead_leafs == 0) {
+      std::vector<PageNr> ahead;
+      for (auto j = i; j < std::min(pages.size(), i + k_readahead_leafs) &&
+                       !pages[j].isNull();
+           ++j) {
+        ahead.push_back(pages[j].pageNr());
+      }
+      if (!ahead.empty()) db_.prefetch(std::move(ahead));
+    }
+
+    auto page = db_.loadBlock<k_page_size>(pages[i]);
+    bytesAsType<DskDenseHdr>(*page).check(kPageMagic);
+    auto data = wordsOf(*page);
+
+    if (level == 1) {
+      SlotLayout layout{ kPageWords };
+      auto n = std::min<uint64_t>(rest, kSegmentSlots);
+      for (size_t s = 0; s < n; ++s) {
+        out.push_back(readStored(db_, layout.type(data, s),
+                                 &data[layout.valueWord(s)]));
+      }
+      rest -= n;
+    } else {
+      std::vector<Addr> below;
+      for (size_t w = 1; w < kPageWords; ++w) below.emplace_back(data[w]);
+      page.free();
+      readPages(below, level - 1, rest, out);
+    }
+  }
+}
+
+model::Value DenseReadOnly::getChildValue(uint64_t index) {
+  auto s = readSlot(db_, root_, index);
+  if (!s) return model::Missing{};
+  return readStored(db_, s->type, &s->word);
+}
+
+std::unique_ptr<ValueW> DenseReadOnly::getChildCollectionW(Transaction& ta,
+                                                           uint64_t index) {
+  auto s = readSlot(ta, root_, index);
+  if (!s) return nullptr;
+  if (s->type == ValueType::object)
+    return std::make_unique<ObjectW>(ta, Addr(s->word));
+  if (s->type == ValueType::array)
+    return std::make_unique<ArrayW>(ta, Addr(s->word));
+  return nullptr;
+}
+
+std::unique_ptr<ValueR> DenseReadOnly::getChildCollectionR(uint64_t index) {
+  auto s = readSlot(db_, root_, index);
+  if (!s) return nullptr;
+  if (s->type == ValueType::object)
+    return std::make_unique<ObjectR>(db_, Addr(s->word));
+  if (s->type == ValueType::array)
+    return std::make_unique<ArrayR>(db_, Addr(s->word));
+  return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DenseCursor
+
+DenseCursor::DenseCursor(Database& db, Addr root)
+    : db_{ db }, root_{ root } {
+  auto head = db_.loadBlock<k_min_node_size>(root_);
+  auto hdr = bytesAsType<DskDenseHdr>(*head);
+  hdr.check(kRootMagic);
+  node_words_ = hdr.nodeSize() / 8;
+  depth_ = hdr.depth();
+  size_ = hdr.size();
+  head.free();
+  load();
+}
+
+model::Value DenseCursor::value() const {
+  Expects(valid());
+  auto i = static_cast<size_t>(index_ - first_);
+  return readStored(db_, layout_.type(words_.data(), i),
+                    &words_[layout_.valueWord(i)]);
+}
+
+void DenseCursor::next() {
+  Expects(valid());
+  ++index_;
+  if (index_ - first_ == layout_.slots) load();
+}
+
+void DenseCursor::seek(uint64_t index) {
+  index_ = index;
+  if (words_.empty() || index_ < first_ || index_ - first_ >= layout_.slots)
+    load();
+}
+
+void DenseCursor::load() {
+  words_.clear();
+  if (index_ >= size_) return;
+
+  {
+    auto head = db_.loadBlock<k_min_node_size>(root_);
+    // nodes are aligned to their size, so the root is part of the same page
+    auto data = wordsOf(*head);
+    words_.assign(data, data + node_words_);
+  }
+  layout_ = SlotLayout{ node_words_ };
+  first_ = 0;
+  if (depth_ == 0) return;
+
+  // the pages on the way down pass through words_ as well
+  auto below = elementsBelow(depth_);
+  auto index = index_;
+  for (auto level = depth_; level > 0; --level) {
+    auto pos = 1 + index / below;
+    Addr addr{ words_[pos] };
+    index %= below;
+    below /= kDirectoryAddrs;
+
+    // segments follow each other, prefetch the next ones in one go
+    if (level == 1 && (pos - 1) % k_readahead_leafs == 0) {
+      std::vector<PageNr> ahead;
+      for (auto w = pos; w < std::min(words_.size(), pos + k_readahead_leafs) &&
+                         words_[w] != 0;
+           ++w) {
+        ahead.push_back(Addr(words_[w]).pageNr());
+      }
+      db_.prefetch(std::move(ahead));
+    }
+
+    auto page = db_.loadBlock<k_page_size>(addr);
+    bytesAsType<DskDenseHdr>(*page).check(kPageMagic);
+    auto data = wordsOf(*page);
+    words_.assign(data, data + kPageWords);
+  }
+
+  layout_ = SlotLayout{ kPageWords };
+  first_ = index_ - index;
+}
+
+} // namespace dense
+} // namespace disk
+} // namespace cheesebase
@@ -0,0 +1,229 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Arrays without holes are stored densely: element i is in slot i, found by
+// index arithmetic instead of a search. A slot is a type byte and a word, a
+// leaf entry without its key. Objects, arrays and strings of more than 8 bytes
+// are stored in blocks of their own, like long strings in B-trees. Arrays
+// with holes are stored in B-trees.
+//
+// The root is a block of the size of a B-tree node. While the elements fit,
+// they are kept in the root itself (depth 0). Otherwise the root holds the
+// addresses of pages of the level below. Pages of level 1 are segments of
+// kSegmentSlots slots, pages of higher levels hold kDirectoryAddrs addresses.
+// Reading element i loads the root, the pages of levels above 1 and one
+// segment. Unchanged words are not written again, appending an element writes
+// its slot and the header of the root.
+
+#pragma once
+
+#include "../common.h"
+#include "btree/btree.h"
+#include "btree/common.h"
+#include "value.h"
+#include <boost/container/flat_map.hpp>
+#include <boost/container/flat_set.hpp>
+#include <boost/optional.hpp>
+#include <map>
+
+namespace cheesebase {
+namespace disk {
+namespace dense {
+
+constexpr uint8_t kRootMagic = 'A';
+constexpr uint8_t kPageMagic = 'P';
+
+constexpr size_t kPageWords = k_page_size / 8;
+
+// Slots in a block of words words. After the header word are the type bytes
+// of all slots, 8 per word, then a word per slot.
+constexpr size_t slotsIn(size_t words) { return (words - 1) * 8 / 9; }
+
+constexpr size_t kSegmentSlots = slotsIn(kPageWords);
+constexpr size_t kDirectoryAddrs = kPageWords - 1;
+
+// Elements below an address in a block of depth or level depth.
+uint64_t elementsBelow(size_t depth);
+
+// Root: magic byte, node size class, depth and number of elements. Pages:
+// magic byte and level.
+CB_PACKED(struct DskDenseHdr {
+  static DskDenseHdr root(size_t node_size, size_t depth, uint64_t size) {
+    Expects(size < (static_cast<uint64_t>(1) << 40));
+    return { (static_cast<uint64_t>(kRootMagic) << 56) +
+             (btree::classOfNodeSize(node_size) << 48) +
+             (static_cast<uint64_t>(depth) << 40) + size };
+  }
+
+  static DskDenseHdr page(size_t level) {
+    return { (static_cast<uint64_t>(kPageMagic) << 56) +
+             (static_cast<uint64_t>(level) << 40) };
+  }
+
+  uint8_t magic() const noexcept { return static_cast<uint8_t>(data >> 56); }
+  void check(uint8_t expected) const {
+    if (magic() != expected)
+      throw ConsistencyError("Expected dense array header");
+  }
+
+  size_t nodeSize() const {
+    return btree::nodeSizeOfClass((data >> 48) & lowerBitmask(8));
+  }
+  size_t depth() const noexcept {
+    return static_cast<size_t>((data >> 40) & lowerBitmask(8));
+  }
+  uint64_t size() const noexcept { return data & lowerBitmask(40); }
+
+  uint64_t data;
+});
+static_assert(sizeof(DskDenseHdr) == 8, "Invalid DskDenseHdr size");
+
+// Position of the slots in a block.
+struct SlotLayout {
+  explicit SlotLayout(size_t words)
+      : slots{ slotsIn(words) }, type_words{ (slots + 7) / 8 } {}
+
+  size_t typeWord(size_t i) const noexcept { return 1 + i / 8; }
+  size_t typeShift(size_t i) const noexcept { return i % 8 * 8; }
+  size_t valueWord(size_t i) const noexcept { return 1 + type_words + i; }
+
+  uint8_t type(const uint64_t* block, size_t i) const noexcept {
+    return static_cast<uint8_t>(block[typeWord(i)] >> typeShift(i));
+  }
+
+  size_t slots;
+  size_t type_words;
+};
+
+// True if the root of the array at the start of block is stored densely.
+bool isDense(gsl::span<const Byte> block);
+
+class DenseWritable {
+public:
+  // create new empty array
+  explicit DenseWritable(Transaction& ta);
+  // open existing array
+  DenseWritable(Transaction& ta, Addr root);
+
+  // True if the value is stored in a slot or in blocks referenced by one.
+  static bool fits(const model::Value& val);
+
+  // True if the entries of a new array are stored densely.
+  static bool fits(const btree::BulkEntries& entries);
+
+  Addr addr() const noexcept { return root_.addr; }
+  uint64_t size() const noexcept { return size_; }
+  size_t nodeSize() const noexcept { return root_.words.size() * 8; }
+
+  // Like BtreeWritable, but index may be size() at most and val has to fit.
+  bool insert(uint64_t index, const model::Value& val, Overwrite);
+  Key append(const model::Value& val);
+
+  // Only the last element can be removed.
+  bool remove(uint64_t index);
+
+  void destroy();
+  Writes getWrites() const;
+
+  // All elements in their stored form for a B-tree replacing the array. The
+  // pages are freed, the root is left for the root of the tree.
+  btree::RawEntries toEntries();
+
+private:
+  // Block as modified by the writer. New blocks are written at once, others
+  // only the changed words.
+  struct Block {
+    Addr addr;
+    std::vector<uint64_t> words;
+    bool fresh;
+    boost::container::flat_set<size_t> dirty;
+
+    void set(size_t i, uint64_t word) {
+      words[i] = word;
+      if (!fresh) dirty.insert(i);
+    }
+  };
+
+  uint64_t capacity() const;
+  const SlotLayout& layoutOf(const Block& block) const;
+  Block& page(Addr addr);
+  Addr newPage(size_t level);
+  void freePages(Addr addr, size_t level);
+
+  // Block holding element index and the number of its slot there. Missing
+  // pages are created if create is set.
+  std::pair<Block*, size_t> slot(uint64_t index, bool create);
+  void setSlot(uint64_t index, uint8_t type, uint64_t word);
+
+  // one level more below the root, it is full
+  void deepen();
+  // free the pages after the last element
+  void freeEmpty();
+  // free all pages below the root
+  void freeAll();
+  void destroyValue(uint64_t index);
+  void storeHeader();
+
+  Transaction& ta_;
+  Block root_;
+  SlotLayout root_layout_;
+  SlotLayout segment_layout_{ kPageWords };
+  size_t depth_{ 0 };
+  uint64_t size_{ 0 };
+  std::map<Addr, Block> pages_;
+  boost::container::flat_map<uint64_t, std::unique_ptr<ValueW>> linked_;
+};
+
+class DenseReadOnly {
+public:
+  DenseReadOnly(Database& db, Addr root);
+
+  uint64_t size();
+  model::Collection getArray();
+  model::Value getChildValue(uint64_t index);
+  std::unique_ptr<ValueW> getChildCollectionW(Transaction& ta,
+                                              uint64_t index);
+  std::unique_ptr<ValueR> getChildCollectionR(uint64_t index);
+
+private:
+  // Append the elements below the pages of level to out, until rest is 0.
+  void readPages(const std::vector<Addr>& pages, size_t level, uint64_t& rest,
+                 std::vector<model::Value>& out);
+
+  Database& db_;
+  Addr root_;
+};
+
+// Forward cursor over the elements of a dense array. The block holding the
+// current element is copied, like btree::Cursor does with leafs.
+class DenseCursor {
+public:
+  // Positioned at element 0.
+  DenseCursor(Database& db, Addr root);
+
+  bool valid() const noexcept { return index_ < size_; }
+  uint64_t index() const noexcept { return index_; }
+  model::Value value() const;
+  void next();
+
+  // Move to element index, in either direction.
+  void seek(uint64_t index);
+
+private:
+  // copy the block holding element index_
+  void load();
+
+  Database& db_;
+  Addr root_;
+  size_t node_words_;
+  size_t depth_;
+  uint64_t size_;
+  uint64_t index_{ 0 };
+  // copy of the block and the index of its first slot
+  std::vector<uint64_t> words_;
+  SlotLayout layout_{ kPageWords };
+  uint64_t first_{ 0 };
+};
+
+} // namespace dense
+} // namespace disk
+} // namespace cheesebase
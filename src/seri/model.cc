@@ -0,0 +1,109 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "model.h"
+
+#include "array.h"
+#include "object.h"
+#include "string.h"
+#include <algorithm>
+
+namespace cheesebase {
+namespace disk {
+
+std::unique_ptr<ValueW> writeRemote(Transaction& ta, const model::Value& val) {
+  switch (valueType(val)) {
+  case ValueType::object: {
+    // new objects and arrays are built bottom-up from their sorted entries
+    auto& obj = boost::get<model::STuple>(val);
+    btree::BulkEntries entries;
+    entries.reserve(obj->size());
+    for (auto& c : *obj) entries.emplace_back(ta.key(c.first), &c.second);
+    std::sort(entries.begin(), entries.end(),
+              [](const btree::BulkEntries::value_type& l,
+                 const btree::BulkEntries::value_type& r) {
+                return l.first < r.first;
+              });
+    return std::make_unique<ObjectW>(ta, entries);
+  }
+
+  case ValueType::array: {
+    auto& arr = boost::get<model::SCollection>(val);
+    btree::BulkEntries entries;
+    entries.reserve(arr->size());
+    Key idx{ 0 };
+    for (auto& c : *arr) {
+      entries.emplace_back(idx, &c);
+      idx.value++;
+    }
+    return std::make_unique<ArrayW>(ta, entries);
+  }
+
+  case ValueType::string:
+    return std::make_unique<StringW>(ta, boost::get<model::String>(val));
+
+  default:
+    throw ConsistencyError("Value is not stored remotely");
+  }
+}
+
+bool isRemote(uint8_t type) {
+  return type == ValueType::object || type == ValueType::string ||
+         type == ValueType::array;
+}
+
+void destroyRemote(Transaction& ta, uint8_t type, Addr addr) {
+  switch (type) {
+  case ValueType::object:
+    ObjectW(ta, addr).destroy();
+    break;
+  case ValueType::string:
+    StringW(ta, addr).destroy();
+    break;
+  case ValueType::array:
+    ArrayW(ta, addr).destroy();
+    break;
+  }
+}
+
+model::Value readStored(Database& db, uint8_t type, const uint64_t* extras) {
+  if (type & 0b10000000) {
+    // short string
+    size_t size = (type & 0b00111111);
+    std::string str;
+    str.reserve(size);
+    uint64_t word = 0;
+    for (size_t c = 0; c < size; ++c) {
+      if (c % 8 == 0) word = *extras++;
+      str.push_back(static_cast<char>(word));
+      word >>= 8;
+    }
+    return model::Value(std::move(str));
+  }
+
+  switch (type) {
+  case ValueType::object:
+    return model::Tuple(std::make_unique<ObjectR>(db, Addr(*extras)));
+  case ValueType::array:
+    return model::Collection(std::make_unique<ArrayR>(db, Addr(*extras)));
+  case ValueType::number:
+    union {
+      uint64_t word;
+      model::Number number;
+    } num;
+    num.word = *extras;
+    return model::Value(num.number);
+  case ValueType::string:
+    return StringR(db, Addr(*extras)).getValue();
+  case ValueType::boolean_true:
+    return model::Bool{ true };
+  case ValueType::boolean_false:
+    return model::Bool{ false };
+  case ValueType::null:
+    return model::Null{};
+  default:
+    throw ConsistencyError("Unknown value type");
+  }
+}
+
+} // namespace disk
+} // namespace cheesebase
@@ -6,6 +6,10 @@
 #include "../model/model.h"
 
 namespace cheesebase {
+
+class Transaction;
+class Database;
+
 namespace disk {
 
 constexpr size_t kShortStringMaxLen = 24;
@@ -111,5 +115,20 @@ inline std::vector<uint64_t> extraWords(const model::Value& val) {
   return ret;
 }
 
+class ValueW;
+
+// Store an object, array or long string in blocks of its own. Returns the
+// writer, its address is stored in the node referencing the value.
+std::unique_ptr<ValueW> writeRemote(Transaction& ta, const model::Value& val);
+
+// True if values of the type are stored in blocks of their own.
+bool isRemote(uint8_t type);
+
+// Free the blocks of a value of the type stored at addr.
+void destroyRemote(Transaction& ta, uint8_t type, Addr addr);
+
+// Read a value of the type from its extra words as stored in a node.
+model::Value readStored(Database& db, uint8_t type, const uint64_t* extras);
+
 } // namespace disk
 } // namespace cheesebase
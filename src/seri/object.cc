@@ -1,5 +1,6 @@
 #include "object.h"
 #include "../model/model.h"
+#include "btree/read.h"
 
 namespace cheesebase {
 namespace disk {
@@ -28,5 +29,41 @@ ObjectR::getChildCollectionR(const std::string& key) {
 
 model::Tuple ObjectR::getObject() { return tree_.getObject(); }
 
+uint64_t ObjectR::size() { return tree_.count(); }
+
+std::pair<std::string, model::Value> ObjectR::nth(uint64_t n) {
+  auto member = tree_.nth(n);
+  if (!member) throw IndexOutOfRangeError();
+  return { db_.resolveKey(member->first), std::move(member->second) };
+}
+
+ObjectCursor ObjectR::cursor() { return { db_, addr_ }; }
+
+////////////////////////////////////////////////////////////////////////////////
+// ObjectCursor
+
+ObjectCursor::ObjectCursor(Database& db, Addr addr)
+    : db_{ db }, tree_{ std::make_unique<btree::Cursor>(db, addr) } {}
+
+ObjectCursor::ObjectCursor(ObjectCursor&&) = default;
+ObjectCursor::~ObjectCursor() = default;
+
+bool ObjectCursor::valid() const { return tree_->valid(); }
+
+std::string ObjectCursor::key() const { return db_.resolveKey(tree_->key()); }
+
+model::Value ObjectCursor::value() const { return tree_->value(); }
+
+void ObjectCursor::next() { tree_->next(); }
+
+void ObjectCursor::seek(const std::string& key) {
+  auto k = db_.getKey(key);
+  if (k) return tree_->seek(*k);
+
+  // no object holds a key without id, move past the greatest one
+  tree_->seek(Key(Key::sMaxKey));
+  if (tree_->valid()) tree_->next();
+}
+
 } // namespace disk
 } // namespace cheesebase
@@ -16,6 +16,12 @@ public:
 
   ObjectW(Transaction& ta, Addr addr) : ValueW(ta, addr), tree_{ ta, addr } {}
 
+  // new object holding entries, built at once
+  ObjectW(Transaction& ta, const btree::BulkEntries& entries)
+      : ValueW(ta), tree_{ ta, entries } {
+    addr_ = tree_.addr();
+  }
+
   Writes getWrites() const override { return tree_.getWrites(); }
 
   void destroy() override { return tree_.destroy(); }
@@ -40,6 +46,33 @@ private:
   btree::BtreeWritable tree_;
 };
 
+// Forward cursor over the members of an object in stored order, which is the
+// order of the key ids. See btree::Cursor, it is used while the ObjectR that
+// handed it out exists.
+class ObjectCursor {
+public:
+  ObjectCursor(ObjectCursor&&);
+  ~ObjectCursor();
+
+  // False after the last member.
+  bool valid() const;
+
+  std::string key() const;
+  model::Value value() const;
+  void next();
+
+  // Move to member key or the first one stored after it. At the end if no
+  // object holds key.
+  void seek(const std::string& key);
+
+private:
+  friend class ObjectR;
+  ObjectCursor(Database& db, Addr addr);
+
+  Database& db_;
+  std::unique_ptr<btree::Cursor> tree_;
+};
+
 class ObjectR : public ValueR {
 public:
   ObjectR(Database& db, Addr addr) : ValueR(db, addr), tree_{ db, addr } {}
@@ -51,6 +84,16 @@ public:
   std::unique_ptr<disk::ValueR> getChildCollectionR(const std::string& key);
   model::Tuple getObject();
 
+  // Number of members, without reading them.
+  uint64_t size();
+
+  // Member n in stored order, which is the order of the key ids. Throws
+  // IndexOutOfRangeError if n >= size().
+  std::pair<std::string, model::Value> nth(uint64_t n);
+
+  // Cursor at the first member, reading one leaf at a time.
+  ObjectCursor cursor();
+
 private:
   btree::BtreeReadOnly tree_;
 };
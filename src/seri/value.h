@@ -25,13 +25,12 @@ public:
 
 protected:
   ValueW(Transaction& ta) : addr_{ Addr(0) }, ta_{ ta } {}
-  ValueW(Transaction& ta, Addr addr)
-      : addr_{ addr }, ta_{ ta }, lck_{ ta.getLockW(addr) } {
+  ValueW(Transaction& ta, Addr addr) : addr_{ addr }, ta_{ ta } {
     Expects(addr.value != 0);
+    ta.lockW(addr);
   }
   Addr addr_;
   Transaction& ta_;
-  BlockLockW lck_;
 };
 
 //! Base class representing a read only value on disk.
@@ -1,14 +1,52 @@
 // Licensed under the Apache License 2.0 (see LICENSE file).
 
 #include "storage.h"
+#include "memory_engine.h"
+
+#include <algorithm>
+#include <iostream>
 
 namespace cheesebase {
 
-Storage::Storage(const std::string& filename, OpenMode mode)
-    : cache_(filename, mode, k_default_cache_size / k_page_size) {}
+Storage::Storage(const std::string& filename, OpenMode mode,
+                 const Options& options) {
+  if (options.in_memory) {
+    engine_ = std::make_unique<MemoryEngine>();
+  } else {
+    engine_ = std::make_unique<Cache>(filename, mode,
+                                      options.cache_size / k_page_size,
+                                      options.cache_policy, options.file_access);
+  }
+  if (!engine_->persistent()) return;
+
+  journal_ = std::make_unique<Journal>(filename + ".journal");
+  if (mode == OpenMode::create_new || mode == OpenMode::create_always) {
+    // a left over journal belongs to a previous database
+    journal_->reset();
+  } else {
+    // redo everything that was committed but maybe not written to the file
+    journal_->replay([this](const Writes& w) { apply(w); });
+    checkpoint();
+  }
+}
+
+Storage::~Storage() {
+  // Nothing is lost if the checkpoint fails, the journal stays and is replayed
+  // on the next open. Throwing from a destructor would terminate.
+  try {
+    checkpoint();
+  } catch (const std::exception& e) {
+    std::cerr << "cheesebase: checkpoint on close failed: " << e.what()
+              << '\n';
+  }
+}
 
 PageRef<PageReadView> Storage::loadPage(PageNr page_nr) {
-  return cache_.readPage(page_nr);
+  return engine_->readPage(page_nr);
+}
+
+void Storage::prefetch(std::vector<PageNr> pages) {
+  engine_->prefetch(std::move(pages));
 }
 
 namespace {
@@ -26,28 +64,79 @@ void writeToSpan(const decltype(Write::data)& data, S target) {
 }
 }
 
-void Storage::storeWrite(Write write) {
-  auto p = cache_.writePage(write.addr.pageNr());
-  writeToSpan(write.data, p->subspan(write.addr.pageOffset()));
+void Storage::storeWrite(Write write) { storeWrite(Writes{ write }); }
+
+void Storage::storeWrite(std::vector<Write> transaction,
+                         const CommitHooks& hooks) {
+  {
+    ShLock<RwMutex> lck{ checkpoint_mtx_ };
+    if (failed_) throw DatabaseError("storage failed, reopen the database");
+    uint64_t seq;
+    if (journal_) {
+      seq = journal_->enqueue(transaction);
+    } else {
+      Guard<Mutex> guard{ apply_mtx_ };
+      seq = ++enqueued_seq_;
+    }
+    if (hooks.enqueued) hooks.enqueued();
+    if (journal_) journal_->waitDurable(seq);
+
+    // apply in the order of the journal, overlapping writes of different
+    // transactions end up as they would after a replay
+    ExLock<Mutex> apply_lck{ apply_mtx_ };
+    while (applied_seq_ + 1 != seq) apply_cond_.wait(apply_lck);
+    apply_lck.unlock();
+
+    try {
+      apply(transaction);
+    } catch (...) {
+      // The record is durable but only partly in the cache. Flushing the
+      // cache now and truncating the journal would lose it, keep the journal
+      // to have it replayed on the next open.
+      apply_lck.lock();
+      failed_ = true;
+      applied_seq_ = seq;
+      apply_cond_.notify_all();
+      throw;
+    }
+
+    apply_lck.lock();
+    applied_seq_ = seq;
+    apply_cond_.notify_all();
+  }
+
+  if (journal_ && journal_->size() >= k_journal_checkpoint_size) checkpoint();
 }
 
-void Storage::storeWrite(std::vector<Write> transaction) {
-  // TODO: write to journal here
+void Storage::checkpoint() {
+  if (!journal_) return;
+  ExLock<RwMutex> lck{ checkpoint_mtx_ };
+  if (failed_) throw DatabaseError("storage failed, journal kept for replay");
+  if (journal_->size() == 0) return;
+
+  engine_->flush();
+  journal_->reset();
+}
 
-  // sort the writes to minimize cache requests
-  std::sort(transaction.begin(), transaction.end(),
-            [](const Write& l, const Write& r) {
-              return l.addr.value < r.addr.value;
-            });
+void Storage::apply(const Writes& transaction) {
+  // sort the writes to minimize cache requests, stable to keep the order of
+  // writes to the same address
+  std::vector<const Write*> sorted;
+  sorted.reserve(transaction.size());
+  for (auto& w : transaction) sorted.push_back(&w);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Write* l, const Write* r) {
+                     return l->addr.value < r->addr.value;
+                   });
 
-  auto it = transaction.begin();
-  while (it != transaction.end()) {
-    auto nr = it->addr.pageNr();
-    auto ref = cache_.writePage(nr);
+  auto it = sorted.begin();
+  while (it != sorted.end()) {
+    auto nr = (*it)->addr.pageNr();
+    auto ref = engine_->writePage(nr);
     do {
-      writeToSpan(it->data, ref->subspan(it->addr.pageOffset()));
+      writeToSpan((*it)->data, ref->subspan((*it)->addr.pageOffset()));
       ++it;
-    } while (it != transaction.end() && nr.value == it->addr.pageNr().value);
+    } while (it != sorted.end() && nr.value == (*it)->addr.pageNr().value);
   }
 }
 
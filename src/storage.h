@@ -7,18 +7,33 @@
 
 #include "cache.h"
 #include "common.h"
+#include "journal.h"
+#include "options.h"
+#include "storage_engine.h"
+#include "sync.h"
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
 
 namespace cheesebase {
 
 // Disk representation of a database instance. Opens DB file and journal on
 // construction. Provides load/store access backed by a cache.
+// In-memory databases keep their pages in a MemoryEngine instead and have
+// neither file nor journal.
 class Storage {
 public:
   // Create a Storage associated with a DB and journal file. Opens an existing
   // database or creates a new one bases on "mode" argument.
-  Storage(const std::string& filename, OpenMode mode);
+  // Records left in the journal of an existing database are applied.
+  // With Options::in_memory filename and mode are ignored.
+  Storage(const std::string& filename, OpenMode mode,
+          const Options& options = {});
+
+  // Persists all changes to the DB file and empties the journal.
+  ~Storage();
 
   // Get a DB page. Reads the requested page in the cache (if needed) and
   // returns a PageReadRef object holding a read-locked reference of the page.
@@ -32,16 +47,52 @@ public:
     return { ref->subspan(addr.pageOffset(), S), std::move(ref) };
   }
 
+  // Hint that the pages are loaded soon. Pages not cached yet are read from
+  // disk in the background, adjacent pages with a single request.
+  void prefetch(std::vector<PageNr> pages);
+
   // Write data to the DB. Old data is overwritten and the file extended if
   // needed. The caller has to handle consistency of the database.
   // The write is guaranteed to be all-or-nothing. On return of the function
   // the journal has been written and persistence of the write is guaranteed.
+  // If a journaled write can not be applied to the cache, the Storage refuses
+  // all further writes and checkpoints with DatabaseError. The journal is kept
+  // and restores the write on the next open.
   void storeWrite(Write write);
 
-  void storeWrite(std::vector<Write> transaction);
+  // Optional callbacks into the commit of a transaction.
+  struct CommitHooks {
+    // Called as soon as the position of the transaction in the journal is
+    // fixed, before waiting for it to be written.
+    std::function<void()> enqueued;
+  };
+
+  void storeWrite(std::vector<Write> transaction,
+                  const CommitHooks& hooks = {});
+
+  // Write all changes to the DB file and empty the journal.
+  void checkpoint();
 
 private:
-  Cache cache_;
+  // write data to the cached pages
+  void apply(const Writes& transaction);
+
+  std::unique_ptr<StorageEngine> engine_;
+  std::unique_ptr<Journal> journal_; // not for volatile engines
+
+  // shared by committers, exclusive while checkpointing
+  RwMutex checkpoint_mtx_;
+
+  // journaled transactions are applied in journal order
+  Mutex apply_mtx_;
+  Cond apply_cond_;
+  uint64_t applied_seq_{ 0 };
+  uint64_t enqueued_seq_{ 0 }; // without journal
+
+  // set when a durable transaction could not be applied, the cache then no
+  // longer matches the journal and must not be checkpointed
+  std::atomic<bool> failed_{ false };
+
 };
 
 } // namespace cheesebase
@@ -0,0 +1,79 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Interface of the engines keeping the pages of a Storage.
+
+#pragma once
+
+#include "common.h"
+#include "sync.h"
+
+#include <vector>
+
+namespace cheesebase {
+
+// Locked reference of a page.
+template <class View>
+class PageRef {
+  template <class V>
+  friend class PageRef;
+
+public:
+  PageRef() = default;
+
+  template <class V>
+  PageRef(View view, PageRef<V>&& other)
+      : view_{ view }, lock_{ std::move(other.lock_) } {}
+
+  template <class L>
+  PageRef(View page, L&& lock)
+      : view_{ page }, lock_{ std::forward<L>(lock) } {}
+
+  MOVE_ONLY(PageRef)
+
+  View get() const noexcept {
+    Expects(lock_.owns_lock());
+    return view_;
+  }
+  View operator*() const noexcept {
+    Expects(lock_.owns_lock());
+    return view_;
+  }
+  const View* operator->() const noexcept {
+    Expects(lock_.owns_lock());
+    return &view_;
+  }
+
+  void free() { lock_.unlock(); }
+
+private:
+  View view_;
+  ShLock<RwMutex> lock_;
+};
+
+template <std::ptrdiff_t S>
+using ReadRef = PageRef<gsl::span<const Byte, S>>;
+template <std::ptrdiff_t S>
+using WriteRef = PageRef<gsl::span<Byte, S>>;
+
+// Keeps the pages of a database and hands out locked references to them. The
+// same page may be referenced for reading and writing at the same time, the
+// caller takes care of consistency.
+class StorageEngine {
+public:
+  virtual ~StorageEngine() = default;
+
+  virtual PageRef<PageReadView> readPage(PageNr page_nr) = 0;
+  virtual PageRef<PageWriteView> writePage(PageNr page_nr) = 0;
+
+  // Make all changes durable.
+  virtual void flush() = 0;
+
+  // Hint that the pages are read soon.
+  virtual void prefetch(std::vector<PageNr> pages) = 0;
+
+  // Whether the pages outlive the engine. Changes to volatile engines do not
+  // need to be journaled.
+  virtual bool persistent() const noexcept = 0;
+};
+
+} // namespace cheesebase
@@ -75,24 +75,65 @@ TEST_CASE("allocate and free blocks") {
   auto b7 = t.alloc(t1_block);
   writes = t.commit();
 
+  // frees only take effect on commit, but the transaction reuses its own
+  // freed blocks: b7 takes the place of b3, b1 is free afterwards
+  //
   // layout
   //
   // [~~~~~~~~~~~~~~~~~~~~~~~~~~ reserved ~~~~~~~~~~~~~~~~~~~~~~~~~~]
-  // [  ][b4][      ][::::: b5 :::::][::::: b6 :::::][              ]
+  // [  ][b4][      ][::::: b5 :::::][:::::::::::::: b7 ::::::::::::]
   // [::::::::::::::::::::::::::::: b2 :::::::::::::::::::::::::::::]
-  // [::::::::::::: b7 :::::::::::::][                              ]
+  // [::::: b6 :::::][              ][                              ]
   //
 
   REQUIRE(b5.addr.value == k_page_size + k_page_size / 4);
-  REQUIRE(b6.addr.value == k_page_size + k_page_size / 2);
-  REQUIRE(b7.addr.value == k_page_size * 3);
+  REQUIRE(b6.addr.value == k_page_size * 3);
+  REQUIRE(b7.addr.value == k_page_size + k_page_size / 2);
 
   REQUIRE(contains(writes, t4_addr, k_page_size));
-  REQUIRE(contains(writes, t2_addr,
-                   k_page_size + k_page_size / 2 + k_page_size / 4));
+  REQUIRE(contains(writes, t2_addr, k_page_size * 3 + k_page_size / 4));
   REQUIRE(contains(writes, t1_addr, k_page_size * 3 + k_page_size / 2));
   REQUIRE(contains(writes, eof_addr, k_page_size * 4));
 
   store.storeWrite(writes);
   t.end();
 }
+
+TEST_CASE("concurrent allocation transactions") {
+  DskDatabaseHdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.end_of_file.value = k_page_size;
+  Storage store{ "test.db", OpenMode::create_always };
+  store.storeWrite(
+      Write({ Addr(0), gsl::as_bytes(gsl::span<DskDatabaseHdr>(&hdr, 1)) }));
+
+  Allocator alloc{ hdr, store };
+  auto t1 = alloc.startTransaction();
+  auto t2 = alloc.startTransaction();
+
+  SECTION("do not get the same blocks") {
+    auto b1 = t1.alloc(t3_block);
+    auto b2 = t2.alloc(t3_block);
+    REQUIRE(b1.addr != b2.addr);
+  }
+
+  SECTION("can not reuse blocks freed by uncommitted transactions") {
+    auto b1 = t1.alloc(t2_block);
+    t1.commit();
+    t1.end();
+
+    t1 = alloc.startTransaction();
+    t1.free(b1);
+    REQUIRE(t2.alloc(t2_block).addr != b1.addr);
+
+    store.storeWrite(t1.commit());
+    t1.end();
+    REQUIRE(t2.alloc(t2_block).addr == b1.addr);
+  }
+
+  SECTION("blocks of aborted transactions are reused") {
+    auto b1 = t1.alloc(pg_block);
+    t1.end();
+    REQUIRE(t2.alloc(pg_block).addr == b1.addr);
+  }
+}
@@ -0,0 +1,81 @@
+#include "catch.hpp"
+#include "block_locks.h"
+
+#include <vector>
+
+using namespace cheesebase;
+
+namespace {
+
+// addresses in the same stripe of the lock table
+Addr sameStripe(size_t i) { return Addr(4096 + i * 256 * k_lock_stripes); }
+
+} // anonymous namespace
+
+TEST_CASE("block locks") {
+  BlockLockPool pool;
+
+  SECTION("readers share a block with a writer") {
+    auto w = pool.getLockW(Addr(4096));
+    auto r1 = pool.getLockR(Addr(4096));
+    auto r2 = pool.getLockR(Addr(4096));
+    REQUIRE_FALSE(w.tryExclusive());
+  }
+
+  SECTION("writer gets exclusive when readers are gone") {
+    auto w = pool.getLockW(Addr(4096));
+    { auto r = pool.getLockR(Addr(4096)); }
+    REQUIRE(w.tryExclusive());
+    w.downgrade();
+    auto r = pool.getLockR(Addr(4096));
+    REQUIRE_FALSE(w.tryExclusive());
+  }
+
+  SECTION("blocks in the same stripe are locked independently") {
+    auto w1 = pool.getLockW(sameStripe(0));
+    auto w2 = pool.getLockW(sameStripe(1));
+    auto r = pool.getLockR(sameStripe(2));
+    REQUIRE(w1.tryExclusive());
+    REQUIRE(w2.tryExclusive());
+  }
+
+  SECTION("many blocks can be locked one after another") {
+    for (uint64_t i = 1; i <= 100000; ++i) {
+      auto w = pool.getLockW(Addr(i * 256));
+      REQUIRE(w.tryExclusive());
+    }
+  }
+
+  SECTION("a full stripe takes more entries") {
+    // one transaction can hold more locks than a stripe has entries
+    for (int round = 0; round < 2; ++round) {
+      std::vector<BlockLockW> locks;
+      for (size_t i = 0; i < k_lock_stripe_entries * 4; ++i)
+        locks.push_back(pool.getLockW(sameStripe(i)));
+
+      auto r = pool.getLockR(sameStripe(k_lock_stripe_entries * 2));
+      for (size_t i = 0; i < locks.size(); ++i)
+        REQUIRE(locks[i].tryExclusive() == (i != k_lock_stripe_entries * 2));
+      REQUIRE(pool.overflowEntries() == k_lock_stripe_entries * 3);
+    }
+  }
+
+  SECTION("additional entries are freed when their blocks are unlocked") {
+    {
+      std::vector<BlockLockW> locks;
+      for (size_t i = 0; i < k_lock_stripe_entries * 4; ++i)
+        locks.push_back(pool.getLockW(sameStripe(i)));
+      auto r = pool.getLockR(sameStripe(k_lock_stripe_entries * 3));
+    }
+    REQUIRE(pool.overflowEntries() == 0);
+
+    // a block locked twice keeps its entry until both are gone
+    std::vector<BlockLockR> locks;
+    for (size_t i = 0; i < k_lock_stripe_entries + 1; ++i)
+      locks.push_back(pool.getLockR(sameStripe(i)));
+    auto w = pool.getLockW(sameStripe(k_lock_stripe_entries));
+    locks.pop_back();
+    REQUIRE(pool.overflowEntries() == 1);
+    REQUIRE(w.tryExclusive());
+  }
+}
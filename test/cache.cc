@@ -3,6 +3,18 @@
 #endif
 #include "catch.hpp"
 #include "cache.h"
+#include "exceptions.h"
+#include "lz.h"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace cheesebase;
 
@@ -36,5 +48,482 @@ SCENARIO("CACHE") {
         }
       }
     }
+
+    WHEN("pages in different mapping chunks are written") {
+      const PageNr first{ 3 };
+      const PageNr second{ k_map_chunk_size / k_page_size + 3 };
+      const std::string test1{ "ABCDEFGHIJKLMNOP" };
+      const std::string test2{ "PONMLKJIHGFEDCBA" };
+      auto bytes1 = gsl::as_bytes(gsl::span<const char>(test1));
+      auto bytes2 = gsl::as_bytes(gsl::span<const char>(test2));
+      {
+        auto p1 = cache.writePage(first);
+        auto p2 = cache.writePage(second);
+        std::copy(bytes1.begin(), bytes1.end(), p1->begin());
+        std::copy(bytes2.begin(), bytes2.end(), p2->begin());
+      }
+
+      THEN("both can be read after being evicted") {
+        for (size_t i = 0; i < 20; ++i) cache.readPage(PageNr(i + 10));
+
+        auto p1 = cache.readPage(first);
+        auto p2 = cache.readPage(second);
+        REQUIRE(bytes1 == p1->subspan(0, test1.size()));
+        REQUIRE(bytes2 == p2->subspan(0, test2.size()));
+      }
+    }
+
+    WHEN("more pages than the cache size are held at once") {
+      std::vector<PageRef<PageWriteView>> refs;
+      for (uint64_t i = 0; i < 20; ++i) {
+        refs.push_back(cache.writePage(PageNr(i)));
+        bytesAsType<uint64_t>(*refs.back()) = i;
+      }
+
+      THEN("all of them stay valid") {
+        for (uint64_t i = 0; i < 20; ++i)
+          REQUIRE(bytesAsType<uint64_t>(*refs[i]) == i);
+      }
+
+      AND_WHEN("they are released and other pages are read") {
+        refs.clear();
+        for (uint64_t i = 100; i < 120; ++i) cache.readPage(PageNr(i));
+
+        THEN("the cache shrinks back to its size") {
+          size_t cached = 0;
+          for (uint64_t i = 0; i < 20; ++i) cached += cache.contains(PageNr(i));
+          for (uint64_t i = 100; i < 120; ++i)
+            cached += cache.contains(PageNr(i));
+          REQUIRE(cached <= 8);
+        }
+
+        THEN("the written pages can be read") {
+          for (uint64_t i = 0; i < 20; ++i)
+            REQUIRE(bytesAsType<uint64_t>(*cache.readPage(PageNr(i))) == i);
+        }
+      }
+    }
+
+    WHEN("pages are read from many threads") {
+      for (uint64_t i = 0; i < 32; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+      std::atomic<size_t> errors{ 0 };
+      std::vector<std::thread> threads;
+      for (uint64_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&cache, &errors, t] {
+          for (uint64_t i = 0; i < 1000; ++i) {
+            auto nr = (i * 7 + t) % 32;
+            if (bytesAsType<uint64_t>(*cache.readPage(PageNr(nr))) != nr)
+              ++errors;
+          }
+        });
+      }
+      for (auto& t : threads) t.join();
+
+      THEN("every read sees the right page") { REQUIRE(errors == 0); }
+    }
+  }
+}
+
+SCENARIO("DB file growth") {
+  GIVEN("A cache on a new file") {
+    boost::filesystem::remove("test.db");
+
+    WHEN("pages past the end of the file are written") {
+      {
+        Cache cache{ "test.db", OpenMode::create_new, 8 };
+        for (uint64_t i = 0; i < 100; ++i) {
+          auto p = cache.writePage(PageNr(i));
+          bytesAsType<uint64_t>(*p) = i;
+        }
+
+        THEN("the file is preallocated ahead of the used pages") {
+          REQUIRE(boost::filesystem::file_size("test.db") >=
+                  100 * k_page_size);
+        }
+      }
+
+      THEN("the file is truncated to the used pages when closed") {
+        REQUIRE(boost::filesystem::file_size("test.db") == 100 * k_page_size);
+
+        Cache cache{ "test.db", OpenMode::open_existing, 8 };
+        for (uint64_t i = 0; i < 100; ++i) {
+          REQUIRE(bytesAsType<uint64_t>(*cache.readPage(PageNr(i))) == i);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("Cache replacement policies") {
+  GIVEN("A working set that was evicted once and is used again") {
+    auto run = [](CachePolicy policy) {
+      Cache cache{ "test.db", OpenMode::create_always, 32, policy };
+      for (uint64_t i = 0; i < 8; ++i) cache.readPage(PageNr(i));
+      for (uint64_t i = 100; i < 132; ++i) cache.readPage(PageNr(i));
+      for (uint64_t i = 0; i < 8; ++i) cache.readPage(PageNr(i));
+
+      // a long scan
+      for (uint64_t i = 1000; i < 1400; ++i) cache.readPage(PageNr(i));
+
+      size_t cached = 0;
+      for (uint64_t i = 0; i < 8; ++i) cached += cache.contains(PageNr(i));
+      return cached;
+    };
+
+    THEN("2Q keeps it cached during a scan") {
+      REQUIRE(run(CachePolicy::two_q) == 8);
+    }
+
+    THEN("CLOCK replaces it") { REQUIRE(run(CachePolicy::clock) == 0); }
+  }
+}
+
+SCENARIO("Dirty page tracking") {
+  GIVEN("A cache") {
+    Cache cache{ "test.db", OpenMode::create_always, 100 };
+
+    WHEN("pages are only read") {
+      for (uint64_t i = 0; i < 20; ++i) cache.readPage(PageNr(i));
+
+      THEN("no page is dirty") { REQUIRE(cache.dirtyPages() == 0); }
+    }
+
+    WHEN("pages are written") {
+      for (uint64_t i = 0; i < 5; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+      bytesAsType<uint64_t>(*cache.writePage(PageNr(0))) = 0;
+
+      THEN("each of them is dirty once") { REQUIRE(cache.dirtyPages() == 5); }
+
+      AND_WHEN("the cache is flushed") {
+        cache.flush();
+
+        THEN("all pages are clean") { REQUIRE(cache.dirtyPages() == 0); }
+      }
+    }
+
+    WHEN("more pages than the writeback threshold are written") {
+      for (uint64_t i = 0; i < 50; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+      THEN("the writeback thread cleans them below the threshold") {
+        cache.waitForWriteBack();
+        REQUIRE(cache.dirtyPages() < 10);
+      }
+    }
+  }
+
+  GIVEN("A larger cache") {
+    Cache cache{ "test.db", OpenMode::create_always, 1000 };
+
+    WHEN("most of it is written at once") {
+      size_t max_dirty = 0;
+      for (uint64_t i = 0; i < 900; ++i) {
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+        max_dirty = std::max(max_dirty, cache.dirtyPages());
+      }
+
+      THEN("writers wait for the writeback thread") {
+        REQUIRE(max_dirty <= 300);
+      }
+    }
+  }
+
+  GIVEN("A small cache") {
+    Cache cache{ "test.db", OpenMode::create_always, 8 };
+
+    WHEN("dirty pages are evicted") {
+      for (uint64_t i = 0; i < 40; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+      THEN("only cached pages count as dirty") {
+        REQUIRE(cache.dirtyPages() <= 8);
+      }
+    }
+  }
+}
+
+SCENARIO("Direct file access") {
+  GIVEN("A cache reading and writing with O_DIRECT") {
+    boost::filesystem::remove("test.db");
+
+    WHEN("more pages than the cache size are written") {
+      {
+        Cache cache{ "test.db", OpenMode::create_new, 8, CachePolicy::clock,
+                     FileAccess::direct };
+        for (uint64_t i = 0; i < 100; ++i)
+          bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+        THEN("evicted pages are read back") {
+          for (uint64_t i = 0; i < 100; ++i)
+            REQUIRE(bytesAsType<uint64_t>(*cache.readPage(PageNr(i))) == i);
+        }
+
+        THEN("prefetched pages are cached") {
+          cache.prefetch(PageNr(20), 4);
+          for (uint64_t i = 20; i < 24; ++i) {
+            REQUIRE(cache.contains(PageNr(i)));
+            REQUIRE(bytesAsType<uint64_t>(*cache.readPage(PageNr(i))) == i);
+          }
+        }
+
+        THEN("new pages past the end of the file are empty") {
+          auto p = cache.readPage(PageNr(1000));
+          REQUIRE(std::all_of(p->begin(), p->end(),
+                              [](Byte b) { return b == Byte(0); }));
+        }
+      }
+
+      THEN("the pages are in the file after it was closed") {
+        REQUIRE(boost::filesystem::file_size("test.db") >= 100 * k_page_size);
+
+        Cache cache{ "test.db", OpenMode::open_existing, 8 };
+        for (uint64_t i = 0; i < 100; ++i)
+          REQUIRE(bytesAsType<uint64_t>(*cache.readPage(PageNr(i))) == i);
+      }
+    }
+
+    WHEN("dirty pages exceed the writeback threshold") {
+      Cache cache{ "test.db", OpenMode::create_new, 100, CachePolicy::clock,
+                   FileAccess::direct };
+      for (uint64_t i = 0; i < 50; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+      THEN("the writeback thread writes them in batches") {
+        cache.waitForWriteBack();
+        REQUIRE(cache.dirtyPages() < 10);
+      }
+    }
+    WHEN("the cache is flushed while readers load other pages") {
+      Cache cache{ "test.db", OpenMode::create_new, 256, CachePolicy::clock,
+                   FileAccess::direct };
+      for (uint64_t i = 0; i < 1024; ++i)
+        bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+      cache.flush();
+
+      // readers miss the cache all the time and evict clean frames, the
+      // frames of pages being flushed are clean already
+      std::atomic<bool> done{ false };
+      std::atomic<size_t> errors{ 0 };
+      std::vector<std::thread> readers;
+      for (uint64_t t = 0; t < 4; ++t) {
+        readers.emplace_back([&cache, &done, &errors, t] {
+          for (uint64_t i = t; !done; i += 7) {
+            auto nr = 64 + i % 960;
+            if (bytesAsType<uint64_t>(*cache.readPage(PageNr(nr))) != nr)
+              ++errors;
+          }
+        });
+      }
+      // the file is checked right after each flush, bypassing the cache
+      auto fd = ::open("test.db", O_RDONLY);
+      size_t wrong = 0;
+      for (uint64_t round = 1; round <= 100; ++round) {
+        for (uint64_t i = 0; i < 64; ++i)
+          bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) =
+              i + round * 1000;
+        cache.flush();
+        for (uint64_t i = 0; i < 64; ++i) {
+          uint64_t value = 0;
+          ::pread(fd, &value, sizeof(value),
+                  static_cast<off_t>(PageNr(i).addr()));
+          if (value != i + round * 1000) ++wrong;
+        }
+      }
+      ::close(fd);
+      done = true;
+      for (auto& t : readers) t.join();
+
+      THEN("the flushed pages are written with their own content") {
+        REQUIRE(errors == 0);
+        REQUIRE(wrong == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("IoRing finishes short reads of O_DIRECT files") {
+  boost::filesystem::remove("test.db");
+  {
+    // the file ends inside the second page
+    std::vector<char> content(k_page_size + 100, 'x');
+    auto f = std::fopen("test.db", "wb");
+    std::fwrite(content.data(), 1, content.size(), f);
+    std::fclose(f);
+  }
+  auto fd = ::open("test.db", O_RDONLY | O_DIRECT);
+  REQUIRE(fd >= 0);
+
+  void* memory;
+  REQUIRE(::posix_memalign(&memory, k_page_size, k_page_size * 2) == 0);
+  auto buffer = static_cast<Byte*>(memory);
+  auto check = [&] {
+    REQUIRE(buffer[0] == Byte('x'));
+    REQUIRE(buffer[k_page_size + 99] == Byte('x'));
+    REQUIRE(buffer[k_page_size + 100] == Byte(0));
+    REQUIRE(buffer[k_page_size * 2 - 1] == Byte(0));
+  };
+  std::vector<IoRequest> requests{
+    { IoRequest::Op::read, buffer, k_page_size * 2, 0 }
+  };
+
+  SECTION("through the ring") {
+    std::fill_n(buffer, k_page_size * 2, Byte(0xff));
+    IoRing ring{ 4 };
+    ring.run(fd, requests);
+    check();
+  }
+
+  SECTION("synchronously") {
+    std::fill_n(buffer, k_page_size * 2, Byte(0xff));
+    runIoRequest(fd, requests.front());
+    check();
+  }
+
+  std::free(memory);
+  ::close(fd);
+}
+
+TEST_CASE("LZ compression") {
+  auto roundtrip = [](const std::vector<Byte>& data) {
+    std::vector<Byte> compressed(data.size() + 64);
+    auto size = lzCompress(data, compressed);
+    REQUIRE(size > 0);
+    std::vector<Byte> out(data.size());
+    lzDecompress(gsl::span<const Byte>(compressed).first(
+                     static_cast<std::ptrdiff_t>(size)),
+                 out);
+    REQUIRE(out == data);
+    return size;
+  };
+
+  std::vector<Byte> text;
+  for (int i = 0; text.size() < k_page_size; ++i) {
+    auto s = "{\"name\": \"entry " + std::to_string(i) + "\", \"value\": 1.5}";
+    for (auto c : s) text.push_back(static_cast<Byte>(c));
+  }
+  text.resize(k_page_size);
+  std::vector<Byte> zeros(k_page_size, Byte(0));
+  std::vector<Byte> random(k_page_size);
+  std::minstd_rand rand(42);
+  for (auto& b : random) b = static_cast<Byte>(rand());
+
+  SECTION("repetitive data shrinks") {
+    REQUIRE(roundtrip(text) < k_page_size / 2);
+    REQUIRE(roundtrip(zeros) < 64);
+  }
+
+  SECTION("incompressible data roundtrips") { roundtrip(random); }
+
+  SECTION("short inputs roundtrip") {
+    roundtrip({});
+    roundtrip({ Byte(1), Byte(2), Byte(3) });
+  }
+
+  SECTION("output not fitting is reported") {
+    std::vector<Byte> small(k_page_size / 2);
+    REQUIRE(lzCompress(random, small) == 0);
+  }
+
+  SECTION("corrupted input is detected") {
+    std::vector<Byte> compressed(k_page_size);
+    auto size = lzCompress(text, compressed);
+    std::vector<Byte> out(k_page_size);
+    REQUIRE_THROWS_AS(lzDecompress(gsl::span<const Byte>(compressed).first(
+                                       static_cast<std::ptrdiff_t>(size / 2)),
+                                   out),
+                      ConsistencyError);
+    compressed[0] = Byte(0xff);
+    REQUIRE_THROWS_AS(lzDecompress(gsl::span<const Byte>(compressed).first(
+                                       static_cast<std::ptrdiff_t>(size)),
+                                   out),
+                      ConsistencyError);
+  }
+}
+
+SCENARIO("Compressed file access") {
+  GIVEN("A cache compressing its pages") {
+    boost::filesystem::remove("test.db");
+    const std::string map_file = std::string("test.db") + k_page_map_suffix;
+
+    auto fill = [](Cache& cache, uint64_t pages, uint64_t round) {
+      for (uint64_t i = 0; i < pages; ++i) {
+        auto p = cache.writePage(PageNr(i));
+        std::fill(p->begin(), p->end(), Byte(0));
+        for (size_t j = 0; j < k_page_size / 8; j += 3)
+          bytesAsType<uint64_t>(p->subspan(
+              static_cast<std::ptrdiff_t>(j * 8))) = i + round;
+      }
+    };
+    auto check = [](Cache& cache, uint64_t pages, uint64_t round) {
+      for (uint64_t i = 0; i < pages; ++i) {
+        auto p = cache.readPage(PageNr(i));
+        REQUIRE(bytesAsType<uint64_t>(*p) == i + round);
+        REQUIRE(bytesAsType<uint64_t>(p->subspan(24)) == i + round);
+        REQUIRE(bytesAsType<uint64_t>(p->subspan(8)) == 0);
+      }
+    };
+
+    WHEN("more pages than the cache size are written") {
+      {
+        Cache cache{ "test.db", OpenMode::create_new, 8, CachePolicy::clock,
+                     FileAccess::compressed };
+        fill(cache, 100, 0);
+
+        THEN("evicted pages are decompressed") { check(cache, 100, 0); }
+
+        THEN("pages never written are empty") {
+          auto p = cache.readPage(PageNr(1000));
+          REQUIRE(std::all_of(p->begin(), p->end(),
+                              [](Byte b) { return b == Byte(0); }));
+        }
+      }
+
+      THEN("the file is smaller than the pages") {
+        REQUIRE(boost::filesystem::exists(map_file));
+        REQUIRE(boost::filesystem::file_size("test.db") < 50 * k_page_size);
+
+        Cache cache{ "test.db", OpenMode::open_existing, 8, CachePolicy::clock,
+                     FileAccess::compressed };
+        check(cache, 100, 0);
+      }
+
+      THEN("it can not be opened uncompressed") {
+        REQUIRE_THROWS_AS(Cache("test.db", OpenMode::open_existing, 8),
+                          FileError);
+      }
+
+      AND_WHEN("the pages are rewritten several times") {
+        for (uint64_t round = 1; round <= 4; ++round) {
+          Cache cache{ "test.db", OpenMode::open_existing, 8,
+                       CachePolicy::clock, FileAccess::compressed };
+          fill(cache, 100, round);
+          cache.flush();
+          fill(cache, 100, round);
+        }
+
+        THEN("extents of old pages are reused") {
+          REQUIRE(boost::filesystem::file_size("test.db") < 50 * k_page_size);
+
+          Cache cache{ "test.db", OpenMode::open_existing, 8,
+                       CachePolicy::clock, FileAccess::compressed };
+          check(cache, 100, 4);
+        }
+      }
+    }
+
+    WHEN("the database is created again uncompressed") {
+      {
+        Cache cache{ "test.db", OpenMode::create_new, 8, CachePolicy::clock,
+                     FileAccess::compressed };
+      }
+      Cache cache{ "test.db", OpenMode::create_always, 8 };
+
+      THEN("the page map is removed") {
+        REQUIRE_FALSE(boost::filesystem::exists(map_file));
+      }
+    }
   }
 }
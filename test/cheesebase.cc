@@ -5,6 +5,7 @@
 #include "cheesebase.h"
 #include <iostream>
 #include <boost/filesystem.hpp>
+#include <thread>
 #include <parser.h>
 #include <model/json_print.h>
 
@@ -132,6 +133,21 @@ TEST_CASE("db insert") {
       auto read = cb["test"].get();
       REQUIRE(read == doc);
     }
+    // reopen with a small scan resistant cache
+    {
+      Options options;
+      options.cache_size = k_page_size * 16;
+      options.cache_policy = CachePolicy::two_q;
+      CheeseBase cb{ "test.db", options };
+      REQUIRE(cb["test"].get() == doc);
+    }
+    // reopen bypassing the page cache of the kernel
+    {
+      Options options;
+      options.file_access = FileAccess::direct;
+      CheeseBase cb{ "test.db", options };
+      REQUIRE(cb["test"].get() == doc);
+    }
     // reopen
     {
       CheeseBase cb{ "test.db" };
@@ -148,3 +164,201 @@ TEST_CASE("db insert") {
     }
   }
 }
+
+TEST_CASE("concurrent inserts into different objects") {
+  boost::filesystem::remove("test.db");
+  CheeseBase cb{ "test.db" };
+
+  const size_t threads = 4;
+  const size_t amount = 50;
+  for (size_t t = 0; t < threads; ++t)
+    cb.insert("t" + std::to_string(t), parseJson("{}"));
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&cb, t] {
+      for (size_t i = 0; i < amount; ++i) {
+        cb["t" + std::to_string(t)].insert(
+            "k" + std::to_string(i),
+            parseJson("{\"t\": " + std::to_string(t) + ", \"i\": " +
+                      std::to_string(i) + "}"));
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  for (size_t t = 0; t < threads; ++t) {
+    for (size_t i = 0; i < amount; ++i) {
+      REQUIRE(cb["t" + std::to_string(t)]["k" + std::to_string(i)].get() ==
+              parseJson("{\"t\": " + std::to_string(t) + ", \"i\": " +
+                        std::to_string(i) + "}"));
+    }
+  }
+}
+
+TEST_CASE("in-memory database") {
+  boost::filesystem::remove("memory.db");
+  Options options;
+  options.in_memory = true;
+
+  auto doc = parseJson(R"({"a": [1, 2, {"b": "some longer string value"}],
+                           "c": {"d": null, "e": true}})");
+  {
+    CheeseBase cb{ "memory.db", options };
+    cb.insert("doc", doc);
+
+    const size_t amount = 2000;
+    cb.insert("big", parseJson("{}"));
+    for (size_t i = 0; i < amount; ++i)
+      cb["big"].insert("k" + std::to_string(i), model::Value(double(i)));
+
+    REQUIRE(cb["doc"].get() == doc);
+    REQUIRE(cb["big"]["k1234"].get() == model::Value(1234.0));
+    cb["doc"]["c"].remove();
+    REQUIRE(cb["doc"]["c"].get() == model::Missing{});
+  }
+
+  REQUIRE(!boost::filesystem::exists("memory.db"));
+  REQUIRE(!boost::filesystem::exists("memory.db.journal"));
+
+  // a new in-memory database starts empty
+  CheeseBase cb{ "memory.db", options };
+  REQUIRE(cb["doc"].get() == model::Missing{});
+}
+
+TEST_CASE("compressed database") {
+  boost::filesystem::remove("test.db");
+  Options options;
+  options.file_access = FileAccess::compressed;
+  options.cache_size = k_page_size * 16;
+
+  auto doc = parseJson(R"({"a": [1, 2, {"b": "some longer string value"}],
+                           "c": {"d": null, "e": true}})");
+  const size_t amount = 2000;
+  {
+    CheeseBase cb{ "test.db", options };
+    cb.insert("doc", doc);
+    cb.insert("big", parseJson("{}"));
+    for (size_t i = 0; i < amount; ++i)
+      cb["big"].insert("k" + std::to_string(i), model::Value(double(i)));
+  }
+
+  {
+    CheeseBase cb{ "test.db", options };
+    REQUIRE(cb["doc"].get() == doc);
+    for (size_t i = 0; i < amount; i += 97)
+      REQUIRE(cb["big"]["k" + std::to_string(i)].get() ==
+              model::Value(double(i)));
+  }
+
+  REQUIRE_THROWS_AS(CheeseBase("test.db"), FileError);
+}
+
+TEST_CASE("append and upsert many values at once") {
+  boost::filesystem::remove("test.db");
+  CheeseBase cb{ "test.db" };
+  cb.insert("arr", parseJson("[ \"first\" ]"));
+  cb.insert("obj", parseJson(R"({ "k0": "old", "other": true })"));
+
+  const size_t amount = 3000;
+  std::vector<model::Value> values;
+  std::vector<std::pair<std::string, model::Value>> members;
+  for (size_t i = 0; i < amount; ++i) {
+    values.push_back(parseJson("{ \"i\": " + std::to_string(i) + " }"));
+    members.emplace_back("k" + std::to_string(i), model::Value(double(i)));
+  }
+
+  REQUIRE(cb.appendAll(values, { "arr" }) == 1);
+  REQUIRE(cb["arr"].append(model::Value("last")) == amount + 1);
+  cb.upsertAll(members, { "obj" });
+
+  REQUIRE(cb["arr"][0].get() == model::Value("first"));
+  for (size_t i = 0; i < amount; i += 101) {
+    REQUIRE(cb["arr"][i + 1].get() == values[i]);
+    REQUIRE(cb["obj"]["k" + std::to_string(i)].get() ==
+            model::Value(double(i)));
+  }
+  REQUIRE(cb["obj"]["other"].get() == model::Value(true));
+
+  REQUIRE_THROWS_AS(cb.appendAll(values, { "obj" }), NotFoundError);
+  REQUIRE_THROWS_AS(cb.upsertAll(members, { "arr" }), NotFoundError);
+}
+
+TEST_CASE("write batch") {
+  boost::filesystem::remove("test.db");
+  CheeseBase cb{ "test.db" };
+  cb.insert("obj", parseJson(R"({ "a": 1, "b": 2, "nested": { "x": 1 } })"));
+  cb.insert("arr", parseJson("[ 1, 2 ]"));
+
+  SECTION("mutations are applied in order") {
+    WriteBatch batch;
+    batch.insert("new", parseJson("{ \"c\": 3 }"));
+    batch.update("a", model::Value(10.0), { "obj" });
+    batch.upsert("b", model::Value(20.0), { "obj" });
+    batch.upsert("y", model::Value(2.0), { "obj", "nested" });
+    batch.remove({ "obj", "nested", "x" });
+    batch.append(model::Value(3.0), { "arr" });
+    batch.upsert(0, model::Value("zero"), { "arr" });
+    batch.remove({ "arr", 1 });
+    batch.update("a", model::Value(11.0), { "obj" });
+    REQUIRE(batch.size() == 9);
+    cb.write(batch);
+
+    REQUIRE(cb["new"].get() == parseJson("{ \"c\": 3 }"));
+    REQUIRE(cb["obj"].get() ==
+            parseJson(R"({ "a": 11, "b": 20, "nested": { "y": 2 } })"));
+    REQUIRE(cb["arr"][0].get() == model::Value("zero"));
+    REQUIRE(cb["arr"][1].get() == model::Missing());
+    REQUIRE(cb["arr"][2].get() == model::Value(3.0));
+  }
+
+  SECTION("nothing is written if a mutation fails") {
+    WriteBatch batch;
+    batch.update("a", model::Value(10.0), { "obj" });
+    batch.append(model::Value(3.0), { "arr" });
+    batch.update("missing", model::Value(1.0), { "obj" });
+    REQUIRE_THROWS_AS(cb.write(batch), CRUDError);
+
+    batch.clear();
+    batch.update("a", model::Value(10.0), { "obj" });
+    batch.remove({ "obj", "missing" });
+    REQUIRE_THROWS_AS(cb.write(batch), NotFoundError);
+
+    REQUIRE(cb["obj"]["a"].get() == model::Value(1.0));
+    REQUIRE(cb["arr"].get() == parseJson("[ 1, 2 ]"));
+  }
+
+  SECTION("values changed by the batch are not written into") {
+    WriteBatch batch;
+    batch.insert("new", parseJson("{}"));
+    batch.insert("k", model::Value(1.0), { "new" });
+    REQUIRE_THROWS_AS(cb.write(batch), CRUDError);
+
+    batch.clear();
+    batch.insert("k", model::Value(1.0), { "obj", "nested" });
+    batch.remove({ "obj", "nested" });
+    REQUIRE_THROWS_AS(cb.write(batch), CRUDError);
+
+    REQUIRE(cb["new"].get() == model::Missing());
+    REQUIRE(cb["obj"]["nested"].get() == parseJson("{ \"x\": 1 }"));
+  }
+
+  SECTION("large batches") {
+    const size_t amount = 5000;
+    for (auto round : { 1.0, 2.0 }) {
+      // the second round replaces every document, locking each of them
+      WriteBatch batch;
+      for (size_t i = 0; i < amount; ++i) {
+        batch.upsert("k" + std::to_string(i),
+                     parseJson("{ \"round\": " + std::to_string(round) + " }"),
+                     { "obj" });
+      }
+      cb.write(batch);
+    }
+
+    for (size_t i = 0; i < amount; i += 99) {
+      REQUIRE(cb["obj"]["k" + std::to_string(i)]["round"].get() ==
+              model::Value(2.0));
+    }
+  }
+}
@@ -1,6 +1,9 @@
 #include "catch.hpp"
 #include "seri/object.h"
 #include "seri/array.h"
+#include "seri/dense.h"
+#include "seri/btree/internal.h"
+#include "seri/btree/leaf.h"
 #include "parser.h"
 #include "model/json_print.h"
 #include <boost/filesystem.hpp>
@@ -69,3 +72,338 @@ TEST_CASE("array") {
     }
   }
 }
+
+TEST_CASE("scan of a deep array") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+  const size_t n = 20000;
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta);
+    root = arr.addr();
+    for (size_t i = 0; i < n; ++i)
+      arr.append(model::Value(static_cast<double>(i)));
+    ta.commit(arr.getWrites());
+  }
+
+  // many leafs below several levels of internal nodes, read with readahead
+  model::Collection_base read = disk::ArrayR(db, root).getArray();
+  REQUIRE(read.size() == n);
+  for (size_t i = 0; i < n; ++i)
+    REQUIRE(read[i] == model::Value(static_cast<double>(i)));
+}
+
+TEST_CASE("depth of a large array") {
+  // Counts lower the fanout of internal nodes of 256 bytes from 15 to 9
+  // children, appends leave them about half full. 100k entries need seven
+  // levels there, four in nodes of 1 KiB.
+  const size_t n = 100000;
+  for (auto limit : { std::make_pair(256, 7), std::make_pair(1024, 4) }) {
+    boost::filesystem::remove("test.db");
+    Options options;
+    options.node_size = limit.first;
+    Database db("test.db", options);
+
+    Addr root;
+    {
+      auto ta = db.startTransaction();
+      disk::btree::BtreeWritable arr(ta);
+      root = arr.addr();
+      for (size_t i = 0; i < n; ++i)
+        arr.append(model::Value(static_cast<double>(i)));
+      ta.commit(arr.getWrites());
+    }
+
+    int depth = 1;
+    for (auto addr = root;; ++depth) {
+      auto node = disk::btree::loadNode(db, addr);
+      if (disk::btree::isNodeLeaf(*node)) break;
+      addr = disk::btree::InternalView(*node).first();
+    }
+    REQUIRE(depth <= limit.second);
+
+    disk::btree::BtreeReadOnly read(db, root);
+    REQUIRE(read.count() == n);
+    REQUIRE(read.nth(n - 1)->second ==
+            model::Value(static_cast<double>(n - 1)));
+  }
+}
+
+TEST_CASE("append to the rightmost leaf") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+
+  // new arrays are stored densely, the B-tree is written directly
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::btree::BtreeWritable arr(ta);
+    root = arr.addr();
+    ta.commit(arr.getWrites());
+  }
+  auto append = [&](double val) {
+    auto ta = db.startTransaction();
+    disk::btree::BtreeWritable arr(ta, root);
+    auto key = arr.append(model::Value(val));
+    ta.commit(arr.getWrites());
+    return key;
+  };
+  // the root header points to a leaf without next leaf
+  auto tail = [&] {
+    auto hdr = bytesAsType<disk::btree::DskInternalHdr>(
+        *db.loadBlock<k_min_node_size>(root));
+    REQUIRE(hdr.hasMagic());
+    auto leaf = bytesAsType<disk::btree::DskLeafHdr>(
+        *db.loadBlock<k_min_node_size>(hdr.tail()));
+    REQUIRE(leaf.isSlotted());
+    REQUIRE(leaf.next() == Addr(0));
+    return hdr.tail();
+  };
+  // the counts in the internal nodes follow appends on the fast path
+  auto counted = [&](const model::Collection_base& values) {
+    disk::btree::BtreeReadOnly read(db, root);
+    REQUIRE(read.count() == values.size());
+    for (size_t i = 0; i < values.size(); i += 7)
+      REQUIRE(read.nth(i)->second == values[i]);
+    REQUIRE(!read.nth(values.size()));
+  };
+
+  // one transaction per value, the tail leaf splits many times
+  model::Collection_base expected;
+  for (size_t i = 0; i < 1000; ++i) {
+    REQUIRE(append(static_cast<double>(i)) == Key(i));
+    expected.push_back(model::Value(static_cast<double>(i)));
+  }
+  tail();
+  counted(expected);
+  REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+
+  SECTION("after removing the last values") {
+    {
+      auto ta = db.startTransaction();
+      disk::btree::BtreeWritable arr(ta, root);
+      for (size_t i = 500; i < 1000; ++i) REQUIRE(arr.remove(Key(i)));
+      ta.commit(arr.getWrites());
+    }
+    expected.resize(500);
+    tail();
+    REQUIRE(append(-1.0) == Key(500));
+    expected.push_back(model::Value(-1.0));
+    counted(expected);
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  }
+
+  SECTION("after inserting behind the last value") {
+    {
+      auto ta = db.startTransaction();
+      disk::btree::BtreeWritable arr(ta, root);
+      for (size_t i = 1100; i < 1200; ++i)
+        arr.insert(Key(i), model::Value(true), disk::Overwrite::Insert);
+      ta.commit(arr.getWrites());
+    }
+    tail();
+    REQUIRE(append(-1.0) == Key(1200));
+    REQUIRE(disk::btree::BtreeReadOnly(db, root).count() == 1101);
+  }
+
+  SECTION("mixed in one transaction") {
+    {
+      auto ta = db.startTransaction();
+      disk::btree::BtreeWritable arr(ta, root);
+      REQUIRE(arr.append(model::Value(true)) == Key(1000));
+      REQUIRE(arr.remove(Key(1000)));
+      REQUIRE(arr.append(model::Value(false)) == Key(1000));
+      arr.insert(Key(10), model::Value(true), disk::Overwrite::Update);
+      for (size_t i = 1001; i < 1100; ++i)
+        REQUIRE(arr.append(model::Value(false)) == Key(i));
+      ta.commit(arr.getWrites());
+    }
+    expected[10] = model::Value(true);
+    expected.resize(1100, model::Value(false));
+    tail();
+    counted(expected);
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  }
+}
+
+TEST_CASE("dense array") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta);
+    root = arr.addr();
+    ta.commit(arr.getWrites());
+  }
+  auto isDense = [&] {
+    return disk::dense::isDense(*db.loadBlock<k_min_node_size>(root));
+  };
+  auto value = [](size_t i) -> model::Value {
+    switch (i % 4) {
+    case 0:
+      return model::Value(static_cast<double>(i));
+    case 1:
+      return model::Value(std::to_string(i));
+    case 2:
+      return model::Value(i % 3 == 0);
+    default:
+      return model::Value(model::Null());
+    }
+  };
+
+  // past the root and the first segment, a few values per transaction
+  const size_t n = 3 * disk::dense::kSegmentSlots;
+  model::Collection_base expected;
+  for (size_t i = 0; i < n; i += 10) {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta, root);
+    for (size_t j = i; j < i + 10 && j < n; ++j) {
+      REQUIRE(arr.append(value(j)) == Key(j));
+      expected.push_back(value(j));
+    }
+    ta.commit(arr.getWrites());
+  }
+  REQUIRE(isDense());
+  REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  for (size_t i = 0; i < n; i += 37)
+    REQUIRE(disk::ArrayR(db, root).getChildValue(i) == expected[i]);
+  REQUIRE(disk::ArrayR(db, root).getChildValue(n) ==
+          model::Value(model::Missing()));
+
+  SECTION("update and remove the last values") {
+    {
+      auto ta = db.startTransaction();
+      disk::ArrayW arr(ta, root);
+      REQUIRE(arr.insert(Key(3), model::Value(1.5), disk::Overwrite::Update));
+      REQUIRE_FALSE(arr.insert(Key(4), model::Value(1.5),
+                               disk::Overwrite::Insert));
+      for (size_t i = n; i-- > 10;) REQUIRE(arr.remove(Key(i)));
+      REQUIRE_FALSE(arr.remove(Key(10)));
+      ta.commit(arr.getWrites());
+    }
+    expected[3] = model::Value(1.5);
+    expected.resize(10);
+    REQUIRE(isDense());
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+
+    {
+      auto ta = db.startTransaction();
+      disk::ArrayW arr(ta, root);
+      REQUIRE(arr.append(model::Value(true)) == Key(10));
+      ta.commit(arr.getWrites());
+    }
+    expected.push_back(model::Value(true));
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  }
+
+  SECTION("moved to a B-tree by a hole") {
+    {
+      auto ta = db.startTransaction();
+      disk::ArrayW arr(ta, root);
+      arr.append(parseJson(R"({ "a": [ 1, 2 ] })"));
+      REQUIRE(arr.insert(Key(n + 2), model::Value(true),
+                         disk::Overwrite::Insert));
+      ta.commit(arr.getWrites());
+    }
+    expected.push_back(parseJson(R"({ "a": [ 1, 2 ] })"));
+    expected.push_back(model::Value(model::Missing()));
+    expected.push_back(model::Value(true));
+    REQUIRE_FALSE(isDense());
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  }
+
+  SECTION("strings longer than a slot are stored remotely") {
+    const std::string sixteen{ "sixteen bytes..." };
+    const std::string long_str(100, 'x');
+    {
+      auto ta = db.startTransaction();
+      disk::ArrayW arr(ta, root);
+      REQUIRE(arr.insert(Key(1), model::Value(sixteen),
+                         disk::Overwrite::Update));
+      arr.append(model::Value(long_str));
+      ta.commit(arr.getWrites());
+    }
+    expected[1] = model::Value(sixteen);
+    expected.push_back(model::Value(long_str));
+    REQUIRE(isDense());
+    REQUIRE(disk::ArrayR(db, root).getChildValue(1) == expected[1]);
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+
+    // the remote strings are taken over by the B-tree
+    {
+      auto ta = db.startTransaction();
+      disk::ArrayW arr(ta, root);
+      REQUIRE(arr.remove(Key(0)));
+      ta.commit(arr.getWrites());
+    }
+    expected[0] = model::Value(model::Missing());
+    REQUIRE_FALSE(isDense());
+    REQUIRE(disk::ArrayR(db, root).getArray() == expected);
+  }
+
+  SECTION("destroyed") {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta, root);
+    arr.destroy();
+    ta.commit(arr.getWrites());
+  }
+}
+
+TEST_CASE("array cursor") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+
+  const size_t n = 20000;
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta);
+    root = arr.addr();
+    for (size_t i = 0; i < n; ++i)
+      arr.append(model::Value(static_cast<double>(i)));
+    ta.commit(arr.getWrites());
+  }
+
+  auto check = [&](const std::vector<uint64_t>& indexes) {
+    disk::ArrayR read(db, root);
+    auto cursor = read.cursor();
+    for (auto i : indexes) {
+      REQUIRE(cursor.valid());
+      REQUIRE(cursor.index() == i);
+      REQUIRE(cursor.value() == model::Value(static_cast<double>(i)));
+      cursor.next();
+    }
+    REQUIRE(!cursor.valid());
+
+    cursor.seek(indexes.back());
+    REQUIRE(cursor.index() == indexes.back());
+    cursor.seek(0);
+    REQUIRE(cursor.index() == indexes.front());
+    cursor.seek(n);
+    REQUIRE(!cursor.valid());
+    cursor.seek(n / 2 + 1);
+    REQUIRE(cursor.valid());
+    REQUIRE(cursor.index() >= n / 2 + 1);
+  };
+
+  // stored densely with pages of two levels
+  std::vector<uint64_t> indexes;
+  for (uint64_t i = 0; i < n; ++i) indexes.push_back(i);
+  check(indexes);
+
+  // holes move the array to a B-tree, the cursor skips them
+  {
+    auto ta = db.startTransaction();
+    disk::ArrayW arr(ta, root);
+    for (size_t i = 1; i < n - 1; i += 2) REQUIRE(arr.remove(Key(i)));
+    ta.commit(arr.getWrites());
+  }
+  indexes.clear();
+  for (uint64_t i = 0; i < n; i += 2) indexes.push_back(i);
+  indexes.push_back(n - 1);
+  check(indexes);
+}
@@ -3,9 +3,16 @@
 #endif
 #include "catch.hpp"
 #include "keycache.h"
+#include "seri/model.h"
 #include "seri/object.h"
 #include "parser.h"
+#include "storage.h"
 #include <boost/filesystem.hpp>
+#include <atomic>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
 
 #define private public
 #include "core.h"
@@ -258,3 +265,358 @@ TEST_CASE("B+Tree insert") {
     }
   }
 }
+
+TEST_CASE("readers are not blocked by a transaction in progress") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+  auto parsed = parseJson(input_short);
+  auto& doc = boost::get<model::STuple>(parsed);
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta };
+    root = tree.addr();
+    for (auto& c : *doc)
+      tree.insert(ta.key(c.first), c.second, disk::Overwrite::Upsert);
+    ta.commit(tree.getWrites());
+  }
+
+  auto ta = db.startTransaction();
+  disk::ObjectW tree{ ta, root };
+  tree.insert(ta.key("new"), model::Value(true), disk::Overwrite::Upsert);
+
+  // sees the state before the transaction
+  model::Tuple read;
+  std::thread([&] { read = disk::ObjectR(db, root).getObject(); }).join();
+  REQUIRE(read == *doc);
+
+  ta.commit(tree.getWrites());
+  REQUIRE(disk::ObjectR(db, root).getObject().at("new") == model::Value(true));
+}
+
+TEST_CASE("a commit waits for a long-lived reader") {
+  boost::filesystem::remove("test.db");
+  Database db("test.db");
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta };
+    root = tree.addr();
+    tree.insert(ta.key("a"), model::Value(true), disk::Overwrite::Upsert);
+    ta.commit(tree.getWrites());
+  }
+
+  std::atomic<bool> committed{ false };
+  std::thread writer;
+  {
+    disk::ObjectR reader(db, root);
+    writer = std::thread([&] {
+      auto ta = db.startTransaction();
+      disk::ObjectW tree{ ta, root };
+      tree.insert(ta.key("b"), model::Value(true), disk::Overwrite::Upsert);
+      ta.commit(tree.getWrites());
+      committed = true;
+    });
+
+    // longer than any commit takes, the reader keeps seeing its state
+    for (int i = 0; i < 20; ++i) {
+      REQUIRE(reader.getObject().count("b") == 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE_FALSE(committed);
+  }
+  writer.join();
+
+  auto obj = disk::ObjectR(db, root).getObject();
+  REQUIRE(obj.at("a") == model::Value(true));
+  REQUIRE(obj.at("b") == model::Value(true));
+}
+
+TEST_CASE("B+Tree leafs of version 1 are migrated") {
+  boost::filesystem::remove("test.db");
+  Addr root;
+  {
+    Database db("test.db");
+    auto ta = db.startTransaction();
+    root = ta.alloc(256).addr;
+
+    // leaf in the stream format: header, then entries with their extra words
+    auto entry = [](Key k, uint8_t type) -> uint64_t {
+      return '!' + (static_cast<uint64_t>(type) << 8) + (k.value << 16);
+    };
+    double one = 1;
+    std::array<uint64_t, 32> leaf{};
+    leaf[0] = static_cast<uint64_t>('L') << 56;
+    leaf[1] = entry(ta.key("a"), disk::ValueType::number);
+    leaf[2] = *reinterpret_cast<uint64_t*>(&one);
+    leaf[3] = entry(ta.key("b"), disk::ValueType::null);
+    leaf[4] = entry(ta.key("c"), disk::ValueType::boolean_true);
+    ta.commit({ { root, gsl::as_bytes(gsl::span<uint64_t>(leaf)) } });
+  }
+  {
+    // header of a version 1 file
+    Storage store{ "test.db", OpenMode::open_existing };
+    store.storeWrite({ { Addr(0), magicOfVersion(1) } });
+  }
+
+  Database db("test.db");
+  REQUIRE(bytesAsType<DskDatabaseHdr>(*db.loadPage(PageNr(0))).magic ==
+          k_magic);
+
+  auto expected = parseJson(R"({"a": 1, "b": null, "c": true})");
+  auto& doc = boost::get<model::STuple>(expected);
+  REQUIRE(disk::ObjectR(db, root).getObject() == *doc);
+  REQUIRE(disk::ObjectR(db, root).getChildValue("b") == model::Value(model::Null{}));
+
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta, root };
+    tree.insert(ta.key("d"), model::Value(false), disk::Overwrite::Upsert);
+    ta.commit(tree.getWrites());
+  }
+
+  auto block = db.loadBlock<256>(root);
+  REQUIRE(bytesAsType<uint64_t>(*block) >> 56 == 'S');
+  block.free();
+
+  auto read = disk::ObjectR(db, root).getObject();
+  REQUIRE(read.size() == 4);
+  REQUIRE(read.at("a") == doc->at("a"));
+  REQUIRE(read.at("d") == model::Value(false));
+}
+
+TEST_CASE("B+Tree with large nodes") {
+  boost::filesystem::remove("test.db");
+  const size_t n = 3000;
+  auto name = [](size_t i) { return "key" + std::to_string(i); };
+  auto hdr = [](Database& db, Addr addr) {
+    return bytesAsType<uint64_t>(*db.loadBlock<256>(addr));
+  };
+
+  Addr root;
+  {
+    Options options;
+    options.node_size = 2048;
+    Database db("test.db", options);
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta };
+    root = tree.addr();
+    for (size_t i = 0; i < n; ++i)
+      tree.insert(ta.key(name(i)), model::Value(static_cast<double>(i)),
+                  disk::Overwrite::Upsert);
+    ta.commit(tree.getWrites());
+  }
+
+  // the tree keeps its node size when opened with other options
+  Database db("test.db");
+  auto root_hdr = hdr(db, root);
+  REQUIRE(root_hdr >> 56 == 'C');
+  REQUIRE(((root_hdr >> 48) & 0xff) == 3);
+
+  // fan-out is big enough for the leafs to be children of the root
+  Addr first{ bytesAsType<uint64_t>(db.loadBlock<256>(root)->subspan(8)) };
+  REQUIRE(hdr(db, first) >> 56 == 'S');
+  REQUIRE((hdr(db, first) & 0xff) == 3);
+
+  auto read = disk::ObjectR(db, root).getObject();
+  REQUIRE(read.size() == n);
+  for (size_t i = 0; i < n; ++i)
+    REQUIRE(read.at(name(i)) == model::Value(static_cast<double>(i)));
+  REQUIRE(disk::ObjectR(db, root).getChildValue(name(1234)) ==
+          model::Value(1234.0));
+
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta, root };
+    for (size_t i = 10; i < n; ++i) REQUIRE(tree.remove(name(i)));
+    ta.commit(tree.getWrites());
+  }
+  read = disk::ObjectR(db, root).getObject();
+  REQUIRE(read.size() == 10);
+  REQUIRE(read.at(name(9)) == model::Value(9.0));
+}
+
+TEST_CASE("invalid B-tree node size") {
+  boost::filesystem::remove("test.db");
+  Options options;
+  options.node_size = 1000;
+  REQUIRE_THROWS_AS(Database("test.db", options), DatabaseError);
+  options.node_size = 4096;
+  REQUIRE_THROWS_AS(Database("test.db", options), DatabaseError);
+}
+
+TEST_CASE("B+Tree built bottom-up") {
+  auto name = [](size_t i) { return "key" + std::to_string(i); };
+  auto value = [](size_t i) {
+    if (i % 3 == 0) return model::Value("a string longer than a word " +
+                                        std::to_string(i));
+    return model::Value(static_cast<double>(i));
+  };
+
+  for (size_t node_size : { 256, 512, 2048 }) {
+    for (size_t n : { 0, 5, 200, 5000 }) {
+      boost::filesystem::remove("test.db");
+      Options options;
+      options.node_size = node_size;
+      Database db("test.db", options);
+
+      std::vector<model::Value> values;
+      for (size_t i = 0; i < n; ++i) values.push_back(value(i));
+      Addr root;
+      {
+        auto ta = db.startTransaction();
+        disk::btree::BulkEntries entries;
+        for (size_t i = 0; i < n; ++i)
+          entries.emplace_back(ta.key(name(i)), &values[i]);
+        std::sort(entries.begin(), entries.end(),
+                  [](const disk::btree::BulkEntries::value_type& l,
+                     const disk::btree::BulkEntries::value_type& r) {
+                    return l.first < r.first;
+                  });
+        disk::ObjectW tree{ ta, entries };
+        root = tree.addr();
+        ta.commit(tree.getWrites());
+      }
+
+      // the leafs follow each other in the file
+      Addr leaf = root;
+      while (bytesAsType<uint64_t>(*db.loadBlock<256>(leaf)) >> 56 == 'C')
+        leaf = Addr(bytesAsType<uint64_t>(db.loadBlock<256>(leaf)->subspan(8)));
+      for (;;) {
+        auto hdr = bytesAsType<uint64_t>(*db.loadBlock<256>(leaf));
+        REQUIRE(hdr >> 56 == 'S');
+        Addr next{ hdr & lowerBitmask(48) & ~lowerBitmask(8) };
+        if (next.isNull()) break;
+        REQUIRE(next.value == leaf.value + node_size);
+        leaf = next;
+      }
+
+      auto read = disk::ObjectR(db, root).getObject();
+      REQUIRE(read.size() == n);
+      for (size_t i = 0; i < n; ++i) REQUIRE(read.at(name(i)) == value(i));
+
+      // nodes are at least half full, removing merges them correctly
+      {
+        auto ta = db.startTransaction();
+        disk::ObjectW tree{ ta, root };
+        for (size_t i = 0; i < n; i += 2) REQUIRE(tree.remove(name(i)));
+        for (size_t i = n; i < n + 100; ++i)
+          tree.insert(ta.key(name(i)), value(i), disk::Overwrite::Insert);
+        ta.commit(tree.getWrites());
+      }
+      read = disk::ObjectR(db, root).getObject();
+      REQUIRE(read.size() == n - (n + 1) / 2 + 100);
+      for (size_t i = 1; i < n + 100; i += 2)
+        REQUIRE(read.at(name(i)) == value(i));
+    }
+  }
+}
+
+TEST_CASE("B+Tree entry counts") {
+  boost::filesystem::remove("test.db");
+  auto name = [](size_t i) { return "key" + std::to_string(i); };
+  Options options;
+  options.node_size = 256;
+  Database db("test.db", options);
+
+  std::map<std::string, double> expected;
+  auto check = [&](Addr root) {
+    disk::ObjectR read{ db, root };
+    REQUIRE(read.size() == expected.size());
+    std::set<std::string> seen;
+    for (uint64_t n = 0; n < expected.size(); ++n) {
+      auto entry = read.nth(n);
+      REQUIRE(entry.second == model::Value(expected.at(entry.first)));
+      seen.insert(entry.first);
+    }
+    REQUIRE(seen.size() == expected.size());
+    REQUIRE_THROWS_AS(read.nth(expected.size()), IndexOutOfRangeError);
+  };
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta };
+    root = tree.addr();
+    ta.commit(tree.getWrites());
+  }
+  check(root);
+
+  // splits, merges and balancing in internal nodes keep the counts right
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> dist(0, 1999);
+  for (int round = 0; round < 6; ++round) {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta, root };
+    for (int op = 0; op < 800; ++op) {
+      auto i = dist(gen);
+      if (round % 3 != 2) {
+        tree.insert(ta.key(name(i)), model::Value(static_cast<double>(op)),
+                    disk::Overwrite::Upsert);
+        expected[name(i)] = op;
+      } else {
+        REQUIRE(tree.remove(name(i)) == (expected.erase(name(i)) == 1));
+      }
+    }
+    ta.commit(tree.getWrites());
+    check(root);
+  }
+}
+
+TEST_CASE("object cursor") {
+  boost::filesystem::remove("test.db");
+  auto name = [](size_t i) { return "key" + std::to_string(i); };
+  Options options;
+  options.node_size = 256;
+  Database db("test.db", options);
+
+  Addr root;
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta };
+    root = tree.addr();
+    ta.commit(tree.getWrites());
+  }
+
+  REQUIRE(!disk::ObjectR(db, root).cursor().valid());
+
+  const size_t n = 3000;
+  {
+    auto ta = db.startTransaction();
+    disk::ObjectW tree{ ta, root };
+    for (size_t i = 0; i < n; ++i)
+      tree.insert(ta.key(name(i)), model::Value(static_cast<double>(i)),
+                  disk::Overwrite::Upsert);
+    ta.commit(tree.getWrites());
+  }
+
+  disk::ObjectR read{ db, root };
+  auto all = read.getObject();
+  auto cursor = read.cursor();
+  std::vector<std::string> order;
+  for (; cursor.valid(); cursor.next()) {
+    REQUIRE(cursor.value() == all.at(cursor.key()));
+    order.push_back(cursor.key());
+  }
+  REQUIRE(order.size() == n);
+  // stored order is the order of the key ids, nth agrees
+  REQUIRE(read.nth(1234).first == order[1234]);
+
+  // seek backwards, within the leaf and past the end
+  cursor.seek(order[10]);
+  REQUIRE(cursor.key() == order[10]);
+  cursor.seek(order[11]);
+  REQUIRE(cursor.key() == order[11]);
+  cursor.next();
+  REQUIRE(cursor.key() == order[12]);
+  cursor.seek(order[n - 1]);
+  REQUIRE(cursor.key() == order[n - 1]);
+  cursor.seek(order[0]);
+  REQUIRE(cursor.key() == order[0]);
+  cursor.seek("never used as key");
+  REQUIRE(!cursor.valid());
+  cursor.seek(order[2000]);
+  REQUIRE(cursor.value() == all.at(order[2000]));
+}
@@ -0,0 +1,79 @@
+#include "catch.hpp"
+#include "import.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <parser.h>
+#include <sstream>
+
+using namespace cheesebase;
+
+namespace {
+
+void writeFile(const std::string& name, const std::string& content) {
+  std::ofstream f{ name, std::ios_base::binary | std::ios_base::trunc };
+  f << content;
+}
+
+} // anonymous namespace
+
+TEST_CASE("import of newline delimited JSON") {
+  boost::filesystem::remove("test.db");
+  CheeseBase cb{ "test.db" };
+  std::ostringstream log;
+
+  SECTION("every line is a record, blank lines are skipped") {
+    writeFile("test.jsonl", "{\"id\": \"a\", \"n\": 1}\n"
+                            "\n"
+                            "{\"id\": \"b\", \"n\": [true, null]}\n"
+                            "{\"id\": \"c\", \"n\": \"text\"}\n"
+                            "\n");
+
+    REQUIRE(importJsonLines(cb, "test.jsonl", "arr", boost::none, log) == 3);
+    REQUIRE(cb["arr"].get() ==
+            parseJson(R"([ { "id": "a", "n": 1 },
+                           { "id": "b", "n": [true, null] },
+                           { "id": "c", "n": "text" } ])"));
+
+    REQUIRE(importJsonLines(cb, "test.jsonl", "obj", std::string("id"), log) ==
+            3);
+    REQUIRE(cb["obj"]["b"].get() ==
+            parseJson(R"({ "id": "b", "n": [true, null] })"));
+    REQUIRE(cb["obj"]["c"]["n"].get() == model::Value("text"));
+  }
+
+  SECTION("records are appended to an existing array") {
+    writeFile("test.jsonl", "1\n2");
+    importJsonLines(cb, "test.jsonl", "arr", boost::none, log);
+    REQUIRE(importJsonLines(cb, "test.jsonl", "arr", boost::none, log) == 2);
+    REQUIRE(cb["arr"].get() == parseJson("[1, 2, 1, 2]"));
+  }
+
+  SECTION("a malformed line is reported with its number") {
+    writeFile("test.jsonl", "{\"id\": \"a\"}\n"
+                            "\n"
+                            "{\"id\": \"b\",}\n"
+                            "{\"id\": \"c\"}\n");
+    try {
+      importJsonLines(cb, "test.jsonl", "arr", boost::none, log);
+      FAIL("no error reported");
+    } catch (const std::runtime_error& e) {
+      REQUIRE(std::string(e.what()).find("line 3: ") == 0);
+    }
+  }
+
+  SECTION("a record without the key field is reported") {
+    writeFile("test.jsonl", "{\"id\": \"a\"}\n{\"name\": \"b\"}\n");
+    try {
+      importJsonLines(cb, "test.jsonl", "obj", std::string("id"), log);
+      FAIL("no error reported");
+    } catch (const std::runtime_error& e) {
+      REQUIRE(std::string(e.what()) == "line 2: no string member \"id\"");
+    }
+  }
+
+  SECTION("an empty file imports nothing") {
+    writeFile("test.jsonl", "");
+    REQUIRE(importJsonLines(cb, "test.jsonl", "arr", boost::none, log) == 0);
+    REQUIRE(cb["arr"].get() == parseJson("[]"));
+  }
+}
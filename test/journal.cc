@@ -0,0 +1,133 @@
+#include "catch.hpp"
+#include "journal.h"
+#include "storage.h"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <thread>
+
+using namespace cheesebase;
+
+namespace {
+
+std::vector<Writes> readJournal(Journal& journal) {
+  std::vector<Writes> records;
+  journal.replay([&](const Writes& w) { records.push_back(w); });
+  return records;
+}
+
+uint64_t word(const Write& w) {
+  auto span = boost::get<gsl::span<const Byte>>(w.data);
+  return bytesAsType<uint64_t>(span);
+}
+
+} // anonymous namespace
+
+TEST_CASE("journal") {
+  boost::filesystem::remove("test.journal");
+  const std::string str{ "some string" };
+
+  {
+    Journal journal{ "test.journal" };
+    journal.append({ { Addr(8), 42 }, { Addr(16), 43 } });
+    journal.append(
+        { { Addr(100), gsl::as_bytes(gsl::span<const char>(str)) } });
+  }
+
+  SECTION("records are replayed in order") {
+    Journal journal{ "test.journal" };
+    auto records = readJournal(journal);
+    REQUIRE(records.size() == 2);
+    REQUIRE(records[0].size() == 2);
+    REQUIRE(records[0][0].addr == Addr(8));
+    REQUIRE(word(records[0][0]) == 42);
+    REQUIRE(records[0][1].addr == Addr(16));
+    REQUIRE(word(records[0][1]) == 43);
+    REQUIRE(records[1].size() == 1);
+    REQUIRE(records[1][0].addr == Addr(100));
+    REQUIRE(boost::get<gsl::span<const Byte>>(records[1][0].data) ==
+            gsl::as_bytes(gsl::span<const char>(str)));
+  }
+
+  SECTION("torn record at the end is ignored") {
+    auto size = boost::filesystem::file_size("test.journal");
+    {
+      std::ofstream f{ "test.journal",
+                       std::ios_base::binary | std::ios_base::app };
+      f << "CHSBJRNL partial record";
+    }
+    REQUIRE(boost::filesystem::file_size("test.journal") > size);
+
+    Journal journal{ "test.journal" };
+    REQUIRE(readJournal(journal).size() == 2);
+  }
+
+  SECTION("corrupt record ends the journal") {
+    {
+      std::fstream f{ "test.journal", std::ios_base::binary |
+                                          std::ios_base::in |
+                                          std::ios_base::out };
+      f.seekp(-1, std::ios_base::end);
+      f.put('X');
+    }
+    Journal journal{ "test.journal" };
+    REQUIRE(readJournal(journal).size() == 1);
+  }
+
+  SECTION("reset discards all records") {
+    Journal journal{ "test.journal" };
+    journal.reset();
+    REQUIRE(journal.size() == 0);
+    REQUIRE(readJournal(journal).empty());
+  }
+
+  SECTION("concurrent appends are all durable") {
+    Journal journal{ "test.journal" };
+    journal.reset();
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 8; ++t) {
+      threads.emplace_back([&journal, t] {
+        for (uint64_t i = 0; i < 10; ++i)
+          journal.append({ { Addr(t * 8), i } });
+      });
+    }
+    for (auto& t : threads) t.join();
+    REQUIRE(readJournal(journal).size() == 80);
+  }
+}
+
+TEST_CASE("storage recovers from journal") {
+  boost::filesystem::remove("test.db");
+  { Storage store{ "test.db", OpenMode::create_new }; }
+
+  {
+    // a committed transaction that never made it into the DB file
+    Journal journal{ "test.db.journal" };
+    journal.append({ { Addr(k_page_size * 3 + 8), 0xC0FFEE } });
+  }
+
+  Storage store{ "test.db", OpenMode::open_existing };
+  auto page = store.loadPage(PageNr(3));
+  REQUIRE(bytesAsType<uint64_t>(page->subspan(8)) == 0xC0FFEE);
+  REQUIRE(boost::filesystem::file_size("test.db.journal") == 0);
+}
+
+TEST_CASE("storage keeps the journal when a commit can not be applied") {
+  boost::filesystem::remove("test.db");
+  {
+    Storage store{ "test.db", OpenMode::create_new };
+    // the second write is beyond any possible file size
+    REQUIRE_THROWS(store.storeWrite(
+        { { Addr(k_page_size * 2 + 8), 0xC0FFEE },
+          { Addr((uint64_t(1) << 63) - k_page_size), 1 } }));
+    REQUIRE_THROWS_AS(store.checkpoint(), DatabaseError);
+    REQUIRE_THROWS_AS(store.storeWrite({ Addr(k_page_size * 2), 1 }),
+                      DatabaseError);
+  }
+
+  Journal journal{ "test.db.journal" };
+  auto records = readJournal(journal);
+  REQUIRE(records.size() == 1);
+  REQUIRE(records[0].size() == 2);
+  REQUIRE(records[0][0].addr == Addr(k_page_size * 2 + 8));
+}
@@ -63,8 +63,6 @@ TEST_CASE("parse JSON") {
   REQUIRE(boost::get<model::STuple>(doc.get())->at("test") == model::Value(123.));
 }
 
-// TODO: encoded strings
-/*
 TEST_CASE("parse escaped characters") {
   std::string input = R"( "\"\\\/\b\f\n\r\t" )";
   auto val = parseJson(input);
@@ -72,8 +70,55 @@ TEST_CASE("parse escaped characters") {
 }
 
 TEST_CASE("parse unicode escape") {
-  std::string input = R"( "\u0041" )";
-  auto val = parseJson(input);
-  REQUIRE(val == "A");
+  REQUIRE(parseJson(R"( "\u0041" )") == "A");
+  REQUIRE(parseJson(R"("\u00e4\u20AC")") == "\xc3\xa4\xe2\x82\xac");
+  REQUIRE(parseJson(R"("\ud83d\ude00")") == "\xf0\x9f\x98\x80");
+  REQUIRE_THROWS_AS(parseJson(R"("\ud83d")"), ParserError);
+  REQUIRE_THROWS_AS(parseJson(R"("\ude00")"), ParserError);
+  REQUIRE_THROWS_AS(parseJson(R"("\u00g1")"), ParserError);
+}
+
+TEST_CASE("parse numbers") {
+  auto number = [](const std::string& s) {
+    return boost::get<model::Number>(parseJson(s).get());
+  };
+  REQUIRE(number("0") == 0.0);
+  REQUIRE(number("-12") == -12.0);
+  REQUIRE(number("3.25") == 3.25);
+  REQUIRE(number("0.1") == 0.1);
+  REQUIRE(number("-2.5e-3") == -2.5e-3);
+  REQUIRE(number("1E+2") == 100.0);
+  REQUIRE(number("123456789012345678901") == 123456789012345678901.0);
+  REQUIRE(number("1.7976931348623157e308") == 1.7976931348623157e308);
+  REQUIRE(number("4.9e-324") == 4.9e-324);
+  REQUIRE(number("9007199254740993") == 9007199254740993.0);
+
+  for (auto invalid : { "01", "1.", ".5", "+1", "1e", "-", "- 1", "nan" })
+    REQUIRE_THROWS_AS(parseJson(invalid), ParserError);
+}
+
+TEST_CASE("parse invalid JSON") {
+  for (auto invalid : { "", " ", "{", "[1,]", "[1 2]", R"({"a" 1})",
+                        R"({"a": 1,})", R"({a: 1})", R"("abc)", "tru",
+                        "nul", "[] []", R"("\x")", "\v1", "[1,\f2]" })
+    REQUIRE_THROWS_AS(parseJson(invalid), ParserError);
+  REQUIRE(parseJson(" \t\r\n[1,\n2]\r\n") == parseJson("[1,2]"));
+
+  REQUIRE_THROWS_AS(parseJson(std::string(2000, '[') + std::string(2000, ']')),
+                    ParserError);
+  REQUIRE_NOTHROW(parseJson(std::string(500, '[') + std::string(500, ']')));
+}
+
+TEST_CASE("parse structure") {
+  auto val = parseJson(" \n{ \"b\" : [ true, false, null, missing, { } ],"
+                       "\t\"a\": \"x\", \"a\": \"duplicate\", \"c\": [] }\r\n");
+  auto& tuple = *boost::get<model::STuple>(val.get());
+  REQUIRE(tuple.size() == 3);
+  REQUIRE(tuple.at("a") == "x");
+  REQUIRE(tuple.at("c") == model::Value(model::Collection_base{}));
+
+  model::Collection_base b{ model::Value(true), model::Value(false),
+                            model::Null(), model::Missing(),
+                            model::Tuple_base{} };
+  REQUIRE(tuple.at("b") == model::Value(std::move(b)));
 }
-*/
@@ -0,0 +1,62 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <cheesebase.h>
+#include <parser.h>
+#include <boost/filesystem.hpp>
+#include <iostream>
+
+using namespace cheesebase;
+
+namespace bench {
+
+// usage: batch [records] [file|memory]
+// Inserts small documents into one top level object, each in its own
+// transaction and then in write batches of increasing size.
+int batch(const Args& args) {
+  const size_t amount = args.size() > 0 ? std::stoul(args[0]) : 20000;
+  Options options;
+  options.in_memory = args.size() > 1 && args[1] == "memory";
+  const std::string file{ "bench-batch.db" };
+  const auto doc = parseJson(
+      R"({ "name": "some name", "value": 42, "tags": [ "a", "b", "c" ] })");
+
+  std::cout << "batch size  inserts/s\n";
+  for (size_t size = 1; size <= 10000; size *= 10) {
+    boost::filesystem::remove(file);
+    boost::filesystem::remove(file + ".journal");
+    double seconds;
+    {
+      CheeseBase cb{ file, options };
+      cb.insert("docs", parseJson("{}"));
+      const Location docs{ "docs" };
+
+      auto start = Clock::now();
+      if (size == 1) {
+        for (size_t i = 0; i < amount; ++i)
+          cb.insert("k" + std::to_string(i), doc, docs);
+      } else {
+        WriteBatch batch;
+        for (size_t i = 0; i < amount; ++i) {
+          batch.insert("k" + std::to_string(i), doc, docs);
+          if (batch.size() == size) {
+            cb.write(batch);
+            batch.clear();
+          }
+        }
+        cb.write(batch);
+      }
+      seconds = secondsSince(start);
+    }
+
+    std::cout << size << "\t    "
+              << static_cast<uint64_t>(static_cast<double>(amount) / seconds)
+              << '\n';
+  }
+
+  boost::filesystem::remove(file);
+  boost::filesystem::remove(file + ".journal");
+  return 0;
+}
+
+} // namespace bench
@@ -0,0 +1,36 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Micro benchmarks of the storage engine. Every benchmark is a subcommand of
+// cheesebase-bench and gets the remaining command line arguments.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+using Args = std::vector<std::string>;
+using Clock = std::chrono::steady_clock;
+
+inline double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Read throughput of the page cache with an increasing number of threads.
+int cache(const Args& args);
+
+// Insert throughput with an increasing number of writer threads.
+int insert(const Args& args);
+
+// Insert throughput with an increasing number of inserts per write batch.
+int batch(const Args& args);
+
+// File size and throughput with compressed pages.
+int compress(const Args& args);
+
+// Throughput of the JSON parsers.
+int json(const Args& args);
+
+} // namespace bench
@@ -0,0 +1,71 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <cache.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace cheesebase;
+
+namespace bench {
+
+// usage: cache [max threads] [pages] [seconds per run]
+// All pages fit into the cache, so this measures the cost of cache hits.
+int cache(const Args& args) {
+  const size_t max_threads =
+      args.size() > 0 ? std::stoul(args[0])
+                      : std::max(1u, std::thread::hardware_concurrency());
+  const uint64_t pages = args.size() > 1 ? std::stoull(args[1]) : 4096;
+  const double seconds = args.size() > 2 ? std::stod(args[2]) : 1.0;
+  const std::string file{ "bench-cache.db" };
+
+  {
+    Cache cache{ file, OpenMode::create_always, pages };
+    for (uint64_t i = 0; i < pages; ++i)
+      bytesAsType<uint64_t>(*cache.writePage(PageNr(i))) = i;
+
+    std::cout << "threads  reads/s        per thread\n";
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+      std::atomic<bool> stop{ false };
+      std::atomic<uint64_t> total{ 0 };
+      std::atomic<uint64_t> checksum{ 0 };
+      std::vector<std::thread> workers;
+
+      for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+          std::minstd_rand rand(static_cast<unsigned>(t + 1));
+          uint64_t reads = 0;
+          uint64_t sum = 0;
+          while (!stop.load(std::memory_order_relaxed)) {
+            for (int i = 0; i < 256; ++i) {
+              auto page = cache.readPage(PageNr(rand() % pages));
+              sum += bytesAsType<uint64_t>(*page);
+            }
+            reads += 256;
+          }
+          total += reads;
+          checksum += sum; // keeps the reads from being optimized out
+        });
+      }
+
+      auto start = Clock::now();
+      std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+      stop = true;
+      for (auto& w : workers) w.join();
+      auto rate = static_cast<double>(total) / secondsSince(start);
+
+      std::cout << threads << "\t " << static_cast<uint64_t>(rate) << "\t"
+                << static_cast<uint64_t>(rate / static_cast<double>(threads))
+                << '\n';
+    }
+  }
+
+  boost::filesystem::remove(file);
+  return 0;
+}
+
+} // namespace bench
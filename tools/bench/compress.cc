@@ -0,0 +1,141 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <cheesebase.h>
+#include <lz.h>
+#include <parser.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace cheesebase;
+
+namespace bench {
+
+namespace {
+
+const std::string k_file{ "bench-compress.db" };
+
+void removeFiles() {
+  boost::filesystem::remove(k_file);
+  boost::filesystem::remove(k_file + ".journal");
+  boost::filesystem::remove(k_file + k_page_map_suffix);
+}
+
+model::Value document(size_t i) {
+  return parseJson(R"({ "name": "user )" + std::to_string(i) +
+                   R"(", "city": "Berlin", "score": )" +
+                   std::to_string(static_cast<double>(i % 100) / 4) +
+                   R"(, "tags": [ "a", "b" ] })");
+}
+
+} // anonymous namespace
+
+// usage: compress [documents]
+// Inserts documents into a new database and reads them back with a small
+// cache, once with direct and once with compressed file access. Prints the
+// size of the files and the throughput of both, then the throughput of the
+// codec itself on the pages of the uncompressed file.
+int compress(const Args& args) {
+  const size_t amount = args.size() > 0 ? std::stoul(args[0]) : 20000;
+
+  std::cout << "access      file KB  ratio  inserts/s  reads/s\n";
+  uint64_t direct_size = 0;
+  std::vector<char> pages;
+  for (auto access : { FileAccess::direct, FileAccess::compressed }) {
+    removeFiles();
+    Options options;
+    options.file_access = access;
+
+    double insert_seconds;
+    {
+      CheeseBase cb{ k_file, options };
+      cb.insert("docs", parseJson("{}"));
+      auto docs = cb["docs"];
+      auto start = Clock::now();
+      for (size_t i = 0; i < amount; ++i)
+        docs.insert("k" + std::to_string(i), document(i));
+      insert_seconds = secondsSince(start);
+    }
+
+    uint64_t size = boost::filesystem::file_size(k_file);
+    if (access == FileAccess::compressed) {
+      size += boost::filesystem::file_size(k_file + k_page_map_suffix);
+    } else {
+      direct_size = size;
+      std::ifstream in(k_file, std::ios::binary);
+      pages.assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+    }
+
+    double read_seconds;
+    {
+      options.cache_size = k_page_size * 64;
+      CheeseBase cb{ k_file, options };
+      auto docs = cb["docs"];
+      auto start = Clock::now();
+      for (size_t i = 0; i < amount; ++i) docs["k" + std::to_string(i)].get();
+      read_seconds = secondsSince(start);
+    }
+
+    std::cout << (access == FileAccess::direct ? "direct    " : "compressed")
+              << "  " << size / 1024 << "\t "
+              << static_cast<double>(direct_size) / static_cast<double>(size)
+              << "\t"
+              << static_cast<uint64_t>(static_cast<double>(amount) /
+                                       insert_seconds)
+              << "\t   "
+              << static_cast<uint64_t>(static_cast<double>(amount) /
+                                       read_seconds)
+              << '\n';
+  }
+  removeFiles();
+
+  // the codec alone, on the pages of the uncompressed file
+  const auto count = pages.size() / k_page_size;
+  auto page = [&](size_t i) {
+    return gsl::span<const Byte>(
+        reinterpret_cast<const Byte*>(pages.data() + i * k_page_size),
+        static_cast<std::ptrdiff_t>(k_page_size));
+  };
+  std::vector<Byte> compressed(count * k_page_size);
+  std::vector<size_t> sizes(count);
+  std::vector<Byte> out(k_page_size);
+  const int rounds = 10;
+
+  auto start = Clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < count; ++i) {
+      sizes[i] = lzCompress(
+          page(i), gsl::span<Byte>(compressed.data() + i * k_page_size,
+                                   static_cast<std::ptrdiff_t>(k_page_size)));
+    }
+  }
+  auto compress_seconds = secondsSince(start);
+
+  start = Clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < count; ++i) {
+      if (sizes[i] == 0) continue;
+      lzDecompress(gsl::span<const Byte>(
+                       compressed.data() + i * k_page_size,
+                       static_cast<std::ptrdiff_t>(sizes[i])),
+                   out);
+    }
+  }
+  auto decompress_seconds = secondsSince(start);
+
+  uint64_t total = 0;
+  for (auto s : sizes) total += s == 0 ? k_page_size : s;
+  auto mb = static_cast<double>(count * k_page_size * rounds) / (1 << 20);
+  std::cout << "\ncodec on " << count << " pages: ratio "
+            << static_cast<double>(count * k_page_size) /
+                   static_cast<double>(std::max<uint64_t>(1, total))
+            << ", compress " << static_cast<uint64_t>(mb / compress_seconds)
+            << " MB/s, decompress "
+            << static_cast<uint64_t>(mb / decompress_seconds) << " MB/s\n";
+  return 0;
+}
+
+} // namespace bench
@@ -0,0 +1,62 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <cheesebase.h>
+#include <parser.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+using namespace cheesebase;
+
+namespace bench {
+
+// usage: insert [max threads] [inserts per thread] [file|memory]
+// Every thread inserts small documents into its own top level object.
+int insert(const Args& args) {
+  const size_t max_threads =
+      args.size() > 0 ? std::stoul(args[0])
+                      : std::max(1u, std::thread::hardware_concurrency());
+  const size_t amount = args.size() > 1 ? std::stoul(args[1]) : 2000;
+  Options options;
+  options.in_memory = args.size() > 2 && args[2] == "memory";
+  const std::string file{ "bench-insert.db" };
+  const auto doc = parseJson(
+      R"({ "name": "some name", "value": 42, "tags": [ "a", "b", "c" ] })");
+
+  std::cout << "threads  inserts/s\n";
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    boost::filesystem::remove(file);
+    boost::filesystem::remove(file + ".journal");
+    double seconds;
+    {
+      CheeseBase cb{ file, options };
+      for (size_t t = 0; t < threads; ++t)
+        cb.insert("t" + std::to_string(t), parseJson("{}"));
+
+      std::vector<std::thread> workers;
+      auto start = Clock::now();
+      for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+          auto target = cb["t" + std::to_string(t)];
+          for (size_t i = 0; i < amount; ++i)
+            target.insert("k" + std::to_string(i), doc);
+        });
+      }
+      for (auto& w : workers) w.join();
+      seconds = secondsSince(start);
+    }
+
+    std::cout << threads << "\t "
+              << static_cast<uint64_t>(static_cast<double>(threads * amount) /
+                                       seconds)
+              << '\n';
+  }
+
+  boost::filesystem::remove(file);
+  boost::filesystem::remove(file + ".journal");
+  return 0;
+}
+
+} // namespace bench
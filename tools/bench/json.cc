@@ -0,0 +1,70 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <model/json_read.h>
+#include <model/parser.h>
+#include <iostream>
+
+using namespace cheesebase;
+
+namespace bench {
+
+namespace {
+
+// Text of an array of documents with strings, integers, fractions and nested
+// values, about 200 bytes each.
+std::string documents(size_t amount) {
+  std::string text = "[";
+  for (size_t i = 0; i < amount; ++i) {
+    if (i > 0) text += ",\n";
+    text += R"({ "id": )" + std::to_string(i) + R"(, "name": "user )" +
+            std::to_string(i) + R"(", "email": "user)" + std::to_string(i) +
+            R"(@example.com", "score": )" + std::to_string(i % 1000) + "." +
+            std::to_string(i % 97) + R"(, "active": )" +
+            (i % 3 ? "true" : "false") +
+            R"(, "tags": [ "alpha", "beta", "gamma" ], "address": )"
+            R"({ "city": "Berlin", "zip": 10115, "geo": [ 52.52, 13.405 ] } })";
+  }
+  return text + "]";
+}
+
+model::Value parseGrammar(const std::string& text) {
+  auto it = text.begin();
+  model::Value val;
+  if (!x3::phrase_parse(it, text.end(), parser::value, x3::ascii::space, val) ||
+      it != text.end())
+    throw std::runtime_error("grammar failed to parse the documents");
+  return val;
+}
+
+} // anonymous namespace
+
+// usage: json [documents] [rounds]
+// Parses a JSON text of the given number of documents with the Spirit X3
+// grammar of the query parser and with readJson, prints the throughput of
+// both.
+int json(const Args& args) {
+  const size_t amount = args.size() > 0 ? std::stoul(args[0]) : 20000;
+  const size_t rounds = args.size() > 1 ? std::stoul(args[1]) : 5;
+
+  const auto text = documents(amount);
+  const auto mb = static_cast<double>(text.size() * rounds) / (1 << 20);
+  std::cout << "parsing " << text.size() / 1024 << " KB of JSON " << rounds
+            << " times\n\nparser    MB/s\n";
+
+  if (!(parseGrammar(text) == model::readJson(text.data(), text.size())))
+    throw std::runtime_error("the parsers disagree");
+
+  auto start = Clock::now();
+  for (size_t r = 0; r < rounds; ++r) parseGrammar(text);
+  std::cout << "grammar   " << static_cast<uint64_t>(mb / secondsSince(start))
+            << '\n';
+
+  start = Clock::now();
+  for (size_t r = 0; r < rounds; ++r) model::readJson(text.data(), text.size());
+  std::cout << "readJson  " << static_cast<uint64_t>(mb / secondsSince(start))
+            << '\n';
+  return 0;
+}
+
+} // namespace bench
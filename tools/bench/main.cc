@@ -0,0 +1,30 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "bench.h"
+#include <functional>
+#include <iostream>
+#include <map>
+
+int main(int argc, char** argv) {
+  const std::map<std::string, std::function<int(const bench::Args&)>>
+      benchmarks{ { "cache", bench::cache },
+                  { "insert", bench::insert },
+                  { "batch", bench::batch },
+                  { "compress", bench::compress },
+                  { "json", bench::json } };
+
+  if (argc < 2 || benchmarks.count(argv[1]) == 0) {
+    std::cerr << "usage: " << argv[0] << " <benchmark> [args...]\n"
+              << "benchmarks:";
+    for (auto& b : benchmarks) std::cerr << ' ' << b.first;
+    std::cerr << '\n';
+    return 1;
+  }
+
+  try {
+    return benchmarks.at(argv[1])(bench::Args(argv + 2, argv + argc));
+  } catch (const std::exception& e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return 1;
+  }
+}
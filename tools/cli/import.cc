@@ -0,0 +1,220 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+#include "import.h"
+#include <exceptions.h>
+#include <model/json_read.h>
+#include <parser.h>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace cheesebase;
+namespace bi = boost::interprocess;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Bytes of the file parsed by one task and committed in one transaction.
+const size_t k_chunk_size{ 1 << 20 };
+
+// Parsed chunks per parsing thread waiting to be committed, at most.
+const size_t k_chunks_ahead{ 2 };
+
+// Records of one chunk, either for an array or keyed for an object.
+struct Batch {
+  std::vector<model::Value> values;
+  std::vector<std::pair<std::string, model::Value>> members;
+  size_t lines{ 0 }; // lines of the chunk, up to the error if there is one
+  std::string error;
+
+  size_t rows() const noexcept { return values.size() + members.size(); }
+};
+
+// Split the file into chunks of about k_chunk_size at line ends. Returns the
+// boundaries, chunk i goes from element i to i + 1.
+std::vector<const char*> chunkBounds(const char* begin, const char* end) {
+  std::vector<const char*> bounds{ begin };
+  auto pos = begin;
+  while (static_cast<size_t>(end - pos) > k_chunk_size) {
+    auto eol = static_cast<const char*>(
+        std::memchr(pos + k_chunk_size, '\n', end - pos - k_chunk_size));
+    if (eol == nullptr) break;
+    pos = eol + 1;
+    bounds.push_back(pos);
+  }
+  if (bounds.back() != end) bounds.push_back(end);
+  return bounds;
+}
+
+// Parse the lines of one chunk. Blank lines are skipped, the first invalid
+// record ends the chunk with an error. The error is on the last line counted.
+Batch parseChunk(const char* begin, const char* end,
+                 const boost::optional<std::string>& key_field) {
+  Batch batch;
+  for (auto pos = begin; pos < end;) {
+    auto eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    if (eol == nullptr) eol = end;
+    const auto line = pos;
+    pos = eol + 1;
+    ++batch.lines;
+    if (std::all_of(line, eol, [](unsigned char c) { return std::isspace(c); }))
+      continue;
+
+    try {
+      auto val = model::readJson(line, static_cast<size_t>(eol - line));
+      if (!key_field) {
+        batch.values.push_back(std::move(val));
+        continue;
+      }
+
+      const model::String* key = nullptr;
+      if (auto tuple = boost::get<model::STuple>(&val)) {
+        auto member = (*tuple)->find(*key_field);
+        if (member != (*tuple)->end())
+          key = boost::get<model::String>(&member->second);
+      }
+      if (key == nullptr)
+        throw std::runtime_error("no string member \"" + *key_field + "\"");
+      auto name = *key;
+      batch.members.emplace_back(std::move(name), std::move(val));
+
+    } catch (const std::exception& e) {
+      batch.error = e.what();
+      return batch;
+    }
+  }
+  return batch;
+}
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+uint64_t importJsonLines(CheeseBase& cb, const std::string& file,
+                         const std::string& target,
+                         const boost::optional<std::string>& key_field,
+                         std::ostream& log) {
+  try {
+    cb.insert(target, parseJson(key_field ? "{}" : "[]"));
+  } catch (const CRUDError&) {
+    // exists already, the records are added to it
+  }
+
+  const auto size = boost::filesystem::file_size(file);
+  if (size == 0) return 0;
+
+  bi::file_mapping mapping(file.c_str(), bi::read_only);
+  bi::mapped_region region(mapping, bi::read_only);
+  region.advise(bi::mapped_region::advice_sequential);
+  const auto begin = static_cast<const char*>(region.get_address());
+  const auto end = begin + size;
+
+  const auto bounds = chunkBounds(begin, end);
+  const auto chunks = bounds.size() - 1;
+  const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // The threads parse chunks in any order, this one commits them in order.
+  std::mutex mtx;
+  std::condition_variable parsed_cv;
+  std::condition_variable committed_cv;
+  std::map<size_t, Batch> parsed;
+  size_t next = 0;
+  size_t committed = 0;
+  bool stop = false;
+
+  auto parse = [&] {
+    for (;;) {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lck{ mtx };
+        committed_cv.wait(lck, [&] {
+          return stop || next >= chunks ||
+                 next < committed + threads * k_chunks_ahead;
+        });
+        if (stop || next >= chunks) return;
+        i = next++;
+      }
+      auto batch = parseChunk(bounds[i], bounds[i + 1], key_field);
+      {
+        std::lock_guard<std::mutex> lck{ mtx };
+        parsed.emplace(i, std::move(batch));
+      }
+      parsed_cv.notify_one();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) workers.emplace_back(parse);
+  auto finish = [&] {
+    {
+      std::lock_guard<std::mutex> lck{ mtx };
+      stop = true;
+    }
+    committed_cv.notify_all();
+    for (auto& w : workers) w.join();
+  };
+
+  const auto start = Clock::now();
+  auto last_report = start;
+  uint64_t rows = 0;
+  size_t lines = 0;
+  const Location location{ target };
+  try {
+    for (size_t i = 0; i < chunks; ++i) {
+      Batch batch;
+      {
+        std::unique_lock<std::mutex> lck{ mtx };
+        parsed_cv.wait(lck, [&] { return parsed.count(i) > 0; });
+        batch = std::move(parsed[i]);
+        parsed.erase(i);
+      }
+      lines += batch.lines;
+      if (!batch.error.empty()) {
+        throw std::runtime_error("line " + std::to_string(lines) + ": " +
+                                 batch.error);
+      }
+
+      if (!batch.values.empty()) cb.appendAll(batch.values, location);
+      if (!batch.members.empty()) cb.upsertAll(batch.members, location);
+      rows += batch.rows();
+      {
+        std::lock_guard<std::mutex> lck{ mtx };
+        committed = i + 1;
+      }
+      committed_cv.notify_all();
+
+      if (secondsSince(last_report) >= 1) {
+        last_report = Clock::now();
+        log << "\rimported " << rows << " rows, "
+            << (bounds[i + 1] - begin) * 100 / static_cast<std::ptrdiff_t>(size)
+            << "% of " << (size >> 20) << " MB, "
+            << static_cast<uint64_t>(static_cast<double>(rows) /
+                                     secondsSince(start))
+            << " rows/s" << std::flush;
+      }
+    }
+  } catch (...) {
+    finish();
+    if (last_report != start) log << '\n';
+    throw;
+  }
+  finish();
+
+  const auto seconds = secondsSince(start);
+  if (last_report != start) log << '\n';
+  log << "imported " << rows << " rows in " << seconds << " s, "
+      << static_cast<uint64_t>(static_cast<double>(rows) / seconds)
+      << " rows/s\n";
+  return rows;
+}
@@ -0,0 +1,23 @@
+// Licensed under the Apache License 2.0 (see LICENSE file).
+
+// Bulk import of newline delimited JSON files.
+
+#pragma once
+
+#include <cheesebase.h>
+#include <boost/optional.hpp>
+#include <ostream>
+#include <string>
+
+// Import every line of file as one record into the top level value target.
+// Without key_field the records are appended to the array target, with it
+// they are upserted into the object target under their string member
+// key_field. The target is created if it does not exist yet. Records are
+// parsed in parallel and committed in large batches, progress is written to
+// log. Blank lines are skipped. Returns the number of imported records.
+// Throws std::runtime_error naming the line of the first invalid record,
+// batches committed before it stay imported.
+uint64_t importJsonLines(cheesebase::CheeseBase& cb, const std::string& file,
+                         const std::string& target,
+                         const boost::optional<std::string>& key_field,
+                         std::ostream& log);
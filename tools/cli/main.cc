@@ -1,5 +1,6 @@
 // Licensed under the Apache License 2.0 (see LICENSE file).
 
+#include "import.h"
 #include <cheesebase.h>
 #include <model/json_print.h>
 #include <model/parser.h>
@@ -120,14 +121,24 @@ void inputLoop(cheesebase::CheeseBase& cb) {
 }
 
 int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    std::cout << "Usage: " << (argc > 0 ? argv[0] : "cheesebase-cli")
-              << " <db-file>\n";
+  const bool import = argc > 2 && std::string(argv[2]) == "import";
+  if (argc < 2 || (argc > 2 && !import) || (import && (argc < 5 || argc > 6))) {
+    const auto name = argc > 0 ? argv[0] : "cheesebase-cli";
+    std::cout << "Usage: " << name << " <db-file>\n"
+              << "       " << name
+              << " <db-file> import <json-lines-file> <target> [key-field]\n";
     return 1;
   }
   try {
     cheesebase::CheeseBase cb{ argv[1] };
-    inputLoop(cb);
+    if (import) {
+      importJsonLines(cb, argv[3], argv[4],
+                      argc > 5 ? boost::make_optional(std::string(argv[5]))
+                               : boost::none,
+                      std::cerr);
+    } else {
+      inputLoop(cb);
+    }
   } catch (const std::exception& e) {
     std::cerr << "Error: " << e.what() << "\n";
     return 1;